@@ -0,0 +1,53 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <memory_resource>
+
+/* Monotonic arena for node-based containers that only grow and are dropped whole.
+ *
+ * A std::pmr container given resource() carves its nodes out of a few large
+ * chunks: no malloc per node, nodes inserted together sit together, and
+ * destroying the Arena releases everything at once. Memory freed by the
+ * container is not reused, so this suits tables that only grow, such as
+ * the per-worker count tables and build-time scratch sets.
+ *
+ * bytes_reserved() is the exact footprint: the chunks the arena holds.
+ */
+class Arena {
+public:
+    explicit Arena(std::size_t first_chunk_bytes = 64 * 1024)
+        : _arena_(first_chunk_bytes, &_upstream_) {}
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    std::pmr::memory_resource *resource() { return &_arena_; }
+    std::size_t bytes_reserved() const { return _upstream_.bytes(); }
+
+private:
+    // new/delete, counting what is outstanding.
+    class CountingResource : public std::pmr::memory_resource {
+    public:
+        std::size_t bytes() const { return _bytes_; }
+
+    private:
+        std::size_t _bytes_ = 0;
+
+        void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+            void *p = std::pmr::new_delete_resource()->allocate(bytes, alignment);
+            _bytes_ += bytes;
+            return p;
+        }
+        void do_deallocate(void *p, std::size_t bytes, std::size_t alignment) override {
+            std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+            _bytes_ -= bytes;
+        }
+        bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+    };
+
+    CountingResource _upstream_; // declared first: the arena hands its chunks back on destruction.
+    std::pmr::monotonic_buffer_resource _arena_;
+};
+
+#endif // ARENA_H
@@ -1,31 +1,245 @@
 #include "barcode_index.h"
+#include "arena.h"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <memory_resource>
 #include <sstream>
 #include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <unordered_set>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 /* Building a hamming dictionary to allow for hamming distance 1/2. Mission Bio
  * docs guarantee that the cell barcodes are more than 3 Levenshtein distance apart.
  * https://missionbio.com/wp-content/uploads/2019/10/WhitePaper_MissionBio_TapestriPlatform_RevA.pdf
  * So, we are safe in assuming there will be no collisions if we build a hash table of noisy barcodes
  * back to canonical barcodes.
+ *
+ * Barcodes are packed 2 bits per base (A=0, C=1, G=2, T=3) into an integer key.
+ * A 9 bp cell barcode half has only 4^9 = 262144 possible keys, so noisy keys index
+ * straight into a 512 KB table of uint16_t IDs. The 15 bp antibody tags would need
+ * 4^15 entries, so their ~2k neighbours live in a sorted key array instead
+ * (binary search, ~11 probes).
+ *
+ * Each entry records the edit distance it was generated at (0 exact, 1 one
+ * substitution or one indel, 2 two substitutions). When a noisy key is reachable
+ * from several canonical barcodes, the lowest distance wins (substitutions before
+ * indels); a tie between two different barcodes marks the key ambiguous, and it
+ * is never corrected. With
+ * distance 2 on 9 bp halves that happens for a fair share of keys, which is the
+ * point: a read is only rescued when the correction is unique.
+ *
+ * Indels are seen through the fixed-length window the parser cuts out of the
+ * read. bc1 is anchored at the read start and bc2 right before the R1 motif, so
+ * both left-anchored (window runs into the next base) and right-anchored (window
+ * starts one base early) forms of every single-base insertion and deletion are
+ * stored.
+ *
+ * N can't be packed into 2 bits. It is handled at lookup time instead: each N
+ * counts as one edit, so we try the 4 bases in its place and accept only entries
+ * that leave room for it within the correction distance.
+ *
+ * Building the distance 2 + indel tables takes tens of ms, paid again by every
+ * short per-sample job. load_or_build() keeps the finished tables in a binary
+ * cache file laid out so it can be mmap'd and used in place: a fixed header
+ * (magic, version, byte order, the correction, a hash of the CSV it came from,
+ * a checksum), the barcodes and labels, then the raw table arrays. Any mismatch
+ * just rebuilds from the CSV and rewrites the file.
  */
 
+namespace {
+
+constexpr std::uint8_t N_CODE = 4;
+constexpr std::uint8_t INVALID_CODE = 5;
+
+constexpr std::array<std::uint8_t, 256> make_base_codes() {
+    std::array<std::uint8_t, 256> codes{};
+    for (auto &code : codes) code = INVALID_CODE;
+    codes['A'] = 0;
+    codes['C'] = 1;
+    codes['G'] = 2;
+    codes['T'] = 3;
+    codes['N'] = N_CODE;
+    return codes;
+}
+
+constexpr std::array<std::uint8_t, 256> BASE_CODES = make_base_codes();
+
+/**
+ * @brief pack an ACGT-only barcode, 2 bits per base, first base most significant.
+ */
+std::uint64_t pack_barcode(const std::string &bc) {
+    std::uint64_t key = 0;
+    for (char c : bc) {
+        std::uint8_t code = BASE_CODES[static_cast<unsigned char>(c)];
+        if (code >= N_CODE) {
+            throw std::runtime_error("Invalid base in barcode: " + bc);
+        }
+        key = (key << 2) | code;
+    }
+    return key;
+}
+
+// Tables built in memory, kept alive by _storage_.
+struct BuiltTables {
+    std::vector<std::uint16_t> direct;
+    std::vector<std::uint64_t> keys;
+    std::vector<std::uint16_t> entries;
+};
+
+// Cache file mapping, kept alive by _storage_.
+struct MappedFile {
+    void *data = MAP_FAILED;
+    std::size_t size = 0;
+    ~MappedFile() {
+        if (data != MAP_FAILED) ::munmap(data, size);
+    }
+};
+
+constexpr char CACHE_MAGIC[8] = {'D', 'A', 'B', 'I', 'N', 'D', 'E', 'X'};
+constexpr std::uint32_t CACHE_VERSION = 1; // bump on any layout or entry encoding change.
+constexpr std::uint32_t CACHE_BYTE_ORDER = 0x01020304;
+
+// Host-endian; the byte order marker makes a file from another architecture a miss.
+// Every array offset is 8-byte aligned so the mapped arrays can be read in place.
+struct CacheHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint64_t csv_size;
+    std::uint64_t csv_hash;
+    std::int32_t max_substitutions;
+    std::uint32_t indels;
+    std::uint32_t length;
+    std::uint32_t num_barcodes;
+    std::uint64_t num_entries;
+    std::uint64_t num_ambiguous;
+    std::uint64_t strings_offset;   // per ID: barcode, uint32 label length, label.
+    std::uint64_t strings_bytes;
+    std::uint64_t keys_offset;      // uint64_t[sorted_count]
+    std::uint64_t entries_offset;   // uint16_t[sorted_count]
+    std::uint64_t sorted_count;
+    std::uint64_t direct_offset;    // uint16_t[direct_count]
+    std::uint64_t direct_count;
+    std::uint64_t file_size;
+    std::uint64_t checksum;         // hash of the header up to here, then of everything after it.
+};
+static_assert(std::is_trivially_copyable_v<CacheHeader>);
+
+struct FileCloser {
+    void operator()(std::FILE *f) const { std::fclose(f); }
+};
+using File = std::unique_ptr<std::FILE, FileCloser>;
+
+std::uint64_t align8(std::uint64_t offset) {
+    return (offset + 7) & ~std::uint64_t(7);
+}
+
+/**
+ * @brief whole file as a string, the CSV is hashed for the cache and then parsed.
+ */
+std::string read_csv(const std::string &csv_path) {
+    std::ifstream barcode_csv(csv_path, std::ios::binary); // Open CSV file.
+    if (!barcode_csv) { // Throw error if CSV doesn't open.
+        throw std::runtime_error("Failed to open barcode CSV: " + csv_path);
+    }
+    std::ostringstream text;
+    text << barcode_csv.rdbuf();
+    return text.str();
+}
+
+/**
+ * @brief strip CR / spaces / tabs from both ends, like load_antibody_name_map.
+ */
+std::string trim(const std::string &field) {
+    const std::size_t first = field.find_first_not_of(" \t\r");
+    if (first == std::string::npos) return "";
+    return field.substr(first, field.find_last_not_of(" \t\r") - first + 1);
+}
+
+/**
+ * @brief 64-bit FNV-1a style hash, 8 bytes per step. Used for the CSV fingerprint
+ * and the cache payload checksum, not for anything adversarial.
+ */
+std::uint64_t hash_bytes(const void *data, std::size_t size, std::uint64_t hash = 0xcbf29ce484222325ULL) {
+    constexpr std::uint64_t PRIME = 0x100000001b3ULL;
+    const auto *bytes = static_cast<const unsigned char *>(data);
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        std::uint64_t word;
+        std::memcpy(&word, bytes + i, 8);
+        hash = (hash ^ word) * PRIME;
+        hash ^= hash >> 32;
+    }
+    for (; i < size; i++) {
+        hash = (hash ^ bytes[i]) * PRIME;
+    }
+    return hash;
+}
+
+} // namespace
+
 
 /**
  * @brief Constructor, Barcode Index object.
  * @param csv_path path to csv of antibody/cell barcodes.
+ * @param correction substitution distance (0-2) and whether to add indel neighbours.
  * Loads either:
  * -> 1536 Mission Bio Cell Barcodes (halfs)
  * -> 46 TotalSeq-B antibody barcodes
  */
-BarcodeIndex::BarcodeIndex(const std::string &csv_path) {
-    std::ifstream barcode_csv(csv_path); // Open CSV file.
+BarcodeIndex::BarcodeIndex(const std::string &csv_path, const BarcodeCorrection &correction) {
+    build(read_csv(csv_path), csv_path, correction);
+}
 
-    if (!barcode_csv) { // Throw error if CSV doesn't open.
-        throw std::runtime_error("Failed to open barcode CSV: " + csv_path);
+/**
+ * @brief build an index over barcodes that are not in a CSV file of their own.
+ * 
+ * The list goes through the CSV parser as "barcode," lines, so the checks are
+ * the same: one length for all, duplicates keep the first ID.
+ * 
+ * @param barcodes canonical barcodes, ID = position (duplicates skipped).
+ * @param correction substitution distance (0-2) and whether to add indel neighbours.
+ * @param name what the list is, for error messages.
+ * @return BarcodeIndex with empty labels, not backed by a cache.
+ */
+BarcodeIndex BarcodeIndex::from_barcodes(const std::vector<std::string> &barcodes, const BarcodeCorrection &correction,
+                                         const std::string &name) {
+    std::string csv_text;
+    for (const std::string &bc : barcodes) {
+        csv_text.append(bc).append(",\n");
+    }
+    BarcodeIndex index;
+    index.build(csv_text, name, correction);
+    return index;
+}
+
+/**
+ * @brief parse the CSV text and build the neighbour tables.
+ */
+void BarcodeIndex::build(const std::string &csv_text, const std::string &csv_path, const BarcodeCorrection &correction) {
+    if (correction.max_substitutions < 0 || correction.max_substitutions > 2) {
+        throw std::runtime_error("Barcode correction supports 0-2 substitutions");
     }
+    _correction_ = correction;
+    _max_distance_ = std::max(correction.max_substitutions, correction.indels ? 1 : 0);
+    _csv_size_ = csv_text.size();
+    _csv_hash_ = hash_bytes(csv_text.data(), csv_text.size());
 
+    std::istringstream barcode_csv(csv_text);
     std::string line; // Temp. holder for each line.
+    // Construction only, skips duplicate rows. Views into the arena's copies, all freed at once.
+    Arena arena;
+    std::pmr::unordered_set<std::string_view> seen(arena.resource());
 
     // Loop and parse lines of CSV.
     while (std::getline(barcode_csv, line)) {
@@ -40,24 +254,61 @@ BarcodeIndex::BarcodeIndex(const std::string &csv_path) {
         // -> (2) antibody_bc, antibody_name
         std::string bc = line.substr(0, comma_pos); // Parse barcode from line.
 
-        // ID in CSV list -> potentially build an unordered map.
-        // std::string id_str = line.substr(comma_pos + 1);
-        // int id = std::stoi(id_str); // assuming the ID is an integer, which it is.
+        if (_canonical_barcodes_.empty()) {
+            if (bc.empty() || bc.size() > MAX_LENGTH) {
+                throw std::runtime_error("Unsupported barcode length (1-32 bp): " + line);
+            }
+            _length_ = bc.size();
+            if (_length_ <= DIRECT_TABLE_MAX_LENGTH) {
+                _build_table_.assign(std::size_t(1) << (2 * _length_), EMPTY_ENTRY);
+            }
+        } else if (bc.size() != _length_) {
+            throw std::runtime_error("Barcode length differs from the rest of the CSV: " + line);
+        }
+
+        if (seen.contains(bc)) continue; // Duplicate row, keep the first ID.
+        char *copy = static_cast<char *>(arena.resource()->allocate(bc.size(), 1));
+        seen.insert(std::string_view(static_cast<const char *>(std::memcpy(copy, bc.data(), bc.size())), bc.size()));
+        if (_canonical_barcodes_.size() >= AMBIGUOUS_ID) {
+            throw std::runtime_error("Too many barcodes in " + csv_path);
+        }
+
+        _canonical_barcodes_.push_back(bc); // ID is the position in this vector.
+        _labels_.push_back(trim(line.substr(comma_pos + 1)));
+        add_neighbors(bc); // Building hamming (and indel) neighbors.
+    }
+
+    finish_table();
+}
 
-        _canonical_barcodes_.insert(bc); // Insert barcode into unordered set.
-        add_hamming_neighbors(bc, 1); // Building hamming neighbors, distance 1.
+/**
+ * @brief bytes held by the index: lookup tables (mapped from the cache or built),
+ * plus the barcode and label strings.
+ */
+std::size_t BarcodeIndex::memory_bytes() const {
+    std::size_t bytes = _direct_table_.size_bytes() + _sorted_keys_.size_bytes() + _sorted_entries_.size_bytes();
+    for (const std::vector<std::string> *strings : {&_canonical_barcodes_, &_labels_}) {
+        bytes += strings->capacity() * sizeof(std::string);
+        for (const std::string &text : *strings) {
+            const char *data = text.data();
+            const bool inline_buffer = data >= reinterpret_cast<const char *>(&text) && data < reinterpret_cast<const char *>(&text + 1);
+            if (!inline_buffer) bytes += text.capacity() + 1;
+        }
     }
+    return bytes;
 }
+
 /**
  * @brief check barcode validity.
- * Barcodes are stored in an unordered set, so O(nlogn) search time.
+ * Exact (distance 0) entry in the packed table, so O(1) / O(log n) search time.
  * 
  * @param bc barcode.
  * @return true, barcode in whitelist
  * @return false, barcode not in whitelist.
  */
 bool BarcodeIndex::is_valid(const std::string &bc) const {
-    return _canonical_barcodes_.contains(bc);
+    BarcodeId id = find_id(bc);
+    return id != NO_BARCODE && _canonical_barcodes_[id] == bc;
 }
 
 /**
@@ -66,8 +317,9 @@ bool BarcodeIndex::is_valid(const std::string &bc) const {
  * Cell/antibody barcodes are located at a constant area dependent on
  * Mission Bio chemistry. That area is extracted, and error-corrected
  * using the Hamming Neighbor List. This function maps an observed barcode
- * to it's canonical version. Barcodes are different enough that this causes
- * no collisions.
+ * to it's canonical version. At distance 1 the barcodes are different enough
+ * that this causes no collisions; keys two barcodes reach equally (distance 2,
+ * indels) are marked ambiguous and not corrected.
  * 
  * Eg:
  * -> Mission Bio Cell Barcode, antibody r1
@@ -115,39 +367,424 @@ bool BarcodeIndex::is_valid(const std::string &bc) const {
  * @return false else
  */
 bool BarcodeIndex::find_canonical_barcode(const std::string &observed, std::string &canonical) const {
-    auto iterator = _noisy_to_canonical_.find(observed); // Find noisy barcode in map.
-    if (iterator == _noisy_to_canonical_.end()) { // If it doesn't exist, ignore.
+    BarcodeId id = find_id(observed);
+    if (id == NO_BARCODE) { // If it doesn't exist, ignore.
         return false;
     }
-    canonical = iterator->second; // Canonical will be stored adjacent to observed.
+    canonical = _canonical_barcodes_[id];
     return true;
 }
 
 /**
- * @brief generates a map from noisy barcodes to canonical, if they exist.
+ * @brief map an observed barcode to the ID of its canonical barcode.
+ * 
+ * Same matching as find_canonical_barcode, without building strings: pack the
+ * observed bases and do a single table lookup (4^k when there are k Ns).
+ * 
+ * @param observed potentially noisy observed barcode, e.g. a view into a read.
+ * @return Match canonical ID (NO_BARCODE if nothing, or more than one barcode, is
+ * within the correction distance) and the edit distance it matched at.
+ */
+BarcodeIndex::Match BarcodeIndex::match(std::string_view observed) const {
+    Match result;
+    if (observed.size() != _length_ || _length_ == 0) {
+        return result;
+    }
+
+    std::uint64_t key = 0;
+    unsigned n_shifts[2];
+    unsigned n_count = 0;
+    for (std::size_t i = 0; i < _length_; i++) {
+        std::uint8_t code = BASE_CODES[static_cast<unsigned char>(observed[i])];
+        if (code < N_CODE) {
+            key = (key << 2) | code;
+        } else if (code == N_CODE && n_count < static_cast<unsigned>(_max_distance_)) {
+            n_shifts[n_count++] = 2 * static_cast<unsigned>(_length_ - 1 - i);
+            key <<= 2; // placeholder base, filled in below.
+        } else {
+            return result; // too many Ns or not a base: beyond the correction distance.
+        }
+    }
+
+    auto accept = [&](std::uint16_t entry) {
+        if ((entry & ID_MASK) == AMBIGUOUS_ID) return; // several barcodes equally close.
+        result.id = static_cast<BarcodeId>(entry & ID_MASK);
+        result.mismatches = static_cast<std::uint8_t>(entry_distance(entry) + n_count);
+        result.indel = entry & INDEL_FLAG;
+    };
+
+    if (n_count == 0) {
+        std::uint16_t entry = lookup(key);
+        if (entry != EMPTY_ENTRY) accept(entry);
+        return result;
+    }
+
+    // Each N is one edit, so only entries leaving room for them count. Fold the
+    // probes like insert_entry() does so two equally close barcodes stay ambiguous.
+    std::uint16_t best = EMPTY_ENTRY;
+    const std::uint64_t fills = std::uint64_t(1) << (2 * n_count);
+    for (std::uint64_t fill = 0; fill < fills; fill++) {
+        std::uint64_t probe = key;
+        for (unsigned n = 0; n < n_count; n++) {
+            probe |= ((fill >> (2 * n)) & 3) << n_shifts[n];
+        }
+        std::uint16_t entry = lookup(probe);
+        if (entry == EMPTY_ENTRY || entry_distance(entry) + n_count > static_cast<unsigned>(_max_distance_)) continue;
+        best = combine_entries(best, entry);
+    }
+    if (best != EMPTY_ENTRY) accept(best);
+    return result;
+}
+
+/**
+ * @brief entry stored for a packed key, EMPTY_ENTRY if none.
+ */
+std::uint16_t BarcodeIndex::lookup(std::uint64_t key) const {
+    if (!_direct_table_.empty()) {
+        return _direct_table_[key];
+    }
+    auto it = std::lower_bound(_sorted_keys_.begin(), _sorted_keys_.end(), key);
+    if (it == _sorted_keys_.end() || *it != key) {
+        return EMPTY_ENTRY;
+    }
+    return _sorted_entries_[it - _sorted_keys_.begin()];
+}
+
+/**
+ * @brief the entry to keep when a key is reached twice.
  * 
- * @param bc barcode to generate hamming dictionary for.
- * @param hamming_dist allowed hamming dist.
+ * Lower distance wins, and at equal distance a substitution beats an indel: the
+ * indel windows are looser than true edit distance and would otherwise make
+ * plain one-substitution keys ambiguous. Two different barcodes at the same rank
+ * make the key ambiguous, so a closer barcode can still claim it later.
+ */
+std::uint16_t BarcodeIndex::combine_entries(std::uint16_t slot, std::uint16_t entry) {
+    auto rank = [](std::uint16_t e) { return 2 * entry_distance(e) + ((e & INDEL_FLAG) ? 1 : 0); };
+    if (slot == EMPTY_ENTRY || rank(entry) < rank(slot)) {
+        return entry;
+    }
+    if (rank(entry) == rank(slot) && (entry & ID_MASK) != (slot & ID_MASK)) {
+        return static_cast<std::uint16_t>((slot & ~ID_MASK) | AMBIGUOUS_ID);
+    }
+    return slot;
+}
+
+/**
+ * @brief record a packed key -> entry mapping, see combine_entries().
+ */
+void BarcodeIndex::insert_entry(std::uint64_t key, std::uint16_t entry) {
+    if (_build_table_.empty()) {
+        _pending_entries_.emplace_back(key, entry); // resolved in finish_table().
+        return;
+    }
+    std::uint16_t &slot = _build_table_[key];
+    slot = combine_entries(slot, entry);
+}
+
+/**
+ * @brief count entries, sort pending entries into the key/entry arrays, and hand the
+ * tables to the read-only views used by lookup().
  */
-void BarcodeIndex::add_hamming_neighbors(const std::string &bc, int hamming_dist) {
-    if (hamming_dist != 1) {
-        throw std::runtime_error("Only hamming_dist = 1 supported right now");
+void BarcodeIndex::finish_table() {
+    auto tables = std::make_shared<BuiltTables>();
+    _num_entries_ = 0;
+    _num_ambiguous_ = 0;
+
+    if (!_build_table_.empty()) {
+        for (std::uint16_t entry : _build_table_) {
+            if (entry == EMPTY_ENTRY) continue;
+            _num_entries_++;
+            if ((entry & ID_MASK) == AMBIGUOUS_ID) _num_ambiguous_++;
+        }
+        tables->direct = std::move(_build_table_);
+    } else {
+        // Stable, so within a key the insertion order is preserved for combine_entries().
+        std::stable_sort(_pending_entries_.begin(), _pending_entries_.end(),
+                         [](const auto &a, const auto &b) { return a.first < b.first; });
+
+        for (std::size_t i = 0; i < _pending_entries_.size();) {
+            const std::uint64_t key = _pending_entries_[i].first;
+            std::uint16_t entry = EMPTY_ENTRY;
+            for (; i < _pending_entries_.size() && _pending_entries_[i].first == key; i++) {
+                entry = combine_entries(entry, _pending_entries_[i].second);
+            }
+            tables->keys.push_back(key);
+            tables->entries.push_back(entry);
+            if ((entry & ID_MASK) == AMBIGUOUS_ID) _num_ambiguous_++;
+        }
+        _num_entries_ = tables->keys.size();
     }
-    static const char BASES[] = {'A', 'C', 'G', 'T', 'N'}; // static means there is only one instance of this in the whole program
+    _build_table_ = {};
+    _pending_entries_ = {};
+
+    _direct_table_ = tables->direct;
+    _sorted_keys_ = tables->keys;
+    _sorted_entries_ = tables->entries;
+    _storage_ = std::move(tables);
+}
+
+/**
+ * @brief generates the packed-key entries mapping noisy barcodes to canonical.
+ * 
+ * Exact key, then every key up to correction().max_substitutions substitutions
+ * away, then the indel neighbours if enabled.
+ * 
+ * @param bc barcode to generate the neighbours of, must be the last one pushed.
+ */
+void BarcodeIndex::add_neighbors(const std::string &bc) {
+    const BarcodeId id = static_cast<BarcodeId>(_canonical_barcodes_.size() - 1);
+    const std::uint64_t key = pack_barcode(bc);
 
-    _noisy_to_canonical_.insert({bc, bc}); // Canonical barcode maps to itself.
+    insert_entry(key, make_entry(id, 0, false)); // Canonical barcode maps to itself.
 
     const std::size_t LENGTH = bc.size(); // Barcode length.
+    auto substitute = [](std::uint64_t k, unsigned shift, std::uint64_t base) {
+        return (k & ~(std::uint64_t(3) << shift)) | (base << shift);
+    };
+
+    if (_correction_.max_substitutions >= 1) {
+        for (std::size_t i = 0; i < LENGTH; i++) { // Loop over length of barcode, modifying each base.
+            const unsigned shift_i = 2 * static_cast<unsigned>(LENGTH - 1 - i);
+            const std::uint64_t original_i = (key >> shift_i) & 3;
+
+            for (std::uint64_t base_i = 0; base_i < 4; base_i++) { // Add a variant that is 1 base off for each base.
+                if (base_i == original_i) continue; // skip over original, we only want different bases.
+                // N variants aren't stored, match() resolves them against the stored entries.
+                const std::uint64_t one_off = substitute(key, shift_i, base_i);
+                insert_entry(one_off, make_entry(id, 1, false));
+
+                if (_correction_.max_substitutions < 2) continue;
+                for (std::size_t j = i + 1; j < LENGTH; j++) { // Second substitution, after the first.
+                    const unsigned shift_j = 2 * static_cast<unsigned>(LENGTH - 1 - j);
+                    const std::uint64_t original_j = (key >> shift_j) & 3;
+                    for (std::uint64_t base_j = 0; base_j < 4; base_j++) {
+                        if (base_j == original_j) continue;
+                        insert_entry(substitute(one_off, shift_j, base_j), make_entry(id, 2, false));
+                    }
+                }
+            }
+        }
+    }
+
+    if (_correction_.indels) {
+        add_indel_neighbors(bc, id);
+    }
+}
+
+/**
+ * @brief windows of the barcode's length around a single inserted or deleted base.
+ * 
+ * The base pulled into the window (the read's next or previous base, or the
+ * inserted one) is unknown, so all 4 are stored. Construction only, so plain
+ * strings are fine here.
+ */
+void BarcodeIndex::add_indel_neighbors(const std::string &bc, BarcodeId id) {
+    static const char BASES[] = {'A', 'C', 'G', 'T'};
+    const std::size_t LENGTH = bc.size();
+    const std::uint16_t entry = make_entry(id, 1, true);
+
+    for (std::size_t i = 0; i <= LENGTH; i++) {
+        for (char base : BASES) {
+            // Insertion before position i, seen from the left and from the right end.
+            const std::string inserted = bc.substr(0, i) + base + bc.substr(i);
+            insert_entry(pack_barcode(inserted.substr(0, LENGTH)), entry);
+            insert_entry(pack_barcode(inserted.substr(1)), entry);
+
+            if (i == LENGTH) continue;
+            // Deletion of position i, the window runs one base past either end.
+            const std::string deleted = bc.substr(0, i) + bc.substr(i + 1);
+            insert_entry(pack_barcode(deleted + base), entry);
+            insert_entry(pack_barcode(base + deleted), entry);
+        }
+    }
+}
+
+/**
+ * @brief the index for csv_path, from its binary cache when that is still current.
+ * 
+ * The CSV is always read and hashed (it is small, building from it is what costs), so
+ * an edited whitelist or a different correction never reuses a stale table. Cache
+ * problems never fail the run: the index is built from the CSV instead, and
+ * cache_status() says what happened to the file.
+ * 
+ * @param csv_path path to csv of antibody/cell barcodes.
+ * @param correction substitution distance and indels, part of the cache key.
+ * @param cache_path cache file to map or (re)write, empty to build without one.
+ * @return BarcodeIndex same tables as BarcodeIndex(csv_path, correction).
+ */
+BarcodeIndex BarcodeIndex::load_or_build(const std::string &csv_path, const BarcodeCorrection &correction,
+                                         const std::string &cache_path) {
+    const std::string csv_text = read_csv(csv_path);
+
+    BarcodeIndex index;
+    if (!cache_path.empty()) {
+        index._correction_ = correction;
+        index._csv_size_ = csv_text.size();
+        index._csv_hash_ = hash_bytes(csv_text.data(), csv_text.size());
+        if (index.load_cache(cache_path)) {
+            index._cache_status_ = CacheStatus::LOADED;
+            return index;
+        }
+        index = BarcodeIndex();
+    }
+
+    index.build(csv_text, csv_path, correction);
+    if (!cache_path.empty()) {
+        try {
+            index.save(cache_path);
+            index._cache_status_ = CacheStatus::WRITTEN;
+        } catch (const std::runtime_error &) {
+            index._cache_status_ = CacheStatus::WRITE_FAILED; // e.g. read-only reference directory.
+        }
+    }
+    return index;
+}
+
+/**
+ * @brief cache file next to the CSV, named by the correction so settings don't evict each other.
+ */
+std::string BarcodeIndex::default_cache_path(const std::string &csv_path, const BarcodeCorrection &correction) {
+    return csv_path + ".d" + std::to_string(correction.max_substitutions) + (correction.indels ? "i" : "") + ".idx";
+}
+
+/**
+ * @brief write the tables as a cache file load_or_build() can map.
+ * 
+ * Written to a temporary name and renamed into place, so concurrent jobs sharing a
+ * whitelist never map a half-written file.
+ * 
+ * @param cache_path destination, replaced if it exists.
+ */
+void BarcodeIndex::save(const std::string &cache_path) const {
+    std::string strings;
+    for (std::size_t id = 0; id < _canonical_barcodes_.size(); id++) {
+        const std::uint32_t label_length = static_cast<std::uint32_t>(_labels_[id].size());
+        strings += _canonical_barcodes_[id];
+        strings.append(reinterpret_cast<const char *>(&label_length), sizeof(label_length));
+        strings += _labels_[id];
+    }
 
-    for (std::size_t i = 0; i < LENGTH; i++) { // Loop over length of barcode, modifying each character.
-        char original = bc[i];
+    CacheHeader header{};
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.byte_order = CACHE_BYTE_ORDER;
+    header.csv_size = _csv_size_;
+    header.csv_hash = _csv_hash_;
+    header.max_substitutions = _correction_.max_substitutions;
+    header.indels = _correction_.indels ? 1 : 0;
+    header.length = static_cast<std::uint32_t>(_length_);
+    header.num_barcodes = static_cast<std::uint32_t>(_canonical_barcodes_.size());
+    header.num_entries = _num_entries_;
+    header.num_ambiguous = _num_ambiguous_;
+    header.strings_offset = sizeof(CacheHeader);
+    header.strings_bytes = strings.size();
+    header.keys_offset = align8(header.strings_offset + header.strings_bytes);
+    header.sorted_count = _sorted_keys_.size();
+    header.entries_offset = align8(header.keys_offset + _sorted_keys_.size_bytes());
+    header.direct_offset = align8(header.entries_offset + _sorted_entries_.size_bytes());
+    header.direct_count = _direct_table_.size();
+    header.file_size = header.direct_offset + _direct_table_.size_bytes();
 
-        for (char base : BASES) { // Add a variant that is 1 base off for each base.
-            if (base == original) continue; // skip over original, we only want different bases.
+    // Payload in file order, zero padding included, so the checksum is over exactly what's read back.
+    std::string payload(header.file_size - sizeof(CacheHeader), '\0');
+    auto place = [&](std::uint64_t offset, const void *data, std::size_t bytes) {
+        if (bytes > 0) std::memcpy(payload.data() + (offset - sizeof(CacheHeader)), data, bytes);
+    };
+    place(header.strings_offset, strings.data(), strings.size());
+    place(header.keys_offset, _sorted_keys_.data(), _sorted_keys_.size_bytes());
+    place(header.entries_offset, _sorted_entries_.data(), _sorted_entries_.size_bytes());
+    place(header.direct_offset, _direct_table_.data(), _direct_table_.size_bytes());
+    header.checksum = hash_bytes(payload.data(), payload.size(), hash_bytes(&header, offsetof(CacheHeader, checksum)));
 
-            std::string neighbor = bc; // Set neighbor to original barcode. --> is this 9 or 18?
-            neighbor[i] = base; // Modify with different base.
-            _noisy_to_canonical_.insert({neighbor, bc}); // Map noisy hamming neighbor to canonical barcode.
+    const std::string temp_path = cache_path + ".tmp." + std::to_string(::getpid());
+    {
+        File f(std::fopen(temp_path.c_str(), "wb"));
+        if (!f) {
+            throw std::runtime_error("Failed to create barcode index cache " + temp_path);
+        }
+        bool ok = std::fwrite(&header, sizeof(header), 1, f.get()) == 1 &&
+                  std::fwrite(payload.data(), 1, payload.size(), f.get()) == payload.size();
+        ok = std::fclose(f.release()) == 0 && ok;
+        if (!ok) {
+            std::remove(temp_path.c_str());
+            throw std::runtime_error("Failed to write barcode index cache " + temp_path);
         }
     }
-}
\ No newline at end of file
+    std::error_code error;
+    std::filesystem::rename(temp_path, cache_path, error);
+    if (error) {
+        std::remove(temp_path.c_str());
+        throw std::runtime_error("Failed to replace barcode index cache " + cache_path + ": " + error.message());
+    }
+}
+
+/**
+ * @brief map a cache file and point the tables at it.
+ * 
+ * Expects _correction_, _csv_size_ and _csv_hash_ already set to what the caller wants.
+ * 
+ * @param cache_path file written by save().
+ * @return true if the file is intact and was built from the same CSV and correction.
+ */
+bool BarcodeIndex::load_cache(const std::string &cache_path) {
+    const int fd = ::open(cache_path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    auto mapping = std::make_shared<MappedFile>();
+    if (::fstat(fd, &info) == 0 && static_cast<std::size_t>(info.st_size) >= sizeof(CacheHeader)) {
+        mapping->size = static_cast<std::size_t>(info.st_size);
+        mapping->data = ::mmap(nullptr, mapping->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd); // the mapping stays valid.
+    if (mapping->data == MAP_FAILED) return false;
+    // Lookups hit the direct table at random, fault it all in now rather than on the hot path.
+    ::madvise(mapping->data, mapping->size, MADV_WILLNEED);
+
+    const char *file = static_cast<const char *>(mapping->data);
+    CacheHeader header;
+    std::memcpy(&header, file, sizeof(header));
+
+    const bool header_ok =
+        std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0 && header.version == CACHE_VERSION &&
+        header.byte_order == CACHE_BYTE_ORDER && header.file_size == mapping->size &&
+        header.csv_size == _csv_size_ && header.csv_hash == _csv_hash_ &&
+        header.max_substitutions == _correction_.max_substitutions && (header.indels != 0) == _correction_.indels &&
+        header.length >= 1 && header.length <= MAX_LENGTH && header.num_barcodes < AMBIGUOUS_ID &&
+        header.strings_offset == sizeof(CacheHeader) &&
+        header.keys_offset >= header.strings_offset + header.strings_bytes && header.keys_offset % 8 == 0 &&
+        header.entries_offset >= header.keys_offset + header.sorted_count * sizeof(std::uint64_t) &&
+        header.direct_offset >= header.entries_offset + header.sorted_count * sizeof(std::uint16_t) &&
+        header.direct_offset % 8 == 0 && header.entries_offset % 8 == 0 &&
+        header.direct_offset + header.direct_count * sizeof(std::uint16_t) == header.file_size &&
+        (header.direct_count == 0 ? header.length > DIRECT_TABLE_MAX_LENGTH
+                                  : header.direct_count == (std::uint64_t(1) << (2 * header.length)));
+    if (!header_ok) return false;
+    const std::uint64_t checksum = hash_bytes(file + sizeof(CacheHeader), mapping->size - sizeof(CacheHeader),
+                                              hash_bytes(&header, offsetof(CacheHeader, checksum)));
+    if (checksum != header.checksum) return false;
+
+    // Barcodes and labels are small, copy them out.
+    std::size_t pos = header.strings_offset;
+    const std::size_t strings_end = header.strings_offset + header.strings_bytes;
+    for (std::uint32_t id = 0; id < header.num_barcodes; id++) {
+        std::uint32_t label_length = 0;
+        if (pos + header.length + sizeof(label_length) > strings_end) return false;
+        _canonical_barcodes_.emplace_back(file + pos, header.length);
+        pos += header.length;
+        std::memcpy(&label_length, file + pos, sizeof(label_length));
+        pos += sizeof(label_length);
+        if (pos + label_length > strings_end) return false;
+        _labels_.emplace_back(file + pos, label_length);
+        pos += label_length;
+    }
+
+    _length_ = header.length;
+    _max_distance_ = std::max(_correction_.max_substitutions, _correction_.indels ? 1 : 0);
+    _num_entries_ = header.num_entries;
+    _num_ambiguous_ = header.num_ambiguous;
+    _sorted_keys_ = {reinterpret_cast<const std::uint64_t *>(file + header.keys_offset), header.sorted_count};
+    _sorted_entries_ = {reinterpret_cast<const std::uint16_t *>(file + header.entries_offset), header.sorted_count};
+    _direct_table_ = {reinterpret_cast<const std::uint16_t *>(file + header.direct_offset), header.direct_count};
+    _storage_ = std::move(mapping);
+    return true;
+}
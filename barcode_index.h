@@ -1,28 +1,123 @@
 #ifndef BARCODE_INDEX_H
 #define BARCODE_INDEX_H
 
+#include <cstdint>
+#include <memory>
+#include <span>
 #include <string>
-#include <unordered_set>
-#include <unordered_map>
+#include <string_view>
+#include <vector>
+
+// Which noisy forms of a barcode the index corrects.
+struct BarcodeCorrection {
+    int max_substitutions = 1; // 0, 1 or 2.
+    bool indels = false;       // also one inserted or deleted base, seen through a fixed-length window.
+};
 
 class BarcodeIndex {
 
 public:
+    // Dense ID of a canonical barcode, its row in the CSV (duplicates skipped).
+    using BarcodeId = std::uint16_t;
+    static constexpr BarcodeId NO_BARCODE = 0xFFFF;
+
+    // Canonical ID plus the edit distance it was matched at.
+    struct Match {
+        BarcodeId id = NO_BARCODE;
+        std::uint8_t mismatches = 0; // edits: substitutions, an N, or one indel.
+        bool indel = false;          // matched through an insertion/deletion neighbour.
+    };
+
+    // What load_or_build() did with the binary cache file.
+    enum class CacheStatus { NOT_USED, LOADED, WRITTEN, WRITE_FAILED };
+
     // Prevents implicit conversion.
-    explicit BarcodeIndex(const std::string& csv_path);
+    explicit BarcodeIndex(const std::string& csv_path, const BarcodeCorrection& correction = BarcodeCorrection());
+
+    // Map cache_path if it was built from this exact CSV and correction, else build from the
+    // CSV and (best effort) rewrite the cache. Empty cache_path builds without a cache.
+    static BarcodeIndex load_or_build(const std::string& csv_path, const BarcodeCorrection& correction,
+                                      const std::string& cache_path);
+    // Index over an in-memory list (labels empty), e.g. sample indexes from a sample sheet.
+    // `name` stands in for the CSV path in error messages.
+    static BarcodeIndex from_barcodes(const std::vector<std::string>& barcodes, const BarcodeCorrection& correction,
+                                      const std::string& name);
+    static std::string default_cache_path(const std::string& csv_path, const BarcodeCorrection& correction);
+    void save(const std::string& cache_path) const; // throws std::runtime_error.
+    CacheStatus cache_status() const { return _cache_status_; }
 
     bool is_valid(const std::string& bc) const; // const at the end here means this method is read-only. Doesn't impact class members.
 
+    // Compatibility wrapper around find_id().
     bool find_canonical_barcode(const std::string& observed, std::string& canonical) const; // read only method, doesn't impact class members.
 
+    // Hot path: ID of the one canonical barcode within the correction distance of observed, or NO_BARCODE.
+    BarcodeId find_id(std::string_view observed) const { return match(observed).id; }
+    Match match(std::string_view observed) const;
+
+    const std::string& barcode(BarcodeId id) const { return _canonical_barcodes_[id]; }
+    // Second CSV column, trimmed: the antibody name, or the cell barcode number.
+    const std::string& label(BarcodeId id) const { return _labels_[id]; }
+    std::size_t barcode_length() const { return _length_; }
+    const BarcodeCorrection& correction() const { return _correction_; }
+
     // Get number of canonical barcodes loaded
     std::size_t size() const { return _canonical_barcodes_.size(); }
-    std::size_t hamming_dict_size() const { return _noisy_to_canonical_.size(); }
+    std::size_t hamming_dict_size() const { return _num_entries_; }
+    // Neighbour keys shared by several barcodes at the same distance, never corrected.
+    std::size_t ambiguous_entries() const { return _num_ambiguous_; }
+    // Heap (or mapped) bytes of the tables and strings.
+    std::size_t memory_bytes() const;
 
 private:
-    std::unordered_map <std::string, std::string> _noisy_to_canonical_;
-    std::unordered_set <std::string> _canonical_barcodes_;
-    void add_hamming_neighbors(const std::string& bc, int hamming_dist);
+    // Table entries: [15:14] edit distance, [13] indel neighbour, [12:0] ID.
+    // Distance 3 never occurs, so EMPTY_ENTRY can't collide with a real entry.
+    static constexpr std::uint16_t EMPTY_ENTRY = 0xFFFF;
+    static constexpr unsigned DISTANCE_SHIFT = 14;
+    static constexpr std::uint16_t INDEL_FLAG = 0x2000;
+    static constexpr std::uint16_t ID_MASK = 0x1FFF;
+    static constexpr std::uint16_t AMBIGUOUS_ID = ID_MASK; // several barcodes at the entry's distance.
+    // Barcodes up to this length get a direct-address table of 4^length entries (2 MB at 10),
+    // longer ones a sorted key array.
+    static constexpr std::size_t DIRECT_TABLE_MAX_LENGTH = 10;
+    static constexpr std::size_t MAX_LENGTH = 32; // 2 bits per base in a uint64_t.
+
+    std::vector<std::string> _canonical_barcodes_; // ID -> barcode.
+    std::vector<std::string> _labels_;             // ID -> second CSV column.
+    std::size_t _length_ = 0;
+    BarcodeCorrection _correction_;
+    int _max_distance_ = 1;
+    std::size_t _num_entries_ = 0;
+    std::size_t _num_ambiguous_ = 0;
+    std::uint64_t _csv_size_ = 0;  // CSV the tables were built from, for cache invalidation.
+    std::uint64_t _csv_hash_ = 0;
+    CacheStatus _cache_status_ = CacheStatus::NOT_USED;
+
+    // Read-only tables, either built in memory or mapped from a cache file. _storage_ owns
+    // whichever it is and is shared, so copies of the index stay valid.
+    std::shared_ptr<const void> _storage_;
+    std::span<const std::uint16_t> _direct_table_;    // indexed by packed key.
+    std::span<const std::uint64_t> _sorted_keys_;     // sorted packed keys...
+    std::span<const std::uint16_t> _sorted_entries_;  // ...and their entries.
+
+    // Build scratch, empty once constructed.
+    std::vector<std::uint16_t> _build_table_;
+    std::vector<std::pair<std::uint64_t, std::uint16_t>> _pending_entries_;
+
+    static std::uint16_t make_entry(BarcodeId id, unsigned distance, bool indel) {
+        return static_cast<std::uint16_t>((distance << DISTANCE_SHIFT) | (indel ? INDEL_FLAG : 0) | id);
+    }
+    static unsigned entry_distance(std::uint16_t entry) { return entry >> DISTANCE_SHIFT; }
+    static std::uint16_t combine_entries(std::uint16_t slot, std::uint16_t entry);
+
+    BarcodeIndex() = default;
+    void build(const std::string& csv_text, const std::string& csv_path, const BarcodeCorrection& correction);
+    bool load_cache(const std::string& cache_path);
+    void add_neighbors(const std::string& bc);
+    void add_indel_neighbors(const std::string& bc, BarcodeId id);
+    void insert_entry(std::uint64_t key, std::uint16_t entry);
+    void finish_table();
+    std::uint16_t lookup(std::uint64_t key) const;
 };
 
-#endif // BARCODE_INDEX_H
\ No newline at end of file
+#endif // BARCODE_INDEX_H
@@ -0,0 +1,698 @@
+#include "count_matrix.h"
+#include "dabseq_utilities.h"
+#include "fixed_motif.h"
+#include "fastq_reader.h"
+#include "motif_search.h"
+#include "tsv_writer.h"
+#include "umi_set.h"
+#include <htslib/bgzf.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Microbenchmarks, built and run with `make bench`.
+ *
+ * Reads are synthetic so runs are comparable between builds. The motif search
+ * uses uniform random bases with a small N rate and the motif planted (with a
+ * controlled number of substitutions) in a fraction of them. Everything else
+ * uses a Tapestri-like library: R1 = bc1 + linker + bc2 + R1_START_MOTIF, R2 in
+ * either antibody layout, with a per-base error rate applied to whole reads.
+ * Each stage reports ns/read and reads/s (best of REPEATS).
+ *
+ * Global operator new is replaced to count heap allocations, so the per-read
+ * parse benchmarks can report allocations/read next to the timings.
+ */
+
+static std::atomic<std::size_t> g_allocations{0};
+
+void *operator new(std::size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr std::size_t READ_LENGTH = 150;
+constexpr std::size_t NUM_READS = 200000;
+constexpr int REPEATS = 5;
+
+struct ReadSetConfig {
+    double n_rate = 0.01;       // per-base chance of an N.
+    double planted = 0.7;       // fraction of reads carrying the motif.
+    double error_rate = 0.02;   // per-base substitution rate inside the planted motif.
+};
+
+/**
+ * @brief random reads, some with the motif planted at a random offset.
+ */
+std::vector<std::string> make_reads(const std::string &motif, const ReadSetConfig &config, std::uint32_t seed) {
+    static const char BASES[] = {'A', 'C', 'G', 'T'};
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> base(0, 3);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::uniform_int_distribution<std::size_t> offset(0, READ_LENGTH - motif.size());
+
+    std::vector<std::string> reads(NUM_READS, std::string(READ_LENGTH, 'A'));
+    for (std::string &read : reads) {
+        for (char &c : read) {
+            c = unit(rng) < config.n_rate ? 'N' : BASES[base(rng)];
+        }
+        if (unit(rng) < config.planted) {
+            std::size_t at = offset(rng);
+            for (std::size_t i = 0; i < motif.size(); i++) {
+                read[at + i] = unit(rng) < config.error_rate ? BASES[base(rng)] : motif[i];
+            }
+        }
+    }
+    return reads;
+}
+
+/**
+ * @brief best-of-REPEATS nanoseconds per read for one motif search kernel.
+ */
+double time_kernel(MotifSearchFn search, const std::vector<std::string> &reads, const std::string &motif, std::size_t &checksum) {
+    double best = 1e300;
+    for (int r = 0; r < REPEATS; r++) {
+        std::size_t sum = 0;
+        const auto start = Clock::now();
+        for (const std::string &read : reads) {
+            sum += search(read, motif, 1);
+        }
+        const double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        best = std::min(best, ns / reads.size());
+        checksum = sum;
+    }
+    return best;
+}
+
+/**
+ * @brief find_fixed_motif() behind the MotifSearchFn signature, the motif argument is ignored.
+ */
+template <FixedMotif MOTIF>
+std::size_t fixed_kernel(std::string_view seq, std::string_view, int max_mismatches) {
+    return find_fixed_motif<MOTIF>(seq, max_mismatches);
+}
+
+void bench_motif_search() {
+    std::cout << "[find_with_mismatches, " << READ_LENGTH << " bp reads, 1 mismatch]\n";
+    std::cout << "  dispatched kernel: " << best_motif_search_kernel().name << ", fixed = find_fixed_motif()\n";
+
+    struct Motif {
+        const char *name;
+        const std::string *motif;
+        MotifSearchFn fixed;
+    };
+    const std::vector<Motif> motifs = {
+        {"R1_START_MOTIF", &R1_START_MOTIF, fixed_kernel<R1_START_FIXED>},
+        {"H5_AB_HANDLE", &H5_AB_HANDLE, fixed_kernel<H5_AB_HANDLE_FIXED>},
+        {"H3B_AB_HANDLE", &H3B_AB_HANDLE, fixed_kernel<H3B_AB_HANDLE_FIXED>},
+        {"H3A_AB_HANDLE", &H3A_AB_HANDLE, fixed_kernel<H3A_AB_HANDLE_FIXED>},
+    };
+    std::vector<MotifSearchKernel> kernels = available_motif_search_kernels();
+    kernels.push_back({"fixed", nullptr}); // per motif, filled in below.
+
+    std::cout << "  " << std::left << std::setw(16) << "motif";
+    for (const MotifSearchKernel &kernel : kernels) {
+        std::cout << std::right << std::setw(12) << (std::string(kernel.name) + " ns");
+    }
+    std::cout << std::setw(12) << "speedup" << std::setw(12) << "M reads/s" << "\n";
+
+    std::uint32_t seed = 1;
+    for (const auto &[name, motif, fixed] : motifs) {
+        const std::vector<std::string> reads = make_reads(*motif, ReadSetConfig(), seed++);
+        kernels.back().search = fixed;
+
+        std::cout << "  " << std::left << std::setw(16) << name;
+        double scalar_ns = 0.0;
+        double best_ns = 0.0;
+        std::size_t reference = 0;
+        for (std::size_t k = 0; k < kernels.size(); k++) {
+            std::size_t checksum = 0;
+            double ns = time_kernel(kernels[k].search, reads, *motif, checksum);
+            if (k == 0) {
+                scalar_ns = ns;
+                reference = checksum;
+            } else if (checksum != reference) {
+                std::cout << "\n  MISMATCH: " << kernels[k].name << " disagrees with scalar\n";
+            }
+            best_ns = ns;
+            std::cout << std::right << std::setw(12) << std::fixed << std::setprecision(1) << ns;
+        }
+        std::cout << std::setw(11) << std::setprecision(2) << scalar_ns / best_ns << "x"
+                  << std::setw(12) << std::setprecision(1) << 1e3 / best_ns << "\n";
+    }
+    std::cout << "\n";
+}
+
+std::string random_bases(std::mt19937 &rng, std::size_t length) {
+    static const char BASES[] = {'A', 'C', 'G', 'T'};
+    std::uniform_int_distribution<int> base(0, 3);
+    std::string bases(length, 'A');
+    for (char &c : bases) c = BASES[base(rng)];
+    return bases;
+}
+
+/**
+ * @brief count random barcodes at least min_distance substitutions apart, like a real whitelist.
+ */
+std::vector<std::string> random_whitelist(std::mt19937 &rng, std::size_t count, std::size_t length, std::size_t min_distance) {
+    std::vector<std::string> barcodes;
+    while (barcodes.size() < count) {
+        std::string candidate = random_bases(rng, length);
+        bool far_enough = true;
+        for (const std::string &bc : barcodes) {
+            std::size_t distance = 0;
+            for (std::size_t i = 0; i < length; i++) distance += candidate[i] != bc[i];
+            if (distance < min_distance) {
+                far_enough = false;
+                break;
+            }
+        }
+        if (far_enough) barcodes.push_back(candidate);
+    }
+    return barcodes;
+}
+
+/**
+ * @brief path for a scratch file in the system temp directory.
+ */
+std::string temp_path(const std::string &name) {
+    return (std::filesystem::temp_directory_path() / ("dabseq_bench_" + name)).string();
+}
+
+/**
+ * @brief write a one-barcode-per-line whitelist CSV.
+ */
+void write_whitelist(const std::string &path, const std::vector<std::string> &barcodes) {
+    std::ofstream out(path);
+    for (std::size_t i = 0; i < barcodes.size(); i++) {
+        out << barcodes[i] << "," << i + 1 << "\n";
+    }
+}
+
+/**
+ * @brief mutate each base with probability error_rate (N included), like sequencing errors.
+ */
+void add_errors(std::string &read, std::mt19937 &rng, double error_rate) {
+    static const char CALLS[] = {'A', 'C', 'G', 'T', 'N'};
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::uniform_int_distribution<int> call(0, 4);
+    for (char &c : read) {
+        if (unit(rng) < error_rate) c = CALLS[call(rng)];
+    }
+}
+
+/* Whitelists and NUM_READS read pairs. 80% of R1 reads carry a whitelisted
+ * cell, 60% of R2 reads the H5/H3B layout and 20% the H3A layout. Whitelist
+ * CSVs live in the temp directory for the lifetime of the library.
+ */
+struct Library {
+    std::vector<std::string> cells;
+    std::vector<std::string> antibodies;
+    std::string cells_csv = temp_path("cells.csv");
+    std::string antibodies_csv = temp_path("antibodies.csv");
+    std::vector<std::string> r1_reads;
+    std::vector<std::string> r2_reads;
+
+    Library() = default;
+    Library(const Library &) = delete;
+    Library &operator=(const Library &) = delete;
+    ~Library() {
+        std::filesystem::remove(cells_csv);
+        std::filesystem::remove(antibodies_csv);
+    }
+};
+
+void fill_library(Library &library, double error_rate, std::uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::mt19937 whitelist_rng(7); // same whitelists at every error rate.
+
+    library.cells = random_whitelist(whitelist_rng, 1536, 9, 3);
+    library.antibodies = random_whitelist(whitelist_rng, 46, 15, 3);
+    write_whitelist(library.cells_csv, library.cells);
+    write_whitelist(library.antibodies_csv, library.antibodies);
+
+    std::uniform_int_distribution<std::size_t> pick_cell(0, library.cells.size() - 1);
+    std::uniform_int_distribution<std::size_t> pick_antibody(0, library.antibodies.size() - 1);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    library.r1_reads.assign(NUM_READS, std::string());
+    library.r2_reads.assign(NUM_READS, std::string());
+    for (std::size_t i = 0; i < NUM_READS; i++) {
+        std::string r1 = unit(rng) < 0.8 ? library.cells[pick_cell(rng)] + "AGTACGTACGAGTC" +
+                                           library.cells[pick_cell(rng)] + R1_START_MOTIF : "";
+        r1 += random_bases(rng, READ_LENGTH);
+        r1.resize(READ_LENGTH);
+        add_errors(r1, rng, error_rate);
+        library.r1_reads[i] = r1;
+
+        const double layout = unit(rng);
+        const std::string &antibody = library.antibodies[pick_antibody(rng)];
+        std::string r2 = layout < 0.6 ? random_bases(rng, 5) + H5_AB_HANDLE + antibody + H3B_AB_HANDLE
+                       : layout < 0.8 ? antibody + H3A_AB_HANDLE : "";
+        r2 += random_bases(rng, READ_LENGTH);
+        r2.resize(READ_LENGTH);
+        add_errors(r2, rng, error_rate);
+        library.r2_reads[i] = r2;
+    }
+}
+
+struct PerRead {
+    double ns = 0.0;
+    double allocations = 0.0;
+};
+
+/**
+ * @brief best-of-REPEATS ns/read and heap allocations/read of parse(read).
+ */
+template <typename Parse>
+PerRead time_per_read(const std::vector<std::string> &reads, Parse parse, std::size_t &checksum) {
+    PerRead best{1e300, 0.0};
+    for (int r = 0; r < REPEATS; r++) {
+        std::size_t sum = 0;
+        const std::size_t allocations_before = g_allocations.load(std::memory_order_relaxed);
+        const auto start = Clock::now();
+        for (const std::string &read : reads) {
+            sum += parse(std::string_view(read));
+        }
+        const double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        const std::size_t allocations = g_allocations.load(std::memory_order_relaxed) - allocations_before;
+        best.ns = std::min(best.ns, ns / reads.size());
+        best.allocations = static_cast<double>(allocations) / reads.size();
+        checksum = sum;
+    }
+    return best;
+}
+
+/**
+ * @brief best-of-REPEATS ns/item and allocations/item of one run(), which handles `items` items.
+ */
+template <typename Run>
+PerRead time_per_item(std::size_t items, Run run) {
+    PerRead best{1e300, 0.0};
+    for (int r = 0; r < REPEATS; r++) {
+        const std::size_t allocations_before = g_allocations.load(std::memory_order_relaxed);
+        const auto start = Clock::now();
+        run();
+        const double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        const std::size_t allocations = g_allocations.load(std::memory_order_relaxed) - allocations_before;
+        if (ns / items < best.ns) {
+            best.ns = ns / items;
+            best.allocations = static_cast<double>(allocations) / items;
+        }
+    }
+    return best;
+}
+
+void print_table_header(const char *first_column, const char *unit) {
+    std::cout << "  " << std::left << std::setw(34) << first_column << std::right
+              << std::setw(10) << (std::string("ns/") + unit)
+              << std::setw(12) << (std::string("M ") + unit + "s/s")
+              << std::setw(14) << (std::string("allocs/") + unit) << "\n";
+}
+
+void print_per_read(const std::string &name, const PerRead &result) {
+    std::cout << "  " << std::left << std::setw(34) << name << std::right << std::fixed
+              << std::setw(10) << std::setprecision(1) << result.ns
+              << std::setw(12) << std::setprecision(2) << 1e3 / result.ns
+              << std::setw(14) << std::setprecision(3) << result.allocations << "\n";
+}
+
+void bench_parse() {
+    std::cout << "[Read parsing, " << NUM_READS << " synthetic " << READ_LENGTH << " bp reads]\n";
+    print_table_header("function @ per-base error rate", "read");
+
+    for (double error_rate : {0.001, 0.01, 0.05}) {
+        Library library;
+        fill_library(library, error_rate, 11);
+        const BarcodeIndex cell_barcodes(library.cells_csv);
+        const BarcodeIndex antibody_barcodes(library.antibodies_csv);
+
+        std::ostringstream suffix;
+        suffix << " @ " << error_rate;
+
+        std::size_t string_checksum = 0;
+        std::size_t pod_checksum = 0;
+        print_per_read("parse_barcodes_from_r1" + suffix.str(), time_per_read(library.r1_reads, [&](std::string_view read) {
+            ParsedBarcode parsed = parse_barcodes_from_r1(read, cell_barcodes);
+            return parsed.valid ? std::size_t(parsed.bc1_id) + parsed.bc2_id : 0;
+        }, string_checksum));
+        print_per_read("match_barcodes_in_r1" + suffix.str(), time_per_read(library.r1_reads, [&](std::string_view read) {
+            CellBarcodeHit hit = match_barcodes_in_r1(read, cell_barcodes);
+            return hit.valid ? std::size_t(hit.bc1_id) + hit.bc2_id : 0;
+        }, pod_checksum));
+        if (string_checksum != pod_checksum) std::cout << "  MISMATCH: R1 parse results differ\n";
+
+        print_per_read("parse_antibody_from_r2" + suffix.str(), time_per_read(library.r2_reads, [&](std::string_view read) {
+            ParsedAntibody parsed = parse_antibody_from_r2(read, antibody_barcodes);
+            return parsed.valid ? std::size_t(parsed.id) + 1 : 0;
+        }, string_checksum));
+        print_per_read("match_antibody_in_r2" + suffix.str(), time_per_read(library.r2_reads, [&](std::string_view read) {
+            AntibodyHit hit = match_antibody_in_r2(read, antibody_barcodes);
+            return hit.valid ? std::size_t(hit.id) + 1 : 0;
+        }, pod_checksum));
+        if (string_checksum != pod_checksum) std::cout << "  MISMATCH: R2 parse results differ\n";
+    }
+    std::cout << "\n";
+}
+
+/**
+ * @brief write reads as FASTQ, through BGZF when compressed.
+ */
+void write_fastq(const std::string &path, const std::vector<std::string> &reads, const char *mate, bool compressed) {
+    std::string text;
+    const std::string quality(READ_LENGTH, 'F');
+    for (std::size_t i = 0; i < reads.size(); i++) {
+        text += "@BENCH:1:FLOWCELL:1:1101:" + std::to_string(i) + ":1 " + mate + ":N:0:GAAAGATC+AGTCGAAT\n";
+        text += reads[i] + "\n+\n" + quality + "\n";
+    }
+
+    if (!compressed) {
+        std::ofstream(path, std::ios::binary).write(text.data(), static_cast<std::streamsize>(text.size()));
+        return;
+    }
+    BGZF *out = bgzf_open(path.c_str(), "w");
+    if (!out || bgzf_write(out, text.data(), text.size()) != static_cast<ssize_t>(text.size())) {
+        throw std::runtime_error("Failed to write " + path);
+    }
+    bgzf_close(out);
+}
+
+void bench_reader(const Library &library) {
+    std::cout << "[FastqPairReader, " << NUM_READS << " pairs of " << READ_LENGTH << " bp]\n";
+    print_table_header("method / input", "pair");
+
+    for (bool compressed : {false, true}) {
+        const std::string suffix = compressed ? ".fastq.gz" : ".fastq";
+        const std::string r1_path = temp_path("R1" + suffix);
+        const std::string r2_path = temp_path("R2" + suffix);
+        write_fastq(r1_path, library.r1_reads, "1", compressed);
+        write_fastq(r2_path, library.r2_reads, "2", compressed);
+        const std::string label = compressed ? " / gz" : " / plain";
+
+        std::size_t pairs = 0;
+        PerRead per_record = time_per_item(NUM_READS, [&]() {
+            FastqPairReader reader(r1_path, r2_path);
+            FastqPairReader::FastqPair pair;
+            pairs = 0;
+            while (reader.next_record(pair) == FastqPairReader::ReadStatus::OK) pairs++;
+        });
+        print_per_read("next_record" + label, per_record);
+        if (pairs != NUM_READS) std::cout << "  MISMATCH: next_record read " << pairs << " pairs\n";
+
+        bool mapped = false;
+        PerRead per_batch = time_per_item(NUM_READS, [&]() {
+            FastqPairReader reader(r1_path, r2_path);
+            FastqPairReader::RecordBatch batch;
+            pairs = 0;
+            while (reader.next_batch(batch, 4096) == FastqPairReader::ReadStatus::OK) pairs += batch.size();
+            mapped = reader.r1_memory_mapped();
+        });
+        print_per_read("next_batch(4096)" + label + (mapped ? " (mmap)" : ""), per_batch);
+        if (pairs != NUM_READS) std::cout << "  MISMATCH: next_batch read " << pairs << " pairs\n";
+
+        PerRead per_batch_spot = time_per_item(NUM_READS, [&]() {
+            FastqPairReader reader(r1_path, r2_path);
+            reader.set_pair_check(FastqPairReader::PairCheck::BATCH_ENDS);
+            FastqPairReader::RecordBatch batch;
+            pairs = 0;
+            while (reader.next_batch(batch, 4096) == FastqPairReader::ReadStatus::OK) pairs += batch.size();
+        });
+        print_per_read("next_batch, batch-end check" + label, per_batch_spot);
+        if (pairs != NUM_READS) std::cout << "  MISMATCH: next_batch read " << pairs << " pairs\n";
+
+        std::filesystem::remove(r1_path);
+        std::filesystem::remove(r2_path);
+    }
+    std::cout << "\n";
+}
+
+void bench_barcode_index(const Library &library) {
+    std::cout << "[BarcodeIndex, " << library.cells.size() << " x 9 bp cell barcodes]\n";
+
+    const std::size_t BUILDS = 20;
+    std::size_t built_size = 0;
+    PerRead build = time_per_item(BUILDS, [&]() {
+        for (std::size_t i = 0; i < BUILDS; i++) {
+            BarcodeIndex index(library.cells_csv);
+            built_size = index.size();
+        }
+    });
+    if (built_size != library.cells.size()) std::cout << "  MISMATCH: index holds " << built_size << " barcodes\n";
+    std::cout << "  construction: " << std::fixed << std::setprecision(2) << build.ns / 1e6 << " ms\n";
+
+    const BarcodeCorrection wide{2, true};
+    PerRead wide_build = time_per_item(BUILDS, [&]() {
+        for (std::size_t i = 0; i < BUILDS; i++) {
+            BarcodeIndex index(library.cells_csv, wide);
+            built_size = index.hamming_dict_size();
+        }
+    });
+    std::cout << "  construction, 2 substitutions + indels: " << wide_build.ns / 1e6 << " ms (" << built_size << " entries)\n";
+
+    const std::string cache_path = (std::filesystem::temp_directory_path() / "bench_dabseq_cells.idx").string();
+    BarcodeIndex::load_or_build(library.cells_csv, wide, cache_path); // writes the cache.
+    bool from_cache = true;
+    PerRead cached = time_per_item(BUILDS, [&]() {
+        for (std::size_t i = 0; i < BUILDS; i++) {
+            BarcodeIndex index = BarcodeIndex::load_or_build(library.cells_csv, wide, cache_path);
+            from_cache = from_cache && index.cache_status() == BarcodeIndex::CacheStatus::LOADED;
+        }
+    });
+    std::filesystem::remove(cache_path);
+    if (!from_cache) std::cout << "  MISMATCH: index cache was not used\n";
+    std::cout << "  load from index cache, 2 substitutions + indels: " << cached.ns / 1e6 << " ms\n";
+
+    const BarcodeIndex index(library.cells_csv);
+    const BarcodeIndex wide_index(library.cells_csv, wide);
+    std::mt19937 rng(5);
+    std::uniform_int_distribution<std::size_t> pick(0, library.cells.size() - 1);
+    std::uniform_int_distribution<std::size_t> position(0, 8);
+    static const char BASES[] = {'A', 'C', 'G', 'T'};
+    std::uniform_int_distribution<int> base(0, 3);
+
+    std::vector<std::pair<const char *, std::vector<std::string>>> query_sets = {
+        {"find_id / exact", {}}, {"find_id / 1 substitution", {}}, {"find_id / 1 N", {}}, {"find_id / random", {}}};
+    for (std::size_t i = 0; i < NUM_READS; i++) {
+        std::string bc = library.cells[pick(rng)];
+        query_sets[0].second.push_back(bc);
+        std::string substituted = bc;
+        char &c = substituted[position(rng)];
+        c = BASES[(std::string_view("ACGT").find(c) + 1 + base(rng) % 3) % 4];
+        query_sets[1].second.push_back(substituted);
+        std::string with_n = bc;
+        with_n[position(rng)] = 'N';
+        query_sets[2].second.push_back(with_n);
+        query_sets[3].second.push_back(random_bases(rng, 9));
+    }
+
+    print_table_header("lookup", "lookup");
+    for (const auto &[name, queries] : query_sets) {
+        std::size_t checksum = 0;
+        print_per_read(name, time_per_read(queries, [&](std::string_view query) {
+            return std::size_t(index.find_id(query));
+        }, checksum));
+    }
+    for (const auto &[name, queries] : query_sets) {
+        std::size_t checksum = 0;
+        print_per_read(std::string("2 subs+indels ") + name, time_per_read(queries, [&](std::string_view query) {
+            return std::size_t(wide_index.find_id(query));
+        }, checksum));
+    }
+    std::cout << "\n";
+}
+
+void bench_aggregation(const Library &library) {
+    std::cout << "[CountMatrix aggregation, " << NUM_READS << " countable reads]\n";
+
+    // 2000 real cells get 90% of the reads, the rest fall on random barcode pairs (noise cells).
+    std::mt19937 rng(9);
+    std::uniform_int_distribution<std::size_t> pick_cell(0, library.cells.size() - 1);
+    std::uniform_int_distribution<std::size_t> pick_real(0, 1999);
+    std::uniform_int_distribution<std::size_t> pick_antibody(0, library.antibodies.size() - 1);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::vector<std::pair<BarcodeIndex::BarcodeId, BarcodeIndex::BarcodeId>> real_cells(2000);
+    for (auto &cell : real_cells) {
+        cell = {static_cast<BarcodeIndex::BarcodeId>(pick_cell(rng)), static_cast<BarcodeIndex::BarcodeId>(pick_cell(rng))};
+    }
+    struct Hit {
+        BarcodeIndex::BarcodeId bc1, bc2, antibody;
+    };
+    std::vector<Hit> hits(NUM_READS);
+    for (Hit &hit : hits) {
+        auto cell = unit(rng) < 0.9 ? real_cells[pick_real(rng)]
+                                    : std::make_pair(static_cast<BarcodeIndex::BarcodeId>(pick_cell(rng)),
+                                                     static_cast<BarcodeIndex::BarcodeId>(pick_cell(rng)));
+        hit = {cell.first, cell.second, static_cast<BarcodeIndex::BarcodeId>(pick_antibody(rng))};
+    }
+
+    print_table_header("operation", "read");
+    std::size_t cells = 0;
+    print_per_read("CountMatrix::add", time_per_item(hits.size(), [&]() {
+        CountMatrix counts(library.antibodies.size());
+        for (const Hit &hit : hits) counts.add(hit.bc1, hit.bc2, hit.antibody);
+        cells = counts.num_cells();
+    }));
+
+    // 8 worker-sized partial tables, merged as the pipeline does at the end.
+    const std::size_t PARTS = 8;
+    std::vector<CountMatrix> parts(PARTS, CountMatrix(library.antibodies.size()));
+    for (std::size_t i = 0; i < hits.size(); i++) {
+        parts[i % PARTS].add(hits[i].bc1, hits[i].bc2, hits[i].antibody);
+    }
+    std::size_t merged_cells = 0;
+    print_per_read("CountMatrix::merge (8 parts)", time_per_item(hits.size(), [&]() {
+        CountMatrix total(library.antibodies.size());
+        for (const CountMatrix &part : parts) total.merge(part);
+        merged_cells = total.num_cells();
+    }));
+    if (merged_cells != cells) std::cout << "  MISMATCH: merged table has " << merged_cells << " cells, expected " << cells << "\n";
+
+    // Same reads with a 10 bp UMI each, every molecule read twice on average.
+    std::uniform_int_distribution<std::uint32_t> pick_umi(0, (1u << 20) - 1);
+    std::vector<std::uint64_t> umi_keys(hits.size());
+    for (std::size_t i = 0; i < hits.size(); i++) {
+        const Hit &hit = i % 2 == 1 ? hits[i - 1] : hits[i];
+        umi_keys[i] = i % 2 == 1 ? umi_keys[i - 1] : UmiSet::key(hit.bc1, hit.bc2, hit.antibody, pick_umi(rng));
+    }
+    std::size_t unique_umis = 0;
+    std::size_t umi_bytes = 0;
+    print_per_read("UmiSet::insert (2 reads/UMI)", time_per_item(umi_keys.size(), [&]() {
+        UmiSet umis;
+        for (std::uint64_t key : umi_keys) umis.insert(key);
+        unique_umis = umis.size();
+        umi_bytes = umis.memory_bytes();
+    }));
+    std::cout << "  " << cells << " distinct cells, " << unique_umis << " UMIs in " << std::fixed << std::setprecision(1)
+              << umi_bytes / 1e6 << " MB\n\n";
+}
+
+/**
+ * @brief aggregation alone at 1-64 threads: private tables per thread, then CountMatrix::merge_all().
+ */
+void bench_aggregation_scaling(const Library &library) {
+    const std::size_t READS = 8 * NUM_READS;
+    std::mt19937 rng(13);
+    std::uniform_int_distribution<std::size_t> pick_cell(0, library.cells.size() - 1);
+    std::uniform_int_distribution<std::size_t> pick_real(0, 1999);
+    std::uniform_int_distribution<std::size_t> pick_antibody(0, library.antibodies.size() - 1);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::vector<std::pair<BarcodeIndex::BarcodeId, BarcodeIndex::BarcodeId>> real_cells(2000);
+    for (auto &cell : real_cells) {
+        cell = {static_cast<BarcodeIndex::BarcodeId>(pick_cell(rng)), static_cast<BarcodeIndex::BarcodeId>(pick_cell(rng))};
+    }
+    struct Hit {
+        BarcodeIndex::BarcodeId bc1, bc2, antibody;
+    };
+    std::vector<Hit> hits(READS);
+    for (Hit &hit : hits) {
+        auto cell = unit(rng) < 0.9 ? real_cells[pick_real(rng)]
+                                    : std::make_pair(static_cast<BarcodeIndex::BarcodeId>(pick_cell(rng)),
+                                                     static_cast<BarcodeIndex::BarcodeId>(pick_cell(rng)));
+        hit = {cell.first, cell.second, static_cast<BarcodeIndex::BarcodeId>(pick_antibody(rng))};
+    }
+
+    std::cout << "[Aggregation scaling, " << READS << " countable reads, "
+              << std::max(1u, std::thread::hardware_concurrency()) << " cores]\n";
+    print_table_header("threads (count + tree merge)", "read");
+    double single_ns = 0.0;
+    std::size_t single_cells = 0;
+    for (std::size_t threads : {1, 2, 4, 8, 16, 32, 64}) {
+        std::size_t cells = 0;
+        const PerRead result = time_per_item(hits.size(), [&]() {
+            // Contiguous chunks, like the batches a worker pulls.
+            std::vector<CountMatrix> parts(threads, CountMatrix(library.antibodies.size()));
+            std::vector<std::thread> workers;
+            for (std::size_t t = 0; t < threads; t++) {
+                workers.emplace_back([&, t]() {
+                    const std::size_t first = hits.size() * t / threads;
+                    const std::size_t last = hits.size() * (t + 1) / threads;
+                    for (std::size_t i = first; i < last; i++) parts[t].add(hits[i].bc1, hits[i].bc2, hits[i].antibody);
+                });
+            }
+            for (std::thread &worker : workers) worker.join();
+            cells = CountMatrix::merge_all(parts, threads).num_cells();
+        });
+        if (threads == 1) {
+            single_ns = result.ns;
+            single_cells = cells;
+        }
+        std::ostringstream label;
+        label << threads << " (x" << std::fixed << std::setprecision(2) << single_ns / result.ns << " of 1 thread)";
+        print_per_read(label.str(), result);
+        if (cells != single_cells) std::cout << "  MISMATCH: " << cells << " cells, expected " << single_cells << "\n";
+    }
+    std::cout << "\n";
+}
+
+void bench_tsv_writer(const Library &library) {
+    // Dense end of the range: 300k cells, each with a handful of antibodies over the row threshold.
+    const std::size_t CELLS = 300000;
+    const BarcodeIndex cells(library.cells_csv);
+    const BarcodeIndex antibodies(library.antibodies_csv);
+    std::mt19937 rng(11);
+    std::uniform_int_distribution<std::size_t> pick_cell(0, cells.size() - 1);
+    std::uniform_int_distribution<std::size_t> pick_antibody(0, antibodies.size() - 1);
+    std::uniform_int_distribution<CountMatrix::Count> pick_count(1, 500);
+    CountMatrix counts(antibodies.size());
+    while (counts.num_cells() < CELLS) {
+        const auto bc1 = static_cast<BarcodeIndex::BarcodeId>(pick_cell(rng));
+        const auto bc2 = static_cast<BarcodeIndex::BarcodeId>(pick_cell(rng));
+        for (int i = 0; i < 8; i++) {
+            counts.add(bc1, bc2, static_cast<BarcodeIndex::BarcodeId>(pick_antibody(rng)), pick_count(rng));
+        }
+    }
+
+    const std::string path = temp_path("antibody_counts.tsv");
+    TsvSummary written;
+    auto write = [&](std::size_t threads) {
+        TsvOptions options;
+        options.threads = threads;
+        return time_per_item(CELLS, [&]() { written = write_counts_tsv(path, counts, cells, antibodies, options); });
+    };
+    const std::size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    std::cout << "[TSV writer, " << CELLS << " cells]\n";
+    print_table_header("threads", "cell");
+    print_per_read("1", write(1));
+    if (cores > 1) print_per_read(std::to_string(cores), write(cores));
+    std::filesystem::remove(path);
+    std::cout << "  " << written.rows_written << " rows, " << std::fixed << std::setprecision(1)
+              << written.bytes_written / 1e6 << " MB\n\n";
+}
+
+} // namespace
+
+int main() {
+    std::cout << "========================================\n";
+    std::cout << "  DAb-seq C++ Pipeline Benchmarks\n";
+    std::cout << "========================================\n\n";
+
+    bench_motif_search();
+    bench_parse();
+
+    Library library;
+    fill_library(library, 0.01, 3);
+    bench_reader(library);
+    bench_barcode_index(library);
+    bench_aggregation(library);
+    bench_aggregation_scaling(library);
+    bench_tsv_writer(library);
+    return 0;
+}
@@ -0,0 +1,61 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+/**
+ * @brief fixed-capacity blocking queue shared between the reader thread and the workers.
+ *
+ * push() blocks while the queue is full, pop() blocks while it is empty. Once
+ * close() is called, push() drops items and pop() drains whatever is left before
+ * returning std::nullopt, which is how workers learn the input is exhausted.
+ */
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(std::size_t capacity) : _capacity_(capacity == 0 ? 1 : capacity) {}
+
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(_mutex_);
+        _not_full_.wait(lock, [this] { return _closed_ || _items_.size() < _capacity_; });
+        if (_closed_) return false;
+        _items_.push_back(std::move(item));
+        lock.unlock();
+        _not_empty_.notify_one();
+        return true;
+    }
+
+    std::optional<T> pop() {
+        std::unique_lock<std::mutex> lock(_mutex_);
+        _not_empty_.wait(lock, [this] { return _closed_ || !_items_.empty(); });
+        if (_items_.empty()) return std::nullopt; // closed and drained.
+        T item = std::move(_items_.front());
+        _items_.pop_front();
+        lock.unlock();
+        _not_full_.notify_one();
+        return item;
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex_);
+            _closed_ = true;
+        }
+        _not_empty_.notify_all();
+        _not_full_.notify_all();
+    }
+
+private:
+    std::size_t _capacity_;
+    std::deque<T> _items_;
+    bool _closed_ = false;
+    std::mutex _mutex_;
+    std::condition_variable _not_empty_;
+    std::condition_variable _not_full_;
+};
+
+#endif // BOUNDED_QUEUE_H
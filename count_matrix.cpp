@@ -0,0 +1,144 @@
+#include "count_matrix.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+
+/**
+ * @brief deep copy, the cell map is rebuilt in an arena of its own.
+ */
+CountMatrix::CountMatrix(const CountMatrix &other)
+    : _num_antibodies_(other._num_antibodies_), _cell_keys_(other._cell_keys_), _counts_(other._counts_) {
+    if (_cell_keys_.empty()) return;
+    _index_ = std::make_unique<CellIndex>();
+    _index_->row_of_cell.reserve(_cell_keys_.size());
+    for (std::size_t row = 0; row < _cell_keys_.size(); row++) {
+        _index_->row_of_cell.emplace(_cell_keys_[row], static_cast<std::uint32_t>(row));
+    }
+}
+
+CountMatrix &CountMatrix::operator=(const CountMatrix &other) {
+    if (this != &other) *this = CountMatrix(other);
+    return *this;
+}
+
+/**
+ * @brief add another matrix's counts into this one, used to combine worker tables.
+ * 
+ * @param other matrix over the same antibody set.
+ */
+void CountMatrix::merge(const CountMatrix &other) {
+    if (other._num_antibodies_ != _num_antibodies_) {
+        throw std::runtime_error("Cannot merge count matrices with different antibody sets");
+    }
+
+    for (std::size_t row = 0; row < other.num_cells(); row++) {
+        add_row(other._cell_keys_[row], other.counts(row));
+    }
+}
+
+/**
+ * @brief add one row of counts, e.g. read back from a spill run, to the cell with that key.
+ *
+ * @param key another table's key() for the row.
+ * @param row_counts num_antibodies counts.
+ */
+void CountMatrix::add_row(CellKey key, const Count *row_counts) {
+    Count *target = row_for(key);
+    for (std::size_t ab = 0; ab < _num_antibodies_; ab++) {
+        target[ab] += row_counts[ab];
+    }
+}
+
+/**
+ * @brief split a demultiplexed table into one table per sample.
+ *
+ * @param num_samples tables returned; rows of higher sample IDs are dropped.
+ * @return std::vector<CountMatrix> table i holds sample i's rows, in this table's order.
+ */
+std::vector<CountMatrix> CountMatrix::split_samples(std::size_t num_samples) const {
+    std::vector<CountMatrix> samples(num_samples, CountMatrix(_num_antibodies_));
+    for (std::size_t row = 0; row < num_cells(); row++) {
+        if (sample(row) >= num_samples) continue;
+        Count *target = samples[sample(row)].row_for(cell_key(bc1(row), bc2(row), 0));
+        std::copy(counts(row), counts(row) + _num_antibodies_, target);
+    }
+    return samples;
+}
+
+/**
+ * @brief merge worker tables pairwise, each round's merges running in parallel.
+ *
+ * Round r merges part i + 2^r into part i for every i that is a multiple of
+ * 2^(r+1), so about log2(parts) rounds replace parts - 1 serial merges into one
+ * growing table. The right part always goes into the left one, which keeps rows
+ * in the first-seen order of a serial left-to-right merge.
+ *
+ * @param parts tables over the same antibody set, left empty.
+ * @param threads merges run at once, including the caller.
+ * @return CountMatrix the sum of all parts.
+ */
+CountMatrix CountMatrix::merge_all(std::vector<CountMatrix> &parts, std::size_t threads) {
+    if (parts.empty()) return CountMatrix();
+
+    for (std::size_t step = 1; step < parts.size(); step *= 2) {
+        std::vector<std::size_t> targets;
+        for (std::size_t i = 0; i + step < parts.size(); i += 2 * step) {
+            targets.push_back(i);
+        }
+
+        std::atomic<std::size_t> next{0};
+        std::vector<std::exception_ptr> errors(targets.size());
+        auto run = [&]() {
+            for (std::size_t k; (k = next.fetch_add(1)) < targets.size();) {
+                try {
+                    parts[targets[k]].merge(parts[targets[k] + step]);
+                    parts[targets[k] + step] = CountMatrix(); // release it before the next round.
+                } catch (...) {
+                    errors[k] = std::current_exception();
+                }
+            }
+        };
+        std::vector<std::thread> helpers;
+        const std::size_t workers = std::clamp<std::size_t>(threads, 1, targets.size());
+        for (std::size_t t = 1; t < workers; t++) {
+            helpers.emplace_back(run);
+        }
+        run();
+        for (std::thread &helper : helpers) {
+            helper.join();
+        }
+        for (const std::exception_ptr &e : errors) {
+            if (e) std::rethrow_exception(e);
+        }
+    }
+
+    CountMatrix total = std::move(parts.front());
+    parts.clear();
+    return total;
+}
+
+/**
+ * @brief total reads counted for one cell, across all antibodies.
+ */
+std::uint64_t CountMatrix::row_total(std::size_t row) const {
+    std::uint64_t total = 0;
+    const Count *row_counts = counts(row);
+    for (std::size_t ab = 0; ab < _num_antibodies_; ab++) {
+        total += row_counts[ab];
+    }
+    return total;
+}
+
+/**
+ * @brief heap bytes held by the table.
+ * 
+ * Vector capacities plus every chunk of the cell map's arena, which includes
+ * bucket arrays left behind by rehashes.
+ */
+std::size_t CountMatrix::memory_bytes() const {
+    return _counts_.capacity() * sizeof(Count) +
+           _cell_keys_.capacity() * sizeof(CellKey) +
+           map_bytes();
+}
@@ -0,0 +1,100 @@
+#ifndef COUNT_MATRIX_H
+#define COUNT_MATRIX_H
+
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+#include "arena.h"
+#include "barcode_index.h"
+
+/* Cell x antibody read counts keyed by barcode IDs.
+ *
+ * Sparse by cell, dense by antibody: each observed (bc1, bc2) cell gets one row
+ * of num_antibodies uint32_t counters, stored back to back in a single vector.
+ * Counting a read is one integer hash lookup plus an increment, and writers walk
+ * the rows directly instead of re-splitting "bc1_bc2" strings. The cell map's
+ * nodes and buckets come from an Arena owned by the table, so they are packed
+ * together and freed in one go.
+ *
+ * When reads are demultiplexed, a row is a (sample, cell) pair: the sample ID
+ * is part of the row key, so every sample is counted in the same pass and the
+ * same table, and split_samples() gives one table per sample for the writers.
+ *
+ * A table is not thread-safe: each worker counts into its own, and the private
+ * tables are combined once at the end by merge_all().
+ */
+class CountMatrix {
+public:
+    using Count = std::uint32_t;
+    using BarcodeId = BarcodeIndex::BarcodeId;
+    using SampleId = std::uint8_t;
+    using CellKey = std::uint32_t; // packed (sample, bc1, bc2), see cell_key().
+    static constexpr std::size_t MAX_SAMPLES = 64; // sample IDs 0-63 sit above two 13-bit barcode IDs.
+
+    explicit CountMatrix(std::size_t num_antibodies = 0) : _num_antibodies_(num_antibodies) {}
+    CountMatrix(const CountMatrix &other);
+    CountMatrix &operator=(const CountMatrix &other);
+    CountMatrix(CountMatrix &&) noexcept = default;
+    CountMatrix &operator=(CountMatrix &&) noexcept = default;
+
+    void add(BarcodeId bc1, BarcodeId bc2, BarcodeId antibody, Count n = 1, SampleId sample = 0) {
+        row_for(cell_key(bc1, bc2, sample))[antibody] += n;
+    }
+    // Add a whole row of num_antibodies counts to the cell with that key().
+    void add_row(CellKey key, const Count *row_counts);
+
+    void merge(const CountMatrix &other);
+    // All of parts merged in order, pairwise in a tree on up to `threads` threads. parts is emptied.
+    static CountMatrix merge_all(std::vector<CountMatrix> &parts, std::size_t threads);
+    // One table per sample ID below num_samples, rows in this table's order, every sample ID 0.
+    std::vector<CountMatrix> split_samples(std::size_t num_samples) const;
+
+    std::size_t num_cells() const { return _cell_keys_.size(); }
+    std::size_t num_antibodies() const { return _num_antibodies_; }
+
+    // Rows are in first-seen order.
+    CellKey key(std::size_t row) const { return _cell_keys_[row]; }
+    BarcodeId bc1(std::size_t row) const { return static_cast<BarcodeId>(_cell_keys_[row] >> ID_BITS & ID_MASK); }
+    BarcodeId bc2(std::size_t row) const { return static_cast<BarcodeId>(_cell_keys_[row] & ID_MASK); }
+    SampleId sample(std::size_t row) const { return static_cast<SampleId>(_cell_keys_[row] >> (2 * ID_BITS)); }
+    const Count *counts(std::size_t row) const { return &_counts_[row * _num_antibodies_]; }
+    std::uint64_t row_total(std::size_t row) const;
+
+    // Heap footprint in bytes, for the counting memory ceiling.
+    std::size_t memory_bytes() const;
+    std::size_t map_bytes() const { return _index_ ? _index_->arena.bytes_reserved() : 0; } // cell map alone.
+
+private:
+    // The map and the arena it lives in, one allocation that moves with the table.
+    struct CellIndex {
+        Arena arena;
+        std::pmr::unordered_map<CellKey, std::uint32_t> row_of_cell{arena.resource()}; // cell key -> row.
+    };
+
+    static constexpr unsigned ID_BITS = 13; // BarcodeIndex IDs stay below 0x1FFF.
+    static constexpr std::uint32_t ID_MASK = (1u << ID_BITS) - 1;
+
+    std::size_t _num_antibodies_;
+    std::unique_ptr<CellIndex> _index_;     // created on the first add().
+    std::vector<CellKey> _cell_keys_;       // row -> cell key.
+    std::vector<Count> _counts_;            // row-major counters.
+
+    // [31:26] sample, [25:13] bc1, [12:0] bc2.
+    static CellKey cell_key(BarcodeId bc1, BarcodeId bc2, SampleId sample) {
+        return static_cast<std::uint32_t>(sample) << (2 * ID_BITS) | (bc1 & ID_MASK) << ID_BITS | (bc2 & ID_MASK);
+    }
+
+    Count *row_for(CellKey key) {
+        if (!_index_) _index_ = std::make_unique<CellIndex>();
+        auto [it, inserted] = _index_->row_of_cell.try_emplace(key, static_cast<std::uint32_t>(_cell_keys_.size()));
+        if (inserted) {
+            _cell_keys_.push_back(key);
+            _counts_.resize(_counts_.size() + _num_antibodies_, 0);
+        }
+        return &_counts_[static_cast<std::size_t>(it->second) * _num_antibodies_];
+    }
+};
+
+#endif // COUNT_MATRIX_H
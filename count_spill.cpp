@@ -0,0 +1,137 @@
+#include "count_spill.h"
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace {
+
+constexpr char SPILL_MAGIC[8] = {'D', 'A', 'B', 'S', 'P', 'I', 'L', '1'};
+constexpr std::size_t SPILL_BUFFER_BYTES = 1 << 20;
+
+struct FileCloser {
+    void operator()(std::FILE *f) const { std::fclose(f); }
+};
+using File = std::unique_ptr<std::FILE, FileCloser>;
+
+void write_or_throw(std::FILE *f, const void *data, std::size_t bytes, const std::string &path) {
+    if (bytes > 0 && std::fwrite(data, 1, bytes, f) != bytes) {
+        throw std::runtime_error("Failed to write count spill file " + path);
+    }
+}
+
+void read_or_throw(std::FILE *f, void *data, std::size_t bytes, const std::string &path) {
+    if (bytes > 0 && std::fread(data, 1, bytes, f) != bytes) {
+        throw std::runtime_error("Truncated count spill file " + path);
+    }
+}
+
+} // namespace
+
+/**
+ * @brief spill runs go to directory, which must exist.
+ * 
+ * @param directory where run files are created, the system temp directory if empty.
+ */
+CountSpill::CountSpill(std::string directory) : _directory_(std::move(directory)) {
+    if (_directory_.empty()) {
+        _directory_ = std::filesystem::temp_directory_path().string();
+    }
+    _prefix_ = "dabseq_spill_" + std::to_string(::getpid()) + "_" +
+               std::to_string(reinterpret_cast<std::uintptr_t>(this)) + "_";
+}
+
+CountSpill::~CountSpill() {
+    for (const std::string &path : _paths_) {
+        std::error_code ignored;
+        std::filesystem::remove(path, ignored);
+    }
+}
+
+/**
+ * @brief write one partial table as a new run file.
+ * 
+ * @param counts table to persist, left unchanged; callers reset it afterwards.
+ */
+void CountSpill::write(const CountMatrix &counts) {
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(_mutex_);
+        path = (std::filesystem::path(_directory_) / (_prefix_ + std::to_string(_paths_.size()) + ".bin")).string();
+        _paths_.push_back(path); // registered before writing so a failed run is still cleaned up.
+    }
+
+    File f(std::fopen(path.c_str(), "wb"));
+    if (!f) {
+        throw std::runtime_error("Failed to create count spill file " + path);
+    }
+    std::vector<char> buffer(SPILL_BUFFER_BYTES);
+    std::setvbuf(f.get(), buffer.data(), _IOFBF, buffer.size());
+
+    const std::uint32_t num_antibodies = static_cast<std::uint32_t>(counts.num_antibodies());
+    const std::uint64_t num_cells = counts.num_cells();
+    write_or_throw(f.get(), SPILL_MAGIC, sizeof(SPILL_MAGIC), path);
+    write_or_throw(f.get(), &num_antibodies, sizeof(num_antibodies), path);
+    write_or_throw(f.get(), &num_cells, sizeof(num_cells), path);
+
+    for (std::size_t row = 0; row < counts.num_cells(); row++) {
+        const CountMatrix::CellKey key = counts.key(row);
+        write_or_throw(f.get(), &key, sizeof(key), path);
+        write_or_throw(f.get(), counts.counts(row), num_antibodies * sizeof(CountMatrix::Count), path);
+    }
+
+    if (std::fflush(f.get()) != 0) {
+        throw std::runtime_error("Failed to write count spill file " + path);
+    }
+    const std::uint64_t bytes = sizeof(SPILL_MAGIC) + sizeof(num_antibodies) + sizeof(num_cells) +
+                                num_cells * (sizeof(CountMatrix::CellKey) + num_antibodies * sizeof(CountMatrix::Count));
+
+    std::lock_guard<std::mutex> lock(_mutex_);
+    _bytes_written_ += bytes;
+}
+
+/**
+ * @brief add every run back into counts.
+ * 
+ * @param counts table over the same antibody set as the runs.
+ */
+void CountSpill::merge_into(CountMatrix &counts) const {
+    std::lock_guard<std::mutex> lock(_mutex_);
+
+    std::vector<CountMatrix::Count> row(counts.num_antibodies());
+    for (const std::string &path : _paths_) {
+        File f(std::fopen(path.c_str(), "rb"));
+        if (!f) {
+            throw std::runtime_error("Failed to open count spill file " + path);
+        }
+
+        char magic[sizeof(SPILL_MAGIC)];
+        std::uint32_t num_antibodies = 0;
+        std::uint64_t num_cells = 0;
+        read_or_throw(f.get(), magic, sizeof(magic), path);
+        read_or_throw(f.get(), &num_antibodies, sizeof(num_antibodies), path);
+        read_or_throw(f.get(), &num_cells, sizeof(num_cells), path);
+        if (std::memcmp(magic, SPILL_MAGIC, sizeof(magic)) != 0 || num_antibodies != counts.num_antibodies()) {
+            throw std::runtime_error("Count spill file " + path + " does not match this run");
+        }
+
+        for (std::uint64_t cell = 0; cell < num_cells; cell++) {
+            CountMatrix::CellKey key = 0;
+            read_or_throw(f.get(), &key, sizeof(key), path);
+            read_or_throw(f.get(), row.data(), row.size() * sizeof(CountMatrix::Count), path);
+            counts.add_row(key, row.data());
+        }
+    }
+}
+
+std::size_t CountSpill::runs() const {
+    std::lock_guard<std::mutex> lock(_mutex_);
+    return _paths_.size();
+}
+
+std::uint64_t CountSpill::bytes_written() const {
+    std::lock_guard<std::mutex> lock(_mutex_);
+    return _bytes_written_;
+}
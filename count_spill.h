@@ -0,0 +1,45 @@
+#ifndef COUNT_SPILL_H
+#define COUNT_SPILL_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "count_matrix.h"
+
+/* Worker partial count tables written to disk when they hit their memory ceiling.
+ *
+ * A worker whose CountMatrix grows past its share of the ceiling writes the
+ * table out as one run file and starts a fresh one. This caps the partial
+ * tables only; the final table the runs are summed into still holds every cell.
+ * Runs are plain binary (header, then per row its CountMatrix::key() and one
+ * uint32_t per antibody) and are summed back into the final table one row at a
+ * time with CountMatrix::add_row(), so reading them back never holds more than
+ * one run's row in memory on top of the result.
+ *
+ * write() may be called from several workers at once; run files are removed
+ * when the CountSpill is destroyed.
+ */
+class CountSpill {
+public:
+    explicit CountSpill(std::string directory);
+    ~CountSpill();
+
+    CountSpill(const CountSpill &) = delete;
+    CountSpill &operator=(const CountSpill &) = delete;
+
+    void write(const CountMatrix &counts);
+    void merge_into(CountMatrix &counts) const;
+
+    std::size_t runs() const;
+    std::uint64_t bytes_written() const;
+
+private:
+    std::string _directory_;
+    std::string _prefix_;              // unique per process, so concurrent runs can share a directory.
+    mutable std::mutex _mutex_;        // guards the fields below.
+    std::vector<std::string> _paths_;
+    std::uint64_t _bytes_written_ = 0;
+};
+
+#endif // COUNT_SPILL_H
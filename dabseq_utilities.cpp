@@ -1,131 +1,402 @@
 #include "dabseq_utilities.h"
+#include "fixed_motif.h"
+#include "motif_search.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <stdexcept>
 
-AntibodyPayloadResult extract_ab_payload_from_r2(const std::string &seq) {
-    AntibodyPayloadResult result;
-    result.valid = false;
-    result.payload.clear();
-
-    // Try Total-seq second option.
-    std::size_t pos5 = find_with_mismatches(seq, H5_AB_HANDLE, 1); // tolerance of 1
-    std::size_t pos3b = find_with_mismatches(seq, H3B_AB_HANDLE, 1);
-    // MAYBE TRY CHECK FOR 3a?
-    // DOESN'T NEED TO BE WHOLE H3B
-
-    if (pos5 != std::string::npos && pos3b != std::string::npos) {
-        std::size_t payload_start = pos5 + H5_AB_HANDLE.size();
-        std::size_t payload_end = pos3b;
+namespace {
+
+constexpr std::size_t AB_BARCODE_LENGTH = 15; // TotalSeq-B antibody barcode.
+constexpr std::size_t CELL_BARCODE_LENGTH = 9; // each half of the cell barcode.
+
+// N count and summed raw quality bytes of a window.
+struct WindowQuality {
+    std::size_t n_count = 0;
+    std::uint64_t quality_sum = 0;
+};
+
+/**
+ * @brief count Ns and sum quality bytes over seq/quality, eight bytes per step.
+ *
+ * Each 8-byte word is handled in general-purpose registers: a base is N where
+ * the XOR with "NNNNNNNN" leaves a zero byte, and the quality bytes are added
+ * pairwise into 16-bit lanes and folded with one multiply.
+ */
+WindowQuality measure_window(std::string_view seq, std::string_view quality) {
+    constexpr std::uint64_t ONES = 0x0101010101010101ULL;
+    constexpr std::uint64_t LOW7 = 0x7F7F7F7F7F7F7F7FULL;
+    constexpr std::uint64_t EVEN_BYTES = 0x00FF00FF00FF00FFULL;
+    const std::size_t length = std::min(seq.size(), quality.size());
+
+    WindowQuality result;
+    std::size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        std::uint64_t bases;
+        std::uint64_t scores;
+        std::memcpy(&bases, seq.data() + i, 8);
+        std::memcpy(&scores, quality.data() + i, 8);
+
+        const std::uint64_t x = bases ^ (ONES * 'N');
+        const std::uint64_t zero_bytes = ~(((x & LOW7) + LOW7) | x | LOW7); // high bit of each zero byte.
+        result.n_count += static_cast<std::size_t>(std::popcount(zero_bytes));
+
+        const std::uint64_t pairs = (scores & EVEN_BYTES) + ((scores >> 8) & EVEN_BYTES);
+        result.quality_sum += (pairs * 0x0001000100010001ULL) >> 48;
+    }
+    for (; i < length; i++) {
+        result.n_count += seq[i] == 'N';
+        result.quality_sum += static_cast<unsigned char>(quality[i]);
+    }
+    return result;
+}
 
-        // error check -> end is after start, and payload is large enough
+/**
+ * @brief true if the window's mean Phred score is below min_quality.
+ */
+bool below_quality(const WindowQuality &window, std::size_t length, double min_quality, int phred_offset) {
+    return min_quality > 0.0 && length > 0 &&
+           static_cast<double>(window.quality_sum) < (min_quality + phred_offset) * static_cast<double>(length);
+}
 
-        if (payload_end > payload_start) {
-            result.payload = seq.substr(payload_start, payload_end - payload_start);
-            result.valid = true;
-            return result;
+} // namespace
+
+/**
+ * @brief locate the 15 bp antibody barcode in R2, in one pass over the read.
+ * 
+ * Two layouts are recognised, each handle with 1 mismatch of tolerance:
+ * -> [junk] + [5' handle H5] + [15 bp barcode] + [3' handle H3B]
+ * -> [15 bp barcode] + [3' handle H3A]
+ * 
+ * The payload length is fixed, so H3B can only start 15 bases after the end of
+ * H5 and H3A only at position 15. Rather than searching the whole read for
+ * each handle, we scan once for H5 (only as far as a payload + H3B still fits),
+ * check H3B at its one possible offset for every H5 hit, and stop at the first
+ * valid payload. H3A is a single anchored comparison.
+ * 
+ * @param seq R2 sequence.
+ * @param layout set to the layout that matched, AntibodyLayout::NONE if neither.
+ * @return std::uint32_t payload start, NO_OFFSET if neither layout matched.
+ */
+std::uint32_t locate_ab_payload_in_r2(std::string_view seq, AntibodyLayout &layout) {
+    layout = AntibodyLayout::NONE;
+
+    const std::size_t H3B_OFFSET = H5_AB_HANDLE.size() + AB_BARCODE_LENGTH; // from the start of H5.
+
+    if (seq.size() >= H3B_OFFSET + H3B_AB_HANDLE.size()) {
+        // Last H5 start that leaves room for payload + H3B.
+        std::string_view h5_window = seq.substr(0, seq.size() - AB_BARCODE_LENGTH - H3B_AB_HANDLE.size());
+
+        std::size_t from = 0;
+        while (true) {
+            std::size_t hit = find_fixed_motif<H5_AB_HANDLE_FIXED>(h5_window.substr(from), 1); // tolerance of 1
+            if (hit == std::string::npos) break;
+
+            std::size_t pos5 = from + hit;
+            if (fixed_motif_at<H3B_AB_HANDLE_FIXED>(seq, pos5 + H3B_OFFSET, 1)) {
+                layout = AntibodyLayout::H5_H3B;
+                return static_cast<std::uint32_t>(pos5 + H5_AB_HANDLE.size());
+            }
+            from = pos5 + 1; // keep scanning, a spurious H5 hit can precede the real one.
         }
     }
 
-    std::size_t pos3a = find_with_mismatches(seq, H3A_AB_HANDLE, 1);
-    // add length check
-    if (pos3a != std::string::npos) {
-        result.payload = seq.substr(0, pos3a);
-        result.valid = true;
-        return result;
+    if (fixed_motif_at<H3A_AB_HANDLE_FIXED>(seq, AB_BARCODE_LENGTH, 1)) {
+        layout = AntibodyLayout::H3A;
+        return 0;
     }
 
-    return result; // neither pattern matched
-
+    return NO_OFFSET; // neither pattern matched
 }
 
-std::size_t find_with_mismatches(const std::string &seq, const std::string &motif, int max_mismatches) {
+/**
+ * @brief copy of the antibody payload found by locate_ab_payload_in_r2().
+ * 
+ * @param seq R2 sequence.
+ * @return AntibodyPayloadResult payload is always 15 bp when valid.
+ */
+AntibodyPayloadResult extract_ab_payload_from_r2(std::string_view seq, const UmiLayout &umi) {
+    AntibodyPayloadResult result;
+    result.valid = false;
+    result.payload.clear();
+
+    AntibodyHit hit;
+    hit.payload_pos = locate_ab_payload_in_r2(seq, hit.layout);
+    if (hit.payload_pos != NO_OFFSET) {
+        result.payload.assign(seq.substr(hit.payload_pos, AB_BARCODE_LENGTH));
+        result.valid = true;
 
-    // If motif is empty or longer than the sequence, there is no match.
-    if (motif.empty() || seq.size() < motif.size()) {
-        return std::string::npos;
+        const std::uint32_t umi_pos = locate_ab_umi_in_r2(seq, hit, umi);
+        if (umi_pos != NO_OFFSET) result.umi.assign(seq.substr(umi_pos, umi.length));
     }
+    return result;
+}
 
-    const std::size_t MOTIF_LENGTH = motif.size();
-    const std::size_t SEQ_LENGTH = seq.size();
+/**
+ * @brief start of the UMI next to a payload found by locate_ab_payload_in_r2().
+ *
+ * @param seq R2 sequence.
+ * @param hit payload position and layout.
+ * @param umi UMI length and offset past the 3' handle.
+ * @return std::uint32_t UMI start, NO_OFFSET without a UMI, a payload or room for the UMI in the read.
+ */
+std::uint32_t locate_ab_umi_in_r2(std::string_view seq, const AntibodyHit &hit, const UmiLayout &umi) {
+    if (!umi.enabled() || hit.payload_pos == NO_OFFSET) return NO_OFFSET;
+    std::size_t handle_length = 0;
+    switch (hit.layout)
+    {
+    case AntibodyLayout::H5_H3B: handle_length = H3B_AB_HANDLE.size(); break;
+    case AntibodyLayout::H3A: handle_length = H3A_AB_HANDLE.size(); break;
+    case AntibodyLayout::NONE: return NO_OFFSET;
+    }
+    const std::size_t start = hit.payload_pos + AB_BARCODE_LENGTH + handle_length + umi.offset;
+    if (start > seq.size() || seq.size() - start < umi.length) return NO_OFFSET;
+    return static_cast<std::uint32_t>(start);
+}
 
-    for (std::size_t start = 0; start + MOTIF_LENGTH <= SEQ_LENGTH; start++) {
-        int mismatches = 0;
+/**
+ * @brief first position where motif occurs in seq with at most max_mismatches substitutions.
+ * 
+ * Runs the best SIMD kernel for this CPU (AVX2, SSE2 or NEON, scalar otherwise),
+ * see motif_search.h.
+ * 
+ * @param seq read sequence.
+ * @param motif motif to look for.
+ * @param max_mismatches allowed substitutions.
+ * @return std::size_t match start, std::string::npos if none.
+ */
+std::size_t find_with_mismatches(std::string_view seq, std::string_view motif, int max_mismatches) {
+    return best_motif_search_kernel().search(seq, motif, max_mismatches);
+}
 
-        for (std::size_t i = 0; i < MOTIF_LENGTH; i++) {
-            if (seq[start+i] != motif[i]) {
-                mismatches++;
-            }
-            if (mismatches > max_mismatches) {
-                break;
-            }
-        }
+ParsedBarcode parse_barcodes_from_r1(const FastqPairReader::Record &r1, const BarcodeIndex &barcodes)
+{
+    return parse_barcodes_from_r1(std::string_view(r1.sequence), barcodes);
+}
+
+ParsedBarcode parse_barcodes_from_r1(std::string_view seq, const BarcodeIndex &barcodes)
+{
+    R1ParseCounters counters;
+    return parse_barcodes_from_r1(seq, barcodes, MotifWindow(), counters);
+}
 
-        if (mismatches <= max_mismatches) {
-            return start;
+/**
+ * @brief locate R1_START_MOTIF, trying the expected window before the whole read.
+ * 
+ * With Tapestri chemistry the motif almost always starts around position 32
+ * (9 bp bc1 + linker + 9 bp bc2), so a window of a few positions replaces a
+ * scan of the full 150 bp read for nearly every read.
+ * 
+ * @param seq R1 sequence.
+ * @param window expected motif starts, disabled -> full scan only.
+ * @param counters incremented for the path taken.
+ * @return std::size_t motif start, std::string::npos if none.
+ */
+static std::size_t find_r1_start_motif(std::string_view seq, const MotifWindow &window, R1ParseCounters &counters)
+{
+    if (window.enabled() && window.first < seq.size()) {
+        std::string_view region = seq.substr(window.first, window.last - window.first + R1_START_MOTIF.size());
+        std::size_t hit = find_fixed_motif<R1_START_FIXED>(region, 1);
+        if (hit != std::string::npos) {
+            counters.window_hits++;
+            return window.first + hit;
         }
     }
 
-    return std::string::npos;
+    std::size_t motif_pos = find_fixed_motif<R1_START_FIXED>(seq, 1); // hamming distance of 1
+    // previously did .find, though this increases the number of barcodes found
+    // flexibility in finding motif AND correcting barcodes makes more reads valid
+    if (motif_pos == std::string::npos) {
+        counters.no_motif++;
+    } else {
+        counters.full_scan_hits++;
+    }
+    return motif_pos;
 }
 
-ParsedBarcode parse_barcodes_from_r1(const FastqPairReader::Record &r1, const BarcodeIndex &barcodes)
+/**
+ * @brief string-building wrapper around match_barcodes_in_r1().
+ */
+ParsedBarcode parse_barcodes_from_r1(std::string_view seq, const BarcodeIndex &barcodes,
+                                     const MotifWindow &window, R1ParseCounters &counters)
 {
     ParsedBarcode result = {"", "", false};
 
-    const std::string &seq = r1.sequence;                 // efficient, read only reference to r1.sequence via seq
+    CellBarcodeHit hit = match_barcodes_in_r1(seq, barcodes, window, counters);
+    if (hit.motif_pos != NO_OFFSET) result.motif_pos = hit.motif_pos;
+    if (!hit.valid) return result;
 
-    std::size_t motif_pos = find_with_mismatches(seq, R1_START_MOTIF, 1); // hamming distance of 1
-    // previously did .find, though this increases the number of barcodes found
-    // flexibility in finding motif AND correcting barcodes makes more reads valid
+    result.valid = true;
+    result.bc1 = barcodes.barcode(hit.bc1_id);
+    result.bc2 = barcodes.barcode(hit.bc2_id);
+    result.bc1_id = hit.bc1_id;
+    result.bc2_id = hit.bc2_id;
 
-    if (motif_pos == std::string::npos || motif_pos < 9)
-        return result; // no motif or not enough bases before motif -> potentially don't need this, very pedantic
+    return result;
+}
 
-    // Raw observed barcodes from read.
-    std::string barcode_first_half_observed = seq.substr(0, 9);
-    std::string barcode_second_half_observed = seq.substr(motif_pos - 9, 9);
+CellBarcodeHit match_barcodes_in_r1(std::string_view seq, const BarcodeIndex &barcodes)
+{
+    R1ParseCounters counters;
+    return match_barcodes_in_r1(seq, barcodes, MotifWindow(), counters);
+}
 
-    // Canonical forms after Hamming correction.
-    std::string barcode_first_half_corrected;
-    std::string barcode_second_half_corrected;
+/**
+ * @brief cell barcode IDs of an R1 read, without allocating.
+ * 
+ * bc1 is the first 9 bases, bc2 the 9 bases right before R1_START_MOTIF; both
+ * are hamming-corrected through the index.
+ * 
+ * @param seq R1 sequence.
+ * @param barcodes cell barcode whitelist.
+ * @param window expected motif starts, see find_r1_start_motif().
+ * @param counters motif search path counters.
+ * @return CellBarcodeHit valid only if both halves map.
+ */
+CellBarcodeHit match_barcodes_in_r1(std::string_view seq, const BarcodeIndex &barcodes,
+                                    const MotifWindow &window, R1ParseCounters &counters)
+{
+    CellBarcodeHit result;
+
+    std::size_t motif_pos = find_r1_start_motif(seq, window, counters);
+    if (motif_pos == std::string::npos) return result;
+    result.motif_pos = static_cast<std::uint32_t>(motif_pos);
 
-    // Check if the barcodes can be mapped.
-    bool barcode_first_half_mapped = barcodes.find_canonical_barcode(barcode_first_half_observed, barcode_first_half_corrected);
-    bool barcode_second_half_mapped = barcodes.find_canonical_barcode(barcode_second_half_observed, barcode_second_half_corrected);
+    if (motif_pos < 9)
+        return result; // not enough bases before motif -> potentially don't need this, very pedantic
 
-    if (!barcode_first_half_mapped || !barcode_second_half_mapped)
+    // Raw observed barcodes from read, mapped straight to canonical IDs after Hamming correction.
+    BarcodeIndex::Match barcode_first_half = barcodes.match(seq.substr(0, 9));
+    BarcodeIndex::Match barcode_second_half = barcodes.match(seq.substr(motif_pos - 9, 9));
+
+    if (barcode_first_half.id == BarcodeIndex::NO_BARCODE || barcode_second_half.id == BarcodeIndex::NO_BARCODE)
         return result; // at least one barcode isn't valid.
 
     result.valid = true;
-    result.bc1 = std::move(barcode_first_half_corrected); // efficient transfer without copying
-    result.bc2 = std::move(barcode_second_half_corrected);
+    result.bc1_id = barcode_first_half.id;
+    result.bc2_id = barcode_second_half.id;
+    result.bc1_mismatches = barcode_first_half.mismatches;
+    result.bc2_mismatches = barcode_second_half.mismatches;
 
     return result;
 }
 
 ParsedAntibody parse_antibody_from_r2(const FastqPairReader::Record& r2, const BarcodeIndex &antibody_barcodes) {
+    return parse_antibody_from_r2(std::string_view(r2.sequence), antibody_barcodes);
+}
+
+/**
+ * @brief string-building wrapper around match_antibody_in_r2().
+ */
+ParsedAntibody parse_antibody_from_r2(std::string_view r2_sequence, const BarcodeIndex &antibody_barcodes) {
     ParsedAntibody result = {"", false};
 
-    AntibodyPayloadResult pay = extract_ab_payload_from_r2(r2.sequence);
-    if (!pay.valid || pay.payload.size() != 15) {
-        return result; // not valid or not long enough
-    }
+    AntibodyHit hit = match_antibody_in_r2(r2_sequence, antibody_barcodes);
+    if (!hit.valid) return result;
+
+    result.valid = true;
+    result.barcode = antibody_barcodes.barcode(hit.id);
+    result.id = hit.id;
 
-    const std::string &barcode_observed = pay.payload;
+    return result;
+}
 
-    std::string barcode_corrected;
+/**
+ * @brief antibody barcode ID of an R2 read, without allocating.
+ * 
+ * @param r2_sequence R2 sequence.
+ * @param antibody_barcodes antibody barcode whitelist.
+ * @return AntibodyHit valid only if a payload was found and maps.
+ */
+AntibodyHit match_antibody_in_r2(std::string_view r2_sequence, const BarcodeIndex &antibody_barcodes) {
+    AntibodyHit result;
 
-    bool barcode_mapped = antibody_barcodes.find_canonical_barcode(barcode_observed, barcode_corrected);
+    result.payload_pos = locate_ab_payload_in_r2(r2_sequence, result.layout);
+    if (result.payload_pos == NO_OFFSET) return result;
 
-    if (!barcode_mapped) return result; // not in hamming dictionary.
+    BarcodeIndex::Match payload = antibody_barcodes.match(r2_sequence.substr(result.payload_pos, AB_BARCODE_LENGTH));
+    if (payload.id == BarcodeIndex::NO_BARCODE) return result; // not in hamming dictionary.
 
     result.valid = true;
-    result.barcode = std::move(barcode_corrected);
+    result.id = payload.id;
+    result.mismatches = payload.mismatches;
 
     return result;
 }
 
+/**
+ * @brief cheap checks on a pair before any motif search, see ReadFilter.
+ *
+ * Only bc1 has a fixed position in R1, so that is the R1 window; the R2 window
+ * is the whole read, as the H5 layout can put the handles anywhere. Each window
+ * is measured once, checks run in the order of ReadFilterCounters.
+ *
+ * @param pair r1/r2 sequences and quality strings.
+ * @param filter thresholds, disabled checks never reject.
+ * @param counters the reason of a rejection is incremented.
+ * @return bool false if the pair should not be parsed.
+ */
+bool passes_read_filter(const FastqPairReader::PairView &pair, const ReadFilter &filter, ReadFilterCounters &counters) {
+    const std::string_view bc1_bases = pair.r1.sequence.substr(0, CELL_BARCODE_LENGTH);
+    const WindowQuality bc1 = measure_window(bc1_bases, pair.r1.quality);
+    if (bc1.n_count > filter.max_bc1_n) {
+        counters.bc1_n++;
+        return false;
+    }
+    if (below_quality(bc1, bc1_bases.size(), filter.min_bc1_quality, filter.phred_offset)) {
+        counters.bc1_quality++;
+        return false;
+    }
+
+    if (filter.max_r2_n == SIZE_MAX && filter.min_r2_quality <= 0.0) return true;
+    const WindowQuality r2 = measure_window(pair.r2.sequence, pair.r2.quality);
+    if (r2.n_count > filter.max_r2_n) {
+        counters.r2_n++;
+        return false;
+    }
+    if (below_quality(r2, pair.r2.sequence.size(), filter.min_r2_quality, filter.phred_offset)) {
+        counters.r2_quality++;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief narrowest window of motif start positions holding `coverage` of the observations.
+ * 
+ * @param position_histogram count of reads whose motif started at each position.
+ * @param coverage fraction of observed motifs the window must include, eg 0.99.
+ * @return MotifWindow disabled if the histogram is empty.
+ */
+MotifWindow learn_motif_window(const std::vector<std::size_t> &position_histogram, double coverage)
+{
+    std::size_t total = 0;
+    for (std::size_t count : position_histogram) total += count;
+
+    MotifWindow window;
+    if (total == 0) return window;
+
+    const double needed = coverage * static_cast<double>(total);
+    std::size_t in_window = 0;
+    std::size_t best_width = position_histogram.size();
+
+    // Two pointers: shrink from the left while [first, last] still holds enough.
+    for (std::size_t first = 0, last = 0; last < position_histogram.size(); last++) {
+        in_window += position_histogram[last];
+        while (first < last && static_cast<double>(in_window - position_histogram[first]) >= needed) {
+            in_window -= position_histogram[first++];
+        }
+        if (static_cast<double>(in_window) >= needed && last - first < best_width) {
+            best_width = last - first;
+            window.first = first;
+            window.last = last;
+        }
+    }
+    return window;
+}
 
 std::unordered_map<std::string, std::string> load_antibody_name_map(const std::string& csv_path) {
     std::unordered_map<std::string, std::string> barcode_to_name;
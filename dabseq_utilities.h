@@ -1,40 +1,146 @@
 #ifndef DABSEQ_UTILITIES_H
 #define DABSEQ_UTILITIES_H
 
+#include <cstdint>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 #include "fastq_reader.h"
 #include "barcode_index.h"
+#include "motif_search.h"
 
-static const std::string R1_START_MOTIF = "GTACTCGCAGTAGTC";
-static const std::string R1_END_MOTIF = "CTGTCTCTTATACACATCT";
-static const std::string R2_END_MOTIF = "GACTACTGCGAGTAC";
-static const std::string H5_AB_HANDLE = "TGACTACGCTACTCATGG";
-static const std::string H3A_AB_HANDLE = "GCTTTAAGGCCGGTCCTAGC";
-static const std::string H3B_AB_HANDLE = "GAGCCGATCTAGTATCTCAGTCG";
+// Chemistry constants, as template arguments for the matchers in fixed_motif.h.
+inline constexpr FixedMotif R1_START_FIXED{"GTACTCGCAGTAGTC"};
+inline constexpr FixedMotif R1_END_FIXED{"CTGTCTCTTATACACATCT"};
+inline constexpr FixedMotif R2_END_FIXED{"GACTACTGCGAGTAC"};
+inline constexpr FixedMotif H5_AB_HANDLE_FIXED{"TGACTACGCTACTCATGG"};
+inline constexpr FixedMotif H3A_AB_HANDLE_FIXED{"GCTTTAAGGCCGGTCCTAGC"};
+inline constexpr FixedMotif H3B_AB_HANDLE_FIXED{"GAGCCGATCTAGTATCTCAGTCG"};
+
+static const std::string R1_START_MOTIF(R1_START_FIXED.view());
+static const std::string R1_END_MOTIF(R1_END_FIXED.view());
+static const std::string R2_END_MOTIF(R2_END_FIXED.view());
+static const std::string H5_AB_HANDLE(H5_AB_HANDLE_FIXED.view());
+static const std::string H3A_AB_HANDLE(H3A_AB_HANDLE_FIXED.view());
+static const std::string H3B_AB_HANDLE(H3B_AB_HANDLE_FIXED.view());
 
 struct ParsedBarcode {
     std::string bc1;
     std::string bc2;
     bool valid;
+    BarcodeIndex::BarcodeId bc1_id = BarcodeIndex::NO_BARCODE;
+    BarcodeIndex::BarcodeId bc2_id = BarcodeIndex::NO_BARCODE;
+    std::size_t motif_pos = std::string::npos; // R1_START_MOTIF start, set even if the barcodes don't map.
+};
+
+// Start positions where R1_START_MOTIF is expected. Disabled (first > last) means always scan the whole read.
+struct MotifWindow {
+    std::size_t first = 1;
+    std::size_t last = 0;
+    bool enabled() const { return first <= last; }
+};
+
+// Which path found R1_START_MOTIF.
+struct R1ParseCounters {
+    std::size_t window_hits = 0;     // fast path, motif inside the expected window.
+    std::size_t full_scan_hits = 0;  // window missed (or disabled), found by scanning the whole read.
+    std::size_t no_motif = 0;        // not found at all.
+};
+
+// Allocation-free parse results for the per-read path: barcode IDs, offsets into
+// the read and match distances, no strings. Offsets are NO_OFFSET when unset.
+constexpr std::uint32_t NO_OFFSET = 0xFFFFFFFF;
+
+struct CellBarcodeHit {
+    BarcodeIndex::BarcodeId bc1_id = BarcodeIndex::NO_BARCODE;
+    BarcodeIndex::BarcodeId bc2_id = BarcodeIndex::NO_BARCODE;
+    std::uint32_t motif_pos = NO_OFFSET;  // R1_START_MOTIF start, set even if the barcodes don't map.
+    std::uint8_t bc1_mismatches = 0;      // edits to the canonical barcode, 0-2.
+    std::uint8_t bc2_mismatches = 0;
+    bool valid = false;
+};
+
+enum class AntibodyLayout : std::uint8_t {
+    NONE,
+    H5_H3B,     // [junk] + H5 + barcode + H3B
+    H3A,        // barcode + H3A
+};
+
+struct AntibodyHit {
+    BarcodeIndex::BarcodeId id = BarcodeIndex::NO_BARCODE;
+    std::uint32_t payload_pos = NO_OFFSET; // start of the 15 bp payload, set even if it doesn't map.
+    std::uint8_t mismatches = 0;           // payload edits to the canonical barcode, 0-2.
+    AntibodyLayout layout = AntibodyLayout::NONE;
+    bool valid = false;
+};
+
+// Pre-filter run before any motif search: pairs whose cell barcode or R2 bases are
+// too N-rich or too low quality to ever be assigned are dropped. Every check is
+// off at its default.
+struct ReadFilter {
+    std::size_t max_bc1_n = SIZE_MAX; // Ns allowed in bc1 (R1 bases 0-8).
+    double min_bc1_quality = 0.0;     // mean Phred of bc1.
+    std::size_t max_r2_n = SIZE_MAX;  // Ns allowed in R2, where the handles and payload are.
+    double min_r2_quality = 0.0;      // mean Phred of R2.
+    int phred_offset = 33;
+    bool enabled() const {
+        return max_bc1_n != SIZE_MAX || min_bc1_quality > 0.0 || max_r2_n != SIZE_MAX || min_r2_quality > 0.0;
+    }
+};
+
+// Pairs dropped by the ReadFilter, by the first check that failed.
+struct ReadFilterCounters {
+    std::size_t bc1_n = 0;
+    std::size_t bc1_quality = 0;
+    std::size_t r2_n = 0;
+    std::size_t r2_quality = 0;
+    std::size_t rejected() const { return bc1_n + bc1_quality + r2_n + r2_quality; }
+};
+
+// Where the UMI of an antibody read sits: length bases starting offset bases past
+// the end of the 3' handle (H3B or H3A), the same place relative to the tag in
+// both layouts. Length 0 means no UMI.
+struct UmiLayout {
+    std::size_t length = 0;
+    std::size_t offset = 0;
+    bool enabled() const { return length > 0; }
 };
 
 struct AntibodyPayloadResult {
     std::string payload;
     bool valid;
+    std::string umi = ""; // empty unless asked for and fully inside the read.
 };
 
 struct ParsedAntibody {
     std::string barcode;
     bool valid;
+    BarcodeIndex::BarcodeId id = BarcodeIndex::NO_BARCODE;
 };
 
 ParsedAntibody parse_antibody_from_r2(const FastqPairReader::Record &r2, const BarcodeIndex &antibody_barcodes);
+ParsedAntibody parse_antibody_from_r2(std::string_view r2_sequence, const BarcodeIndex &antibody_barcodes);
 
-AntibodyPayloadResult extract_ab_payload_from_r2(const std::string &seq);
+AntibodyPayloadResult extract_ab_payload_from_r2(std::string_view seq, const UmiLayout &umi = UmiLayout());
+std::uint32_t locate_ab_payload_in_r2(std::string_view seq, AntibodyLayout &layout);
+std::uint32_t locate_ab_umi_in_r2(std::string_view seq, const AntibodyHit &hit, const UmiLayout &umi);
+AntibodyHit match_antibody_in_r2(std::string_view r2_sequence, const BarcodeIndex &antibody_barcodes);
 
-std::size_t find_with_mismatches(const std::string &seq, const std::string &motif, int max_mismatches);
+std::size_t find_with_mismatches(std::string_view seq, std::string_view motif, int max_mismatches);
 
 ParsedBarcode parse_barcodes_from_r1(const FastqPairReader::Record &r1, const BarcodeIndex &barcodes);
+ParsedBarcode parse_barcodes_from_r1(std::string_view r1_sequence, const BarcodeIndex &barcodes);
+ParsedBarcode parse_barcodes_from_r1(std::string_view r1_sequence, const BarcodeIndex &barcodes,
+                                     const MotifWindow &window, R1ParseCounters &counters);
+
+CellBarcodeHit match_barcodes_in_r1(std::string_view r1_sequence, const BarcodeIndex &barcodes);
+CellBarcodeHit match_barcodes_in_r1(std::string_view r1_sequence, const BarcodeIndex &barcodes,
+                                    const MotifWindow &window, R1ParseCounters &counters);
+
+bool passes_read_filter(const FastqPairReader::PairView &pair, const ReadFilter &filter, ReadFilterCounters &counters);
+
+MotifWindow learn_motif_window(const std::vector<std::size_t> &position_histogram, double coverage);
 
 std::unordered_map<std::string, std::string> load_antibody_name_map(const std::string &csv_path);
 
@@ -1,5 +1,18 @@
 #include "fastq_reader.h"
+#include <htslib/bgzf.h>
+#include <htslib/hfile.h>
+#include <htslib/thread_pool.h>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
 #include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using ReadStatus = FastqPairReader::ReadStatus;
 using Record = FastqPairReader::Record;
@@ -9,8 +22,14 @@ using Record = FastqPairReader::Record;
  * 
  * @param r1_path read 1 fastq(.gz) path
  * @param r2_path read 2 fastq(.gz) path
+ * @param decompress_threads size of the htslib thread pool shared by R1 and R2,
+ * 0 inflates on the calling thread. BGZF blocks are inflated in parallel by the
+ * pool; plain gzip can't be split, but htslib still moves its inflate onto a
+ * pool thread so it reads ahead while we parse.
+ * @param slice byte range of the pair to read, {0, 1} is the whole files (see open_slice()).
  */
-FastqPairReader::FastqPairReader(const std::string &r1_path, const std::string &r2_path) {
+FastqPairReader::FastqPairReader(const std::string &r1_path, const std::string &r2_path, int decompress_threads,
+                                 Slice slice) {
     _r1_path_ = r1_path; // store to private variable
     _r2_path_ = r2_path; // store to private variable
 
@@ -28,6 +47,44 @@ FastqPairReader::FastqPairReader(const std::string &r1_path, const std::string &
         if (panel_r2) hts_close(panel_r2);
         throw std::runtime_error("Failed to open FASTQ files");
     }
+
+    std::error_code r1_error, r2_error;
+    const std::uintmax_t r1_size = std::filesystem::file_size(r1_path, r1_error);
+    const std::uintmax_t r2_size = std::filesystem::file_size(r2_path, r2_error);
+    if (!r1_error && !r2_error) {
+        _input_bytes_ = static_cast<std::int64_t>(r1_size + r2_size);
+    }
+
+    if (decompress_threads > 0) {
+        _thread_pool_.pool = hts_tpool_init(decompress_threads);
+        if (!_thread_pool_.pool) {
+            hts_close(panel_r1);
+            hts_close(panel_r2);
+            throw std::runtime_error("Failed to create decompression thread pool");
+        }
+        // One pool serves both files so R1 and R2 inflate concurrently without
+        // oversubscribing the box with two independent pools.
+        if (hts_set_thread_pool(panel_r1, &_thread_pool_) != 0 ||
+            hts_set_thread_pool(panel_r2, &_thread_pool_) != 0) {
+            hts_close(panel_r1);
+            hts_close(panel_r2);
+            hts_tpool_destroy(_thread_pool_.pool);
+            throw std::runtime_error("Failed to attach decompression thread pool");
+        }
+        _decompress_threads_ = decompress_threads;
+    }
+
+    if (slice.index != 0 || slice.count != 1) {
+        _slice_ = slice;
+        try {
+            open_slice();
+        } catch (...) {
+            hts_close(panel_r1);
+            hts_close(panel_r2);
+            if (_thread_pool_.pool) hts_tpool_destroy(_thread_pool_.pool);
+            throw;
+        }
+    }
 }
 
 /**
@@ -41,6 +98,506 @@ FastqPairReader::~FastqPairReader() {
     // safe to do on nullptr or not.
     if (panel_r1) hts_close(panel_r1); // Deallocate.
     if (panel_r2) hts_close(panel_r2); // Deallocate.
+    for (BlockStream *stream : {&_stream_r1_, &_stream_r2_}) {
+        if (stream->mapped) ::munmap(const_cast<char *>(stream->mapped), stream->mapped_size);
+    }
+    // Pool must outlive the files using it.
+    if (_thread_pool_.pool) hts_tpool_destroy(_thread_pool_.pool);
+}
+
+/**
+ * @brief current position in the underlying (compressed) file.
+ *
+ * @param file htsLib file pointer.
+ * @return std::int64_t byte offset, -1 if htslib doesn't expose one.
+ */
+std::int64_t FastqPairReader::compressed_offset(htsFile *file) {
+    BGZF *bgzf = hts_get_bgzfp(file);
+    if (bgzf) {
+        return bgzf_htell(bgzf);
+    }
+    if (hts_get_format(file)->compression == no_compression) {
+        return htell(file->fp.hfile);
+    }
+    return -1;
+}
+
+/**
+ * @brief bytes of the file (slice) consumed so far, the mapping position for mapped input.
+ */
+std::int64_t FastqPairReader::stream_offset(htsFile *file, const BlockStream &stream) {
+    const std::int64_t offset = stream.mapped ? static_cast<std::int64_t>(stream.mapped_pos) : compressed_offset(file);
+    return offset < 0 ? -1 : std::max<std::int64_t>(0, offset - static_cast<std::int64_t>(stream.raw_begin));
+}
+
+/**
+ * @brief whether a FASTQ file can be read in slices.
+ * 
+ * Compressed data can only be entered at a block boundary: BGZF has one every
+ * 64 KiB, plain gzip only at the start of the file.
+ * 
+ * @param path file to check.
+ * @return true for uncompressed regular files and BGZF.
+ */
+bool FastqPairReader::splittable(const std::string &path) {
+    struct stat info;
+    if (::stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) {
+        return false;
+    }
+    htsFile *file = hts_open(path.c_str(), "r");
+    if (!file) {
+        return false;
+    }
+    const htsCompression compression = hts_get_format(file)->compression;
+    hts_close(file);
+    return compression == no_compression || compression == bgzf;
+}
+
+/*
+    Slices.
+
+    Splitting one R1/R2 pair into byte ranges lets several readers (and the workers
+    behind them) go through the same lane at once. Cut k of n is placed in R1 at
+    k/n of the file on disk and moved forward to the next record start. BGZF data
+    can only be entered at a block, so it first moves to the next block header and
+    the record start is then found in the decompressed text, giving a virtual
+    offset (block offset << 16 | bytes into the block) that bgzf_seek() accepts.
+
+    R2 reads don't sit at the same offsets (read lengths differ, compression
+    differs), so R2 is cut at the read with the same core header as R1's first
+    read, searched in a window around the proportional offset that widens until
+    it is found.
+
+    Each reader works out both of its cuts itself. Neighbouring slices compute
+    the shared cut with the same code from the same files, so they agree on it
+    without talking to each other and every read lands in exactly one slice.
+*/
+
+/**
+ * @brief random access to R1 or R2 for locating slice cuts, separate from the reader's own stream.
+ */
+class FastqPairReader::SliceScanner {
+public:
+    SliceScanner(const std::string &path, bool is_bgzf) : _path_(path) {
+        _fd_ = ::open(path.c_str(), O_RDONLY);
+        struct stat info;
+        if (_fd_ < 0 || ::fstat(_fd_, &info) != 0) {
+            if (_fd_ >= 0) ::close(_fd_);
+            throw std::runtime_error("Failed to open " + path + " for slicing");
+        }
+        _size_ = static_cast<std::uint64_t>(info.st_size);
+        if (is_bgzf) {
+            _bgzf_ = bgzf_open(path.c_str(), "r");
+            if (!_bgzf_) {
+                ::close(_fd_);
+                throw std::runtime_error("Failed to open " + path + " for slicing");
+            }
+        }
+    }
+
+    ~SliceScanner() {
+        if (_bgzf_) bgzf_close(_bgzf_);
+        ::close(_fd_);
+    }
+
+    SliceScanner(const SliceScanner &) = delete;
+    SliceScanner &operator=(const SliceScanner &) = delete;
+
+    std::uint64_t size() const { return _size_; }
+    SlicePoint end() const { return {_size_, 0}; }
+
+    /**
+     * @brief first record starting at or after k/n of the file, end() if there is none.
+     * 
+     * @param core set to the record's core header.
+     */
+    SlicePoint cut(std::size_t k, std::size_t n, std::string &core) {
+        const std::uint64_t raw = resync(_size_ / n * k + _size_ % n * k / n);
+        if (raw >= _size_) {
+            return end();
+        }
+        start(raw);
+        std::size_t found;
+        while ((found = first_record(_data_.data(), _data_.size(), 1, _data_eof_)) == std::string::npos && !_data_eof_) {
+            more();
+        }
+        if (found == std::string::npos) {
+            return end();
+        }
+        RecordSpan span;
+        std::size_t next;
+        parse_record(_data_.data(), _data_.size(), found, span, next);
+        core = core_header(std::string_view(_data_.data() + span.header, span.header_len));
+        return advance({raw, 0}, found);
+    }
+
+    /**
+     * @brief the record with core header `core`, searched around on-disk offset `estimate`.
+     */
+    SlicePoint find(std::string_view core, std::uint64_t estimate) {
+        for (std::uint64_t window = std::max<std::uint64_t>(4 * CHUNK, _size_ / 256);; window *= 4) {
+            const std::uint64_t low = estimate > window ? resync(estimate - window) : 0;
+            const std::uint64_t high = std::min(_size_, estimate + window);
+            const std::uint64_t limit = distance({low, 0}, {resync(high), 0}); // decompressed bytes to scan.
+
+            start(low);
+            std::size_t pos = 0; // the file start is a record start.
+            if (low > 0) {
+                while ((pos = first_record(_data_.data(), _data_.size(), 1, _data_eof_)) == std::string::npos && !_data_eof_) {
+                    more();
+                }
+            }
+            std::uint64_t dropped = 0; // bytes scanned and discarded before _data_.
+            while (pos != std::string::npos && dropped + pos <= limit) {
+                RecordSpan span;
+                std::size_t next;
+                const ParseStatus parsed = parse_record(_data_.data(), _data_.size(), pos, span, next);
+                if (parsed == ParseStatus::COMPLETE) {
+                    if (core_header(std::string_view(_data_.data() + span.header, span.header_len)) == core) {
+                        return advance({low, 0}, dropped + pos);
+                    }
+                    pos = next;
+                } else if (parsed == ParseStatus::MALFORMED) {
+                    throw std::runtime_error("Malformed FASTQ record in " + _path_);
+                } else {
+                    // Keep memory bounded: drop what was scanned, then read on.
+                    _data_.erase(_data_.begin(), _data_.begin() + pos);
+                    dropped += pos;
+                    pos = 0;
+                    if (!more()) break;
+                }
+            }
+            if (low == 0 && high == _size_) {
+                throw std::runtime_error("No read " + std::string(core) + " in " + _path_ + " to match the other file");
+            }
+        }
+    }
+
+    /**
+     * @brief decompressed bytes from `from` to `to`.
+     */
+    std::uint64_t distance(SlicePoint from, SlicePoint to) const {
+        if (!_bgzf_) {
+            return to.raw - from.raw;
+        }
+        std::uint64_t bytes = 0;
+        for (std::uint64_t offset = from.raw; offset < to.raw;) {
+            std::uint32_t length, isize;
+            if (!block(offset, length, isize)) throw std::runtime_error("Corrupt BGZF block in " + _path_);
+            bytes += isize;
+            offset += length;
+        }
+        return bytes - from.skip + to.skip;
+    }
+
+private:
+    static constexpr std::size_t CHUNK = 1 << 20;
+    std::string _path_;
+    int _fd_ = -1;
+    BGZF *_bgzf_ = nullptr;     // nullptr for uncompressed files.
+    std::uint64_t _size_ = 0;
+    std::vector<char> _data_;   // decompressed text from the last start() on.
+    std::uint64_t _read_pos_ = 0;
+    bool _data_eof_ = false;
+
+    /**
+     * @brief parse the BGZF block header at `offset`, as bgzip writes it (a lone BC subfield).
+     * 
+     * @param length total block size on disk.
+     * @param isize decompressed size, from the block trailer.
+     */
+    bool block(std::uint64_t offset, std::uint32_t &length, std::uint32_t &isize) const {
+        unsigned char header[18];
+        if (offset + 28 > _size_ || ::pread(_fd_, header, 18, static_cast<off_t>(offset)) != 18) {
+            return false;
+        }
+        if (header[0] != 0x1f || header[1] != 0x8b || header[2] != 8 || !(header[3] & 4) ||
+            header[12] != 'B' || header[13] != 'C' || header[14] != 2 || header[15] != 0) {
+            return false;
+        }
+        length = (header[16] | header[17] << 8) + 1u;
+        unsigned char trailer[4];
+        if (offset + length > _size_ || ::pread(_fd_, trailer, 4, static_cast<off_t>(offset + length - 4)) != 4) {
+            return false;
+        }
+        isize = trailer[0] | trailer[1] << 8 | trailer[2] << 16 | static_cast<std::uint32_t>(trailer[3]) << 24;
+        return true;
+    }
+
+    /**
+     * @brief first offset at or after `offset` decompression can start from, size() if none.
+     * 
+     * Any byte for uncompressed files. For BGZF a block header followed by another
+     * one (or the end of the file), so compressed bytes that happen to look like a
+     * header aren't taken for one.
+     */
+    std::uint64_t resync(std::uint64_t offset) const {
+        if (!_bgzf_) {
+            return std::min(offset, _size_);
+        }
+        std::vector<unsigned char> raw(64 * 1024);
+        while (offset < _size_) {
+            const ssize_t got = ::pread(_fd_, raw.data(), raw.size(), static_cast<off_t>(offset));
+            if (got <= 0) break;
+            for (const unsigned char *magic = raw.data();
+                 (magic = static_cast<const unsigned char *>(std::memchr(magic, 0x1f, raw.data() + got - magic)));
+                 magic++) {
+                const std::uint64_t candidate = offset + (magic - raw.data());
+                std::uint32_t length, isize;
+                if (block(candidate, length, isize) &&
+                    (candidate + length == _size_ || block(candidate + length, length, isize))) {
+                    return candidate;
+                }
+            }
+            offset += static_cast<std::uint64_t>(got);
+        }
+        return _size_;
+    }
+
+    /**
+     * @brief restart decompressed reads at a resync point.
+     */
+    void start(std::uint64_t raw) {
+        _data_.clear();
+        _data_eof_ = raw >= _size_;
+        _read_pos_ = raw;
+        if (_bgzf_ && !_data_eof_ && bgzf_seek(_bgzf_, static_cast<std::int64_t>(raw << 16), SEEK_SET) < 0) {
+            throw std::runtime_error("Failed to seek in " + _path_);
+        }
+    }
+
+    /**
+     * @brief append the next chunk of decompressed text to _data_.
+     * 
+     * @return false at end of file.
+     */
+    bool more() {
+        if (_data_eof_) {
+            return false;
+        }
+        const std::size_t old_size = _data_.size();
+        _data_.resize(old_size + CHUNK);
+        const long long got = _bgzf_ ? bgzf_read(_bgzf_, _data_.data() + old_size, CHUNK)
+                                     : ::pread(_fd_, _data_.data() + old_size, CHUNK, static_cast<off_t>(_read_pos_));
+        if (got < 0) {
+            throw std::runtime_error("Failed to read " + _path_ + " for slicing");
+        }
+        _data_.resize(old_size + got);
+        _read_pos_ += static_cast<std::uint64_t>(got);
+        _data_eof_ = got == 0;
+        return got > 0;
+    }
+
+    /**
+     * @brief the point `bytes` decompressed bytes after `from`, with skip inside its block.
+     */
+    SlicePoint advance(SlicePoint from, std::uint64_t bytes) const {
+        if (!_bgzf_) {
+            return {from.raw + bytes, 0};
+        }
+        std::uint64_t skip = from.skip + bytes;
+        for (std::uint64_t offset = from.raw; offset < _size_;) {
+            std::uint32_t length, isize;
+            if (!block(offset, length, isize)) throw std::runtime_error("Corrupt BGZF block in " + _path_);
+            if (skip < isize) return {offset, skip};
+            skip -= isize;
+            offset += length;
+        }
+        return end();
+    }
+};
+
+/**
+ * @brief first record start in `data` at or after `from`, taking only line starts.
+ * 
+ * A quality line may begin with '@' too, so a candidate must parse as a record and
+ * so must the one after it (unless the file ends first).
+ * 
+ * @param data decompressed text, data[from - 1] must exist.
+ * @param size bytes in data.
+ * @param from first candidate offset, at least 1.
+ * @param at_end data runs to the end of the file.
+ * @return std::size_t offset, npos if none can be told yet (read more) or there is none.
+ */
+std::size_t FastqPairReader::first_record(const char *data, std::size_t size, std::size_t from, bool at_end) {
+    if (size < from) {
+        return std::string::npos;
+    }
+    for (std::size_t pos = from; pos <= size;) {
+        const char *newline = static_cast<const char *>(std::memchr(data + pos - 1, '\n', size - pos + 1));
+        if (!newline) {
+            return std::string::npos;
+        }
+        const std::size_t candidate = newline - data + 1;
+        pos = candidate + 1;
+        RecordSpan span;
+        std::size_t next;
+        const ParseStatus first = parse_record(data, size, candidate, span, next);
+        if (first == ParseStatus::MALFORMED) {
+            continue;
+        }
+        if (first == ParseStatus::INCOMPLETE) {
+            return std::string::npos; // at the end, it wasn't a full record.
+        }
+        const ParseStatus second = parse_record(data, size, next, span, next);
+        if (second == ParseStatus::COMPLETE || (at_end && second == ParseStatus::INCOMPLETE)) {
+            return candidate;
+        }
+        if (second == ParseStatus::INCOMPLETE) {
+            return std::string::npos;
+        }
+    }
+    return std::string::npos;
+}
+
+/**
+ * @brief find this slice's cuts in R1 and R2 and move both streams to its start.
+ */
+void FastqPairReader::open_slice() {
+    if (_slice_.count == 0 || _slice_.index >= _slice_.count) {
+        throw std::runtime_error("Invalid FASTQ slice " + std::to_string(_slice_.index) + " of " +
+                                 std::to_string(_slice_.count));
+    }
+    if (!splittable(_r1_path_) || !splittable(_r2_path_)) {
+        throw std::runtime_error("FASTQ files can't be read in slices, they must be uncompressed or BGZF");
+    }
+    SliceScanner scan_r1(_r1_path_, hts_get_format(panel_r1)->compression == bgzf);
+    SliceScanner scan_r2(_r2_path_, hts_get_format(panel_r2)->compression == bgzf);
+
+    SlicePoint r1[2], r2[2]; // begin, end.
+    for (std::size_t side = 0; side < 2; side++) {
+        const std::size_t k = _slice_.index + side;
+        if (k == 0) {
+            continue; // file start.
+        }
+        std::string core;
+        r1[side] = k == _slice_.count ? scan_r1.end() : scan_r1.cut(k, _slice_.count, core);
+        if (r1[side].raw >= scan_r1.size()) {
+            r2[side] = scan_r2.end();
+            continue;
+        }
+        const double fraction = static_cast<double>(r1[side].raw) / static_cast<double>(scan_r1.size());
+        r2[side] = scan_r2.find(core, static_cast<std::uint64_t>(fraction * static_cast<double>(scan_r2.size())));
+    }
+
+    seek_slice(panel_r1, _stream_r1_, r1[0], scan_r1.distance(r1[0], r1[1]));
+    seek_slice(panel_r2, _stream_r2_, r2[0], scan_r2.distance(r2[0], r2[1]));
+    // A cut inside a BGZF block still needs that block, at most 64 KiB.
+    _stream_r1_.raw_end = r1[1].raw + (r1[1].skip > 0 ? 1 << 16 : 0);
+    _stream_r2_.raw_end = r2[1].raw + (r2[1].skip > 0 ? 1 << 16 : 0);
+    _input_bytes_ = static_cast<std::int64_t>((r1[1].raw - r1[0].raw) + (r2[1].raw - r2[0].raw));
+}
+
+/**
+ * @brief position one file of the pair at a slice start.
+ * 
+ * @param file htsLib file pointer.
+ * @param stream gets the slice's extent.
+ * @param begin the slice's first record.
+ * @param bytes decompressed bytes in the slice.
+ */
+void FastqPairReader::seek_slice(htsFile *file, BlockStream &stream, SlicePoint begin, std::uint64_t bytes) {
+    stream.raw_begin = begin.raw;
+    stream.left = bytes;
+    BGZF *bgzf = hts_get_bgzfp(file);
+    const bool seeked = bgzf ? bgzf_seek(bgzf, static_cast<std::int64_t>(begin.raw << 16 | begin.skip), SEEK_SET) >= 0
+                             : hseek(file->fp.hfile, static_cast<off_t>(begin.raw), SEEK_SET) >= 0;
+    if (!seeked) {
+        throw std::runtime_error("Failed to seek to FASTQ slice");
+    }
+}
+
+/**
+ * @brief I/O totals for read 1 so far.
+ */
+FastqPairReader::FileStats FastqPairReader::r1_stats() const {
+    FileStats stats = _r1_stats_;
+    stats.compressed_bytes = stream_offset(panel_r1, _stream_r1_);
+    add_read_ahead_stats(_stream_r1_, stats);
+    return stats;
+}
+
+/**
+ * @brief I/O totals for read 2 so far.
+ */
+FastqPairReader::FileStats FastqPairReader::r2_stats() const {
+    FileStats stats = _r2_stats_;
+    stats.compressed_bytes = stream_offset(panel_r2, _stream_r2_);
+    add_read_ahead_stats(_stream_r2_, stats);
+    return stats;
+}
+
+/**
+ * @brief the prefetch thread's totals, if the stream has one.
+ */
+void FastqPairReader::add_read_ahead_stats(const BlockStream &stream, FileStats &stats) {
+    if (!stream.read_ahead) return;
+    const ReadAhead::Stats prefetch = stream.read_ahead->stats();
+    stats.prefetch_seconds = prefetch.io_seconds;
+    stats.prefetched_bytes = prefetch.bytes;
+}
+
+/**
+ * @brief prefetch both files ahead of next_batch(), see ReadAhead.
+ * 
+ * htslib is also told to read in chunk_bytes, so what it doesn't find cached is
+ * fetched in a few large reads rather than many small ones.
+ * 
+ * @param depth chunks kept ready ahead of the parser, 0 turns read-ahead off.
+ * @param chunk_bytes size of each prefetch read.
+ */
+void FastqPairReader::set_read_ahead(std::size_t depth, std::size_t chunk_bytes) {
+    if (depth > 0 && chunk_bytes == 0) {
+        throw std::invalid_argument("read-ahead chunk size must be at least 1 byte");
+    }
+    _read_ahead_depth_ = depth;
+    _read_ahead_chunk_ = chunk_bytes;
+    if (depth > 0) {
+        const int block_size = static_cast<int>(std::min<std::size_t>(chunk_bytes, INT_MAX));
+        hts_set_opt(panel_r1, HTS_OPT_BLOCK_SIZE, block_size); // best effort, the default buffer works too.
+        hts_set_opt(panel_r2, HTS_OPT_BLOCK_SIZE, block_size);
+    }
+}
+
+/**
+ * @brief start prefetching one file from where its stream will read next.
+ * 
+ * Mapped input is prefetched from the mapping position, anything else from
+ * htslib's offset in the file on disk; without one there is nothing to pace
+ * the prefetcher by and the file is read as usual.
+ */
+void FastqPairReader::start_read_ahead(const std::string &path, htsFile *file, BlockStream &stream) const {
+    const std::int64_t begin = stream.mapped ? static_cast<std::int64_t>(stream.mapped_pos) : compressed_offset(file);
+    if (begin < 0) {
+        return;
+    }
+    const std::uint64_t end = stream.mapped ? stream.mapped_end : stream.raw_end;
+    stream.read_ahead = std::make_unique<ReadAhead>(path, static_cast<std::uint64_t>(begin), end, _read_ahead_chunk_,
+                                                    _read_ahead_depth_);
+}
+
+/**
+ * @brief before a read from disk or the mapping: wait for read-ahead to cover it.
+ * 
+ * Read-ahead works in on-disk bytes. Through htslib the read is sized in
+ * decompressed bytes, so it is scaled by the stream's compression ratio so far;
+ * before the first read only the byte at the position is waited for.
+ * 
+ * @param file htsLib file pointer, unused for mapped input.
+ * @param bytes how many (decompressed) bytes the read may take.
+ * @param stats the wait is added to io_wait_seconds.
+ */
+void FastqPairReader::wait_for_input(htsFile *file, BlockStream &stream, std::uint64_t bytes, FileStats &stats) {
+    if (!stream.read_ahead) return;
+    const std::int64_t position = stream.mapped ? static_cast<std::int64_t>(stream.mapped_pos) : compressed_offset(file);
+    if (position < 0) return;
+    if (!stream.mapped) {
+        const std::uint64_t on_disk = static_cast<std::uint64_t>(position) - std::min<std::uint64_t>(stream.raw_begin, position);
+        bytes = stats.decompressed_bytes > 0
+                    ? static_cast<std::uint64_t>(static_cast<double>(bytes) * on_disk / stats.decompressed_bytes) + 1
+                    : 1;
+    }
+    stats.io_wait_seconds += stream.read_ahead->wait(static_cast<std::uint64_t>(position), bytes);
 }
 
 /*
@@ -65,28 +622,163 @@ FastqPairReader::~FastqPairReader() {
         - control number → typically 0 for normal reads
         - index string → single or dual sample index (e.g. i7 + i5)
     
-    This helper returns the substring from the beginning of the header up to
+    core_header() returns the chunk from the beginning of the header up to
     (but not including) the space.
 
     Comparing the "core" of R1 and R2 lets us verify that the read is indeed a proper pair.
 */
 
 /**
- * @brief extract the core header of a read file
+ * @brief core header of a header view, without allocating.
  * 
  * @param header 
- * @return std::string 
+ * @return std::string_view into header, the whole header if it has no space
+ * (eg @LH00266:77:222WGNLT4:4:1101:51131:1014).
  */
-std::string FastqPairReader::core_header(const std::string& header) {
-    std::size_t space_pos = header.find(' ');
+std::string_view FastqPairReader::core_header(std::string_view header) {
+    return header.substr(0, header.find(' ')); // npos -> whole header
+}
 
-    // No space found: return whole header (eg @LH00266:77:222WGNLT4:4:1101:51131:1014)
-    if (space_pos == std::string::npos) {
-        return header;
+/**
+ * @brief whether two headers share their core, compared in place on the line buffers.
+ * 
+ * One memchr for R1's space and one memcmp of the core, both vectorised in glibc;
+ * R2 only needs a space (or its end) right where R1's core ends.
+ * 
+ * @param r1_header 
+ * @param r2_header 
+ * @return true if the pair is a proper pair.
+ */
+bool FastqPairReader::same_core_header(std::string_view r1_header, std::string_view r2_header) {
+    const std::size_t core = std::min(r1_header.find(' '), r1_header.size());
+    return r2_header.size() >= core && std::memcmp(r1_header.data(), r2_header.data(), core) == 0 &&
+           (r2_header.size() == core || r2_header[core] == ' ');
+}
+
+/**
+ * @brief size of the caller's batch pool, bounds how long a batch that never comes
+ * back can hold on to its mapped pages.
+ * 
+ * @param batches batches passed to next_batch() in turn, at least 1.
+ */
+void FastqPairReader::set_batches_in_flight(std::size_t batches) {
+    _batches_in_flight_ = std::max<std::size_t>(1, batches);
+}
+
+/**
+ * @brief choose how pairing is verified, see PairCheck.
+ * 
+ * @param mode 
+ * @param every_nth N for EVERY_NTH, at least 1.
+ */
+void FastqPairReader::set_pair_check(PairCheck mode, std::size_t every_nth) {
+    if (mode == PairCheck::EVERY_NTH && every_nth == 0) {
+        throw std::invalid_argument("pair check interval must be at least 1");
     }
+    _pair_check_ = mode;
+    _pair_check_every_ = mode == PairCheck::EVERY_NTH ? every_nth : 1;
+}
 
-    // Return everything up to (but not including) the space.
-    return header.substr(0, space_pos);
+/**
+ * @brief verify the pairing of a freshly filled batch, as the PairCheck mode says.
+ * 
+ * A failed spot check is followed by a check of the whole batch, so the error
+ * points at the first bad pair if the drift started in this batch.
+ * 
+ * @param pairs the batch.
+ * @return std::size_t index of the first mismatched pair, pairs.size() if none.
+ */
+std::size_t FastqPairReader::check_pairing(const std::vector<PairView> &pairs) {
+    auto paired = [&](std::size_t i) {
+        _pairs_checked_++;
+        return same_core_header(pairs[i].r1.header, pairs[i].r2.header);
+    };
+
+    bool failed = false;
+    switch (_pair_check_) {
+    case PairCheck::EVERY_PAIR:
+        for (std::size_t i = 0; i < pairs.size(); i++) {
+            if (!paired(i)) return i;
+        }
+        return pairs.size();
+    case PairCheck::EVERY_NTH:
+        for (std::size_t i = (_pair_check_every_ - _pairs_read_ % _pair_check_every_) % _pair_check_every_;
+             i < pairs.size() && !failed; i += _pair_check_every_) {
+            failed = !paired(i);
+        }
+        break;
+    case PairCheck::BATCH_ENDS:
+        failed = !pairs.empty() && !paired(pairs.size() - 1);
+        break;
+    }
+    if (!failed) {
+        return pairs.size();
+    }
+    for (std::size_t i = 0; i < pairs.size(); i++) {
+        if (!same_core_header(pairs[i].r1.header, pairs[i].r2.header)) return i;
+    }
+    return pairs.size();
+}
+
+/**
+ * @brief keep only a fraction of the pairs from now on, see Sampling.
+ * 
+ * @param sampling fraction in (0, 1], or a target pair count resolved on the first block.
+ */
+void FastqPairReader::set_sampling(const Sampling &sampling) {
+    if (!(sampling.fraction > 0.0 && sampling.fraction <= 1.0)) {
+        throw std::invalid_argument("sample fraction must be in (0, 1]");
+    }
+    _sampling_ = sampling;
+    _sample_below_ = sampling.fraction < 1.0 ? static_cast<std::uint64_t>(std::ldexp(sampling.fraction, 64)) : UINT64_MAX;
+    _sample_target_resolved_ = sampling.target_pairs == 0;
+}
+
+/**
+ * @brief turn Sampling::target_pairs into a fraction, from the pairs read per byte consumed.
+ * 
+ * Compressed offsets run ahead of the records parsed by whatever htslib has
+ * buffered, so the estimate is refined block by block until SAMPLE_ESTIMATE_BYTES
+ * are consumed, then fixed. Pairs before that are sampled at the estimate of
+ * the moment, a negligible share of a run big enough to want sampling. Without
+ * sizes to go by every pair is kept.
+ * 
+ * @param pairs pairs read so far.
+ * @param consumed_bytes R1 + R2 bytes they took, -1 if unknown.
+ */
+void FastqPairReader::resolve_sample_target(std::uint64_t pairs, std::int64_t consumed_bytes) {
+    static constexpr std::int64_t SAMPLE_ESTIMATE_BYTES = 16 << 20;
+    if (consumed_bytes <= 0 || _input_bytes_ <= 0) {
+        _sample_target_resolved_ = true;
+        return;
+    }
+    _sample_target_resolved_ = consumed_bytes >= std::min(SAMPLE_ESTIMATE_BYTES, _input_bytes_);
+    const double estimated_pairs = static_cast<double>(pairs) * _input_bytes_ / consumed_bytes;
+    _sampling_.fraction = std::min(1.0, _sampling_.target_pairs / estimated_pairs);
+    _sample_below_ = _sampling_.fraction < 1.0 ? static_cast<std::uint64_t>(std::ldexp(_sampling_.fraction, 64)) : UINT64_MAX;
+}
+
+/**
+ * @brief remove the pairs the sample leaves out, keeping the order of the rest.
+ * 
+ * The hash takes the core header 8 bytes at a time (FNV-style multiply), then a
+ * splitmix64 finaliser spreads the bits, so one multiply per word and no table.
+ */
+void FastqPairReader::drop_unsampled(std::vector<PairView> &pairs) const {
+    auto header_hash = [seed = _sampling_.seed](std::string_view core) {
+        std::uint64_t hash = 0xCBF29CE484222325ULL ^ seed;
+        for (std::size_t pos = 0; pos < core.size(); pos += 8) {
+            std::uint64_t word = 0;
+            std::memcpy(&word, core.data() + pos, std::min<std::size_t>(8, core.size() - pos));
+            hash = (hash ^ word) * 0x100000001B3ULL;
+        }
+        hash ^= hash >> 30;
+        hash *= 0xBF58476D1CE4E5B9ULL;
+        hash ^= hash >> 27;
+        hash *= 0x94D049BB133111EBULL;
+        return hash ^ hash >> 31;
+    };
+    std::erase_if(pairs, [&](const PairView &pair) { return header_hash(core_header(pair.r1.header)) >= _sample_below_; });
 }
 
 /**
@@ -97,7 +789,13 @@ std::string FastqPairReader::core_header(const std::string& header) {
  */
 ReadStatus FastqPairReader::next_record(FastqPair &pair)
 {
-    ReadStatus read_one = read_single_record(panel_r1, line_r1, pair.r1);
+    if (_stream_r1_.left == 0) {
+        return ReadStatus::END_OF_FILE; // end of the slice.
+    }
+    const std::uint64_t r1_before = _r1_stats_.decompressed_bytes;
+    const std::uint64_t r2_before = _r2_stats_.decompressed_bytes;
+
+    ReadStatus read_one = read_single_record(panel_r1, line_r1, pair.r1, _r1_stats_);
     if (read_one == ReadStatus::END_OF_FILE) {
         return ReadStatus::END_OF_FILE;
     }
@@ -106,30 +804,450 @@ ReadStatus FastqPairReader::next_record(FastqPair &pair)
         return ReadStatus::READ_ERROR;
     }
 
-    ReadStatus read_two = read_single_record(panel_r2, line_r2, pair.r2);
+    ReadStatus read_two = read_single_record(panel_r2, line_r2, pair.r2, _r2_stats_);
     // If R1 succeeded, but R2 did not, files are out of sync.
     if (read_two != ReadStatus::OK) {
         return ReadStatus::READ_ERROR;
     }
 
-    std::string core_header_r1 = core_header(pair.r1.header);
-    std::string core_header_r2 = core_header(pair.r2.header);
-    if (core_header_r1 != core_header_r2) {
+    if (_pair_check_ != PairCheck::EVERY_NTH || _pairs_read_ % _pair_check_every_ == 0) {
+        _pairs_checked_++;
+        if (!same_core_header(pair.r1.header, pair.r2.header)) {
+            return ReadStatus::READ_ERROR;
+        }
+    }
+    _pairs_read_++;
+
+    _stream_r1_.left -= _r1_stats_.decompressed_bytes - r1_before;
+    _stream_r2_.left -= _r2_stats_.decompressed_bytes - r2_before;
+    return ReadStatus::OK;
+}
+
+/**
+ * @brief fill a batch with up to max_pairs r1/r2 pairs, the ones the sample keeps.
+ *
+ * With sampling, max_pairs pairs are read and the batch holds the kept ones;
+ * reading goes on until one is kept, so an OK batch is never empty.
+ *
+ * @param batch reusable batch, cleared and refilled.
+ * @param max_pairs upper bound on pairs in the batch.
+ * @return ReadStatus as fill_batch().
+ */
+ReadStatus FastqPairReader::next_batch(RecordBatch &batch, std::size_t max_pairs) {
+    ReadStatus status = fill_batch(batch, max_pairs);
+    while (_sampling_.enabled() && status == ReadStatus::OK && batch.empty() && max_pairs > 0) {
+        status = fill_batch(batch, max_pairs);
+    }
+    return status;
+}
+
+/**
+ * @brief read up to max_pairs r1/r2 pairs into a batch.
+ *
+ * Instead of copying each line into a std::string, raw (decompressed) bytes are
+ * read straight into the batch's block buffers and records are handed out as
+ * string_views into them. Buffers keep their capacity between calls, so once
+ * warmed up there is no per-read allocation. Bytes read past the last complete
+ * record are carried into the next call.
+ *
+ * Uncompressed regular files skip the copy entirely: they are mapped on the first
+ * call and the views point into the mapping (see fill_mapped()).
+ *
+ * On READ_ERROR the batch holds the well-formed pairs before the bad one (those
+ * the sample keeps), and the offending pair is number pairs_read() + 1.
+ *
+ * @param batch reusable batch, cleared and refilled.
+ * @param max_pairs upper bound on pairs in the batch.
+ * @return ReadStatus OK with a non-empty batch, END_OF_FILE once R1 is exhausted,
+ * READ_ERROR if files are out of sync, core headers are different, etc.
+ */
+ReadStatus FastqPairReader::fill_batch(RecordBatch &batch, std::size_t max_pairs) {
+    if (!_stream_r1_.map_tried) {
+        map_input(_r1_path_, panel_r1, _stream_r1_);
+        map_input(_r2_path_, panel_r2, _stream_r2_);
+        if (_read_ahead_depth_ > 0) {
+            start_read_ahead(_r1_path_, panel_r1, _stream_r1_);
+            start_read_ahead(_r2_path_, panel_r2, _stream_r2_);
+        }
+    }
+    release_batch(batch); // its old views die here.
+    batch._pairs_.clear();
+    if (max_pairs == 0) {
+        return ReadStatus::OK;
+    }
+
+    const char *block_r1 = nullptr;
+    const char *block_r2 = nullptr;
+    ReadStatus status_r1 = fill_block(panel_r1, _stream_r1_, batch._block_r1_, max_pairs, _spans_r1_, _r1_stats_, block_r1);
+    const std::size_t num_r1 = _spans_r1_.size();
+    if (num_r1 == 0) {
+        return status_r1 == ReadStatus::OK ? ReadStatus::END_OF_FILE : ReadStatus::READ_ERROR;
+    }
+
+    // R2 must supply exactly as many records as R1 did.
+    ReadStatus status_r2 = fill_block(panel_r2, _stream_r2_, batch._block_r2_, num_r1, _spans_r2_, _r2_stats_, block_r2);
+    const std::size_t num_pairs = std::min(num_r1, _spans_r2_.size());
+
+    const std::int64_t offset_r1 = stream_offset(panel_r1, _stream_r1_);
+    const std::int64_t offset_r2 = stream_offset(panel_r2, _stream_r2_);
+    _consumed_bytes_.store(offset_r1 < 0 || offset_r2 < 0 ? -1 : offset_r1 + offset_r2, std::memory_order_relaxed);
+    if (_stream_r1_.mapped || _stream_r2_.mapped) {
+        _batch_extents_.push_back({_stream_r1_.mapped_pos, _stream_r2_.mapped_pos, false});
+        batch._sequence_ = _first_extent_sequence_ + _batch_extents_.size() - 1;
+    }
+
+    // Blocks are final now, so offsets can become views.
+    auto view = [](const char *block, const RecordSpan &span) {
+        return RecordView{
+            std::string_view(block + span.header, span.header_len),
+            std::string_view(block + span.sequence, span.sequence_len),
+            std::string_view(block + span.quality, span.sequence_len),
+        };
+    };
+
+    batch._pairs_.reserve(num_pairs);
+    for (std::size_t i = 0; i < num_pairs; i++) {
+        batch._pairs_.push_back({view(block_r1, _spans_r1_[i]), view(block_r2, _spans_r2_[i])});
+    }
+    const std::size_t num_paired = check_pairing(batch._pairs_);
+    _pairs_read_ += num_paired;
+    if (!_sample_target_resolved_) {
+        resolve_sample_target(_pairs_read_, _consumed_bytes_.load(std::memory_order_relaxed));
+    }
+    if (num_paired < num_pairs) {
+        batch._pairs_.resize(num_paired);
+        if (_sample_below_ < UINT64_MAX) drop_unsampled(batch._pairs_);
         return ReadStatus::READ_ERROR;
     }
+    // Every pair was checked, so pairing drift is still caught between sampled pairs.
+    if (_sample_below_ < UINT64_MAX) drop_unsampled(batch._pairs_);
+
+    if (status_r1 != ReadStatus::OK || status_r2 != ReadStatus::OK || num_pairs < num_r1) {
+        return ReadStatus::READ_ERROR; // malformed record, or R2 ended before R1.
+    }
+    return ReadStatus::OK;
+}
+
+/**
+ * @brief map an uncompressed regular file for fill_mapped(), if possible.
+ * 
+ * Anything else (gzip/BGZF, pipes, empty files, mmap failure) keeps reading
+ * through htslib. htslib has only peeked at the file (or seeked to a slice, which
+ * reads then resume from), so the mapping starts at the stream's raw_begin.
+ * 
+ * @param path file to map.
+ * @param file htsLib file pointer, for the compression check.
+ * @param stream set up for mapped reads on success.
+ */
+void FastqPairReader::map_input(const std::string &path, htsFile *file, BlockStream &stream) {
+    stream.map_tried = true;
+    if (hts_get_format(file)->compression != no_compression) {
+        return;
+    }
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    struct stat info;
+    if (::fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        void *data = ::mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            ::madvise(data, static_cast<std::size_t>(info.st_size), MADV_SEQUENTIAL); // aggressive read-ahead.
+            static const std::size_t PAGE = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+            stream.mapped = static_cast<const char *>(data);
+            stream.mapped_size = static_cast<std::size_t>(info.st_size);
+            stream.mapped_pos = std::min<std::size_t>(stream.raw_begin, stream.mapped_size);
+            stream.mapped_end = static_cast<std::size_t>(std::min<std::uint64_t>(stream.mapped_size, stream.raw_begin + stream.left));
+            stream.released = stream.mapped_pos / PAGE * PAGE; // earlier pages belong to other slices.
+        }
+    }
+    ::close(fd); // the mapping stays valid.
+}
+
+/**
+ * @brief a batch is being refilled: give back mapped pages no batch can reference anymore.
+ * 
+ * Batches come back out of order from the workers, so pages are only dropped up to
+ * the oldest batch still out. The mapping is read-only, dropped pages are just
+ * re-read if touched, and the file's page cache stops counting against our RSS.
+ */
+void FastqPairReader::release_batch(RecordBatch &batch) {
+    if (batch._sequence_ >= _first_extent_sequence_) {
+        _batch_extents_[batch._sequence_ - _first_extent_sequence_].refilled = true;
+    }
+    batch._sequence_ = 0;
+
+    std::size_t end_r1 = 0, end_r2 = 0;
+    bool released = false;
+    // A batch that is dropped instead of refilled never reports back. Past more batches
+    // out than the caller circulates, the oldest must be one of those.
+    while (!_batch_extents_.empty() &&
+           (_batch_extents_.front().refilled || _batch_extents_.size() > _batches_in_flight_)) {
+        end_r1 = _batch_extents_.front().end_r1;
+        end_r2 = _batch_extents_.front().end_r2;
+        _batch_extents_.pop_front();
+        _first_extent_sequence_++;
+        released = true;
+    }
+    if (!released) {
+        return;
+    }
+
+    static const std::size_t PAGE = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    auto give_back = [](BlockStream &stream, std::size_t end) {
+        const std::size_t page_end = end / PAGE * PAGE; // the page holding `end` may still be in use.
+        if (!stream.mapped || page_end <= stream.released) return;
+        ::madvise(const_cast<char *>(stream.mapped) + stream.released, page_end - stream.released, MADV_DONTNEED);
+        stream.released = page_end;
+    };
+    give_back(_stream_r1_, end_r1);
+    give_back(_stream_r2_, end_r2);
+}
+
+/**
+ * @brief read decompressed bytes from r1 or r2, bypassing hts_getline.
+ *
+ * Text files are backed by BGZF when compressed and by a plain hFILE otherwise.
+ * 
+ * @param file htsLib file pointer.
+ * @param buffer destination.
+ * @param length max bytes to read.
+ * @return long long bytes read, 0 at end of file, negative on error.
+ */
+long long FastqPairReader::raw_read(htsFile *file, char *buffer, std::size_t length) {
+    BGZF *bgzf = hts_get_bgzfp(file);
+    if (bgzf) {
+        return bgzf_read(bgzf, buffer, length);
+    }
+    if (hts_get_format(file)->compression == no_compression) {
+        return hread(file->fp.hfile, buffer, length);
+    }
+    return -1;
+}
+
+/**
+ * @brief locate the next record in a block, without copying it.
+ * 
+ * @param data block start.
+ * @param size bytes in block.
+ * @param pos offset of the record's header line.
+ * @param span line offsets, set on COMPLETE.
+ * @param next offset just past the record, set on COMPLETE.
+ * @return ParseStatus INCOMPLETE if the block ends before the fourth newline.
+ */
+FastqPairReader::ParseStatus FastqPairReader::parse_record(const char *data, std::size_t size, std::size_t pos,
+                                                           RecordSpan &span, std::size_t &next) {
+    std::size_t line_start[4];
+    std::size_t line_length[4];
+    std::size_t cursor = pos;
+
+    for (int i = 0; i < 4; i++) {
+        if (cursor >= size) {
+            return ParseStatus::INCOMPLETE;
+        }
+        const char *newline = static_cast<const char *>(std::memchr(data + cursor, '\n', size - cursor));
+        if (!newline) {
+            return ParseStatus::INCOMPLETE;
+        }
+        const std::size_t line_end = newline - data;
+        line_start[i] = cursor;
+        line_length[i] = line_end - cursor;
+        if (line_length[i] > 0 && data[line_end - 1] == '\r') {
+            line_length[i]--; // tolerate CRLF files
+        }
+        cursor = line_end + 1;
+    }
+
+    // Same checks as read_single_record: header, plus line, matching lengths.
+    if (line_length[0] == 0 || data[line_start[0]] != '@') {
+        return ParseStatus::MALFORMED;
+    }
+    if (line_length[2] == 0 || data[line_start[2]] != '+') {
+        return ParseStatus::MALFORMED;
+    }
+    if (line_length[1] != line_length[3]) {
+        return ParseStatus::MALFORMED;
+    }
+
+    span = {line_start[0], line_length[0], line_start[1], line_length[1], line_start[3]};
+    next = cursor;
+    return ParseStatus::COMPLETE;
+}
+
+/**
+ * @brief parse up to `want` records into `block`, reading more input as needed.
+ * 
+ * @param file htsLib file pointer.
+ * @param stream carried-over bytes and end of file flag for this file.
+ * @param block batch buffer for this file, ends on the last complete record.
+ * @param want number of records wanted.
+ * @param spans line offsets of each record in block.
+ * @param stats per-file totals.
+ * @param base set to what the spans are offsets into: block, or the file mapping.
+ * @return ReadStatus OK (fewer than `want` records means end of file), READ_ERROR
+ * on malformed or truncated input, with spans holding the good records before it.
+ */
+ReadStatus FastqPairReader::fill_block(htsFile *file, BlockStream &stream, std::vector<char> &block, std::size_t want,
+                                       std::vector<RecordSpan> &spans, FileStats &stats, const char *&base) {
+    spans.clear();
+    if (stream.mapped && !stream.mapped_done) {
+        ReadStatus status = fill_mapped(stream, want, spans, stats);
+        if (!stream.mapped_done) {
+            base = stream.mapped;
+            return status;
+        }
+        // Only an unterminated last record is left, it now sits in pending.
+    }
+    ReadStatus status = fill_buffered(file, stream, block, want, spans, stats);
+    base = block.data();
+    return status;
+}
+
+/**
+ * @brief fill_block() through htslib: read into block, carrying leftovers in stream.pending.
+ */
+ReadStatus FastqPairReader::fill_buffered(htsFile *file, BlockStream &stream, std::vector<char> &block, std::size_t want,
+                                          std::vector<RecordSpan> &spans, FileStats &stats) {
+    static constexpr std::size_t MIN_READ_BYTES = 64 * 1024;
+
+    block.swap(stream.pending); // leftover bytes start the block, old block's capacity becomes the next pending.
+    stream.pending.clear();
+
+    std::size_t pos = 0;
+    while (spans.size() < want) {
+        RecordSpan span;
+        std::size_t next = 0;
+        ParseStatus parsed = parse_record(block.data(), block.size(), pos, span, next);
+
+        if (parsed == ParseStatus::COMPLETE) {
+            spans.push_back(span);
+            pos = next;
+            continue;
+        }
+
+        if (parsed == ParseStatus::MALFORMED) {
+            return ReadStatus::READ_ERROR;
+        }
+
+        // INCOMPLETE, need more input.
+        if (stream.eof) {
+            if (pos == block.size()) {
+                break; // clean end of file.
+            }
+            if (block.back() != '\n') {
+                block.push_back('\n'); // last line had no newline.
+                continue;
+            }
+            return ReadStatus::READ_ERROR; // truncated record.
+        }
+
+        // Never past the end of a slice, the next slice's reader owns what follows.
+        const std::size_t chunk = static_cast<std::size_t>(std::min<std::uint64_t>(
+            std::max(MIN_READ_BYTES, (want - spans.size() + 1) * stream.avg_record_bytes), stream.left));
+        const std::size_t old_size = block.size();
+        block.resize(old_size + chunk);
+
+        const auto start = std::chrono::steady_clock::now();
+        wait_for_input(file, stream, chunk, stats);
+        long long got = chunk > 0 ? raw_read(file, block.data() + old_size, chunk) : 0;
+        stats.read_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (got < 0) {
+            return ReadStatus::READ_ERROR;
+        }
+        block.resize(old_size + got);
+        stats.decompressed_bytes += got;
+        stream.left -= got;
+        if (got == 0) {
+            stream.eof = true;
+        }
+    }
 
+    stream.pending.assign(block.begin() + pos, block.end());
+    block.resize(pos);
+    if (!spans.empty()) {
+        stream.avg_record_bytes = std::max<std::size_t>(1, pos / spans.size());
+    }
     return ReadStatus::OK;
 }
 
+/**
+ * @brief fill_block() for a mapped file: find up to `want` records in place.
+ * 
+ * No copy at all, the spans are offsets into the mapping. memchr does the
+ * newline search (vectorised in glibc). A slice ends at mapped_end, on a record
+ * start. A last record without a final newline can't be viewed in place; once
+ * it is all that's left it is copied into stream.pending and mapped_done hands
+ * the file over to the buffered path.
+ * 
+ * @return ReadStatus same contract as fill_block().
+ */
+ReadStatus FastqPairReader::fill_mapped(BlockStream &stream, std::size_t want, std::vector<RecordSpan> &spans,
+                                        FileStats &stats) {
+    const auto start = std::chrono::steady_clock::now(); // page faults are this reader's I/O.
+    wait_for_input(nullptr, stream, want * stream.avg_record_bytes, stats);
+    const std::size_t first = stream.mapped_pos;
+    std::size_t pos = first;
+    ReadStatus status = ReadStatus::OK;
+
+    while (spans.size() < want) {
+        RecordSpan span;
+        std::size_t next = 0;
+        ParseStatus parsed = parse_record(stream.mapped, stream.mapped_end, pos, span, next);
+        if (parsed == ParseStatus::COMPLETE) {
+            spans.push_back(span);
+            pos = next;
+            continue;
+        }
+        if (parsed == ParseStatus::MALFORMED) {
+            status = ReadStatus::READ_ERROR;
+        } else if (pos < stream.mapped_end && spans.empty()) {
+            stream.pending.assign(stream.mapped + pos, stream.mapped + stream.mapped_end);
+            stream.eof = true;
+            stream.mapped_done = true;
+            pos = stream.mapped_end;
+        }
+        break; // end of file, malformed, or the unterminated tail (next call).
+    }
+
+    stream.mapped_pos = pos;
+    if (!spans.empty()) {
+        stream.avg_record_bytes = std::max<std::size_t>(1, (pos - first) / spans.size());
+    }
+    stats.decompressed_bytes += pos - first;
+    stats.read_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return status;
+}
+
 /**
  * @brief read a single record from r1 or r2. Used twice to get a full record.
  * 
  * @param file htsLib file pointer.
  * @param line 
  * @param record (1) header, (2) sequence, (3) pluses, (4) quality.
+ * @param stats per-file totals, bytes and time spent in htslib are added.
+ * @return ReadStatus 
+ */
+ReadStatus FastqPairReader::read_single_record(htsFile *file, kstring_t &line, Record &record, FileStats &stats) {
+    const auto start = std::chrono::steady_clock::now();
+    ReadStatus status = read_lines(file, line, record);
+    stats.read_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (status == ReadStatus::OK) {
+        // +4 for the newlines hts_getline strips.
+        stats.decompressed_bytes += record.header.size() + record.sequence.size() + record.plus.size() + record.quality.size() + 4;
+    }
+    return status;
+}
+
+/**
+ * @brief the four hts_getline calls behind read_single_record.
+ * 
+ * @param file htsLib file pointer.
+ * @param line 
+ * @param record (1) header, (2) sequence, (3) pluses, (4) quality.
  * @return ReadStatus 
  */
-ReadStatus FastqPairReader::read_single_record(htsFile *file, kstring_t &line, Record &record) {
+ReadStatus FastqPairReader::read_lines(htsFile *file, kstring_t &line, Record &record) {
     // 1) HEADER
     int ret = hts_getline(file, '\n', &line);
     if (ret == -1) {
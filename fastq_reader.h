@@ -1,9 +1,16 @@
 #ifndef FASTQ_READER_H
 #define FASTQ_READER_H
+#include <atomic>
+#include <cstdint>
+#include <deque>
 #include <string>
+#include <string_view>
+#include <vector>
 #include <htslib/kstring.h>
 #include <htslib/hts.h>
 #include <iostream>
+#include <memory>
+#include "read_ahead.h"
 
 class FastqPairReader {
 public:
@@ -19,14 +26,131 @@ public:
         Record r2;
     };
 
+    // Non-owning view of one record inside a RecordBatch block. The plus line is skipped.
+    struct RecordView {
+        std::string_view header;
+        std::string_view sequence;
+        std::string_view quality;
+    };
+
+    struct PairView {
+        RecordView r1;
+        RecordView r2;
+    };
+
+    // Reusable block of records filled by next_batch(). Views point into the
+    // batch's own buffers, or straight into the mapping for uncompressed input,
+    // and stay valid until the batch is refilled (and while the reader is alive).
+    class RecordBatch {
+    public:
+        std::size_t size() const { return _pairs_.size(); }
+        bool empty() const { return _pairs_.empty(); }
+        const PairView &operator[](std::size_t i) const { return _pairs_[i]; }
+        std::vector<PairView>::const_iterator begin() const { return _pairs_.begin(); }
+        std::vector<PairView>::const_iterator end() const { return _pairs_.end(); }
+
+    private:
+        friend class FastqPairReader;
+        std::vector<char> _block_r1_;
+        std::vector<char> _block_r2_;
+        std::vector<PairView> _pairs_;
+        std::uint64_t _sequence_ = 0; // which mapped extent the views use, 0 if none.
+    };
+
     enum class ReadStatus {
         OK,
         END_OF_FILE,
         READ_ERROR,
     };
-    FastqPairReader(const std::string& r1_path, const std::string& r2_path);
+
+    // How R1/R2 pairing is verified by core header. R1 and R2 are read in lockstep,
+    // so once they drift apart every later pair mismatches and a spot check finds it.
+    enum class PairCheck {
+        EVERY_PAIR,  // default.
+        EVERY_NTH,   // pairs 0, N, 2N, ... of the stream.
+        BATCH_ENDS,  // last pair of each next_batch(); next_record() still checks every pair.
+    };
+
+    // Subsampling for quick previews: a pair is kept when a hash of its core
+    // header falls below `fraction`, so the choice is spread over the whole file
+    // (not biased by tile order like a prefix), is the same for R1 and R2, every
+    // slice and every rerun, and costs no state. next_batch() only hands out kept pairs.
+    struct Sampling {
+        double fraction = 1.0;          // of the pairs kept, 1 -> all.
+        std::uint64_t target_pairs = 0; // > 0: fraction set to keep about this many, from the record size.
+        std::uint64_t seed = 0;         // another seed draws another sample.
+        bool enabled() const { return fraction < 1.0 || target_pairs > 0; }
+    };
+
+    // Per-file I/O totals, reported at the end of a run.
+    struct FileStats {
+        std::int64_t compressed_bytes = 0;  // raw bytes consumed from disk, -1 if htslib can't tell.
+        std::uint64_t decompressed_bytes = 0;
+        double read_seconds = 0.0;          // time spent inside hts_getline (inflate + I/O).
+        // With read-ahead: part of read_seconds spent waiting for data (I/O-bound), and
+        // the prefetch thread's own time in pread.
+        double io_wait_seconds = 0.0;
+        double prefetch_seconds = 0.0;
+        std::uint64_t prefetched_bytes = 0;
+    };
+
+    // Part `index` of `count` about equal byte ranges of R1, cut on record boundaries.
+    // R2 is cut at the same reads, so each slice is an independent pair of streams.
+    struct Slice {
+        std::size_t index;
+        std::size_t count;
+    };
+
+    // decompress_threads > 0 attaches one htslib thread pool shared by R1 and R2.
+    // A slice other than {0, 1} needs splittable() files and is read with next_batch().
+    FastqPairReader(const std::string& r1_path, const std::string& r2_path, int decompress_threads = 0,
+                    Slice slice = {0, 1});
     ~FastqPairReader();
+    FastqPairReader(const FastqPairReader&) = delete;
+    FastqPairReader& operator=(const FastqPairReader&) = delete;
     ReadStatus next_record(FastqPair& pair);
+    // Fill `batch` with up to max_pairs pairs. Don't mix with next_record() on the same reader.
+    ReadStatus next_batch(RecordBatch& batch, std::size_t max_pairs);
+
+    // Uncompressed regular file or BGZF; plain gzip can only be read from the start.
+    static bool splittable(const std::string& path);
+
+    // Set before reading; every_nth only matters for EVERY_NTH.
+    void set_pair_check(PairCheck mode, std::size_t every_nth = 1);
+    PairCheck pair_check() const { return _pair_check_; }
+    std::size_t pair_check_every() const { return _pair_check_every_; }
+    // Pairs whose core headers were compared so far.
+    std::uint64_t pairs_checked() const { return _pairs_checked_; }
+
+    // Set before reading. sampling() has the fraction in use once target_pairs is resolved.
+    void set_sampling(const Sampling &sampling);
+    const Sampling &sampling() const { return _sampling_; }
+    // Pairs read from the files so far, sampled out or not.
+    std::uint64_t pairs_read() const { return _pairs_read_; }
+
+    // Set before reading: prefetch R1 and R2 `depth` chunks of chunk_bytes ahead of the
+    // parser on threads of their own (see ReadAhead), and read through htslib in chunk_bytes.
+    void set_read_ahead(std::size_t depth, std::size_t chunk_bytes);
+    std::size_t read_ahead_depth() const { return _read_ahead_depth_; }
+
+    // How many batches the caller circulates through next_batch() (its whole pool,
+    // queued and being parsed included). Past that many out, the oldest is taken for
+    // dropped and its mapped pages are given back.
+    void set_batches_in_flight(std::size_t batches);
+
+    int decompress_threads() const { return _decompress_threads_; }
+    Slice slice() const { return _slice_; }
+    // True once next_batch() reads R1/R2 through mmap (uncompressed regular files).
+    bool r1_memory_mapped() const { return _stream_r1_.mapped != nullptr; }
+    bool r2_memory_mapped() const { return _stream_r2_.mapped != nullptr; }
+    FileStats r1_stats() const;
+    FileStats r2_stats() const;
+
+    // R1 + R2 size on disk, -1 if either can't be stat'ed.
+    std::int64_t input_bytes() const { return _input_bytes_; }
+    // R1 + R2 bytes consumed from disk as of the last next_batch(), -1 if htslib
+    // can't tell. Safe to poll from another thread, e.g. a progress reporter.
+    std::int64_t consumed_bytes() const { return _consumed_bytes_.load(std::memory_order_relaxed); }
 
 private:
     std::string _r1_path_;
@@ -36,8 +160,96 @@ private:
     // kstring_t has 3 fields: (1) l (length of string), m (allocated size for buffer), *s (string data).
     kstring_t line_r1 = KS_INITIALIZE;
     kstring_t line_r2 = KS_INITIALIZE;
-    ReadStatus read_single_record(htsFile *fp, kstring_t &line, Record &rec);
-    static std::string core_header(const std::string& header);
+    htsThreadPool _thread_pool_ = {nullptr, 0};
+    int _decompress_threads_ = 0;
+    std::size_t _read_ahead_depth_ = 0; // 0 -> off.
+    std::size_t _read_ahead_chunk_ = 0;
+    Slice _slice_ = {0, 1};
+    PairCheck _pair_check_ = PairCheck::EVERY_PAIR;
+    std::size_t _pair_check_every_ = 1;
+    std::uint64_t _pairs_read_ = 0;     // pairs read, numbers the stream for EVERY_NTH.
+    std::uint64_t _pairs_checked_ = 0;
+    Sampling _sampling_;
+    std::uint64_t _sample_below_ = UINT64_MAX; // pairs whose header hash is at or above this are dropped.
+    bool _sample_target_resolved_ = true;
+    FileStats _r1_stats_;
+    FileStats _r2_stats_;
+    std::int64_t _input_bytes_ = -1;
+    std::atomic<std::int64_t> _consumed_bytes_{0};
+    // Offsets of one record's lines inside a block, turned into views once the block stops growing.
+    struct RecordSpan {
+        std::size_t header, header_len;
+        std::size_t sequence, sequence_len;
+        std::size_t quality;
+    };
+    // Bytes read past the last record handed out, carried into the next block.
+    // Uncompressed files are mapped instead and records are found in place.
+    struct BlockStream {
+        std::vector<char> pending;
+        bool eof = false;
+        std::size_t avg_record_bytes = 512; // sizes the next read so a block holds about one batch.
+        bool map_tried = false;
+        const char *mapped = nullptr;       // whole file, nullptr when read through htslib.
+        std::size_t mapped_size = 0;
+        std::size_t mapped_pos = 0;         // next unparsed byte.
+        std::size_t released = 0;           // pages before this were handed back to the kernel.
+        bool mapped_done = false;           // the rest of the file went through pending.
+        std::size_t mapped_end = 0;         // end of the slice in the mapping.
+        std::uint64_t raw_begin = 0;        // on-disk offset the slice starts at.
+        std::uint64_t left = UINT64_MAX;    // decompressed bytes to the end of the slice.
+        std::uint64_t raw_end = UINT64_MAX; // on-disk offset the slice's data ends by.
+        std::unique_ptr<ReadAhead> read_ahead; // nullptr unless set_read_ahead().
+    };
+    // A record start inside R1 or R2: a byte offset, or for BGZF the offset of the
+    // block holding it plus `skip` decompressed bytes (a virtual offset).
+    struct SlicePoint {
+        std::uint64_t raw = 0;
+        std::uint64_t skip = 0;
+    };
+    class SliceScanner; // finds slice boundaries, see fastq_reader.cpp.
+    // Mapped bytes each handed-out batch may still reference, oldest first. Batches
+    // move through queues by value, so they are tracked by sequence, not address.
+    struct BatchExtent {
+        std::size_t end_r1, end_r2;
+        bool refilled;
+    };
+    enum class ParseStatus {
+        COMPLETE,
+        INCOMPLETE,
+        MALFORMED,
+    };
+    BlockStream _stream_r1_;
+    BlockStream _stream_r2_;
+    std::vector<RecordSpan> _spans_r1_;
+    std::vector<RecordSpan> _spans_r2_;
+    std::deque<BatchExtent> _batch_extents_;   // sequences _first_extent_sequence_ onwards.
+    std::uint64_t _first_extent_sequence_ = 1;
+    std::size_t _batches_in_flight_ = 64;
+    ReadStatus fill_batch(RecordBatch &batch, std::size_t max_pairs);
+    void resolve_sample_target(std::uint64_t pairs, std::int64_t consumed_bytes);
+    void drop_unsampled(std::vector<PairView> &pairs) const;
+    ReadStatus fill_block(htsFile *fp, BlockStream &stream, std::vector<char> &block, std::size_t want,
+                          std::vector<RecordSpan> &spans, FileStats &stats, const char *&base);
+    ReadStatus fill_buffered(htsFile *fp, BlockStream &stream, std::vector<char> &block, std::size_t want,
+                             std::vector<RecordSpan> &spans, FileStats &stats);
+    ReadStatus fill_mapped(BlockStream &stream, std::size_t want, std::vector<RecordSpan> &spans, FileStats &stats);
+    void open_slice();
+    static void seek_slice(htsFile *fp, BlockStream &stream, SlicePoint begin, std::uint64_t bytes);
+    static std::size_t first_record(const char *data, std::size_t size, std::size_t from, bool at_end);
+    static void map_input(const std::string &path, htsFile *fp, BlockStream &stream);
+    void start_read_ahead(const std::string &path, htsFile *fp, BlockStream &stream) const;
+    static void wait_for_input(htsFile *fp, BlockStream &stream, std::uint64_t bytes, FileStats &stats);
+    static void add_read_ahead_stats(const BlockStream &stream, FileStats &stats);
+    void release_batch(RecordBatch &batch);
+    static std::int64_t stream_offset(htsFile *fp, const BlockStream &stream);
+    static ParseStatus parse_record(const char *data, std::size_t size, std::size_t pos, RecordSpan &span, std::size_t &next);
+    static long long raw_read(htsFile *fp, char *buffer, std::size_t length);
+    ReadStatus read_single_record(htsFile *fp, kstring_t &line, Record &rec, FileStats &stats);
+    static ReadStatus read_lines(htsFile *fp, kstring_t &line, Record &rec);
+    static std::int64_t compressed_offset(htsFile *fp);
+    std::size_t check_pairing(const std::vector<PairView> &pairs);
+    static std::string_view core_header(std::string_view header);
+    static bool same_core_header(std::string_view r1_header, std::string_view r2_header);
 };
 
 std::ostream& operator<<(std::ostream& os, const FastqPairReader::Record& rec);
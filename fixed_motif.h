@@ -0,0 +1,186 @@
+#ifndef FIXED_MOTIF_H
+#define FIXED_MOTIF_H
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include "motif_search.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/* find_with_mismatches() specialised for one FixedMotif, for the chemistry
+ * constants in dabseq_utilities.h.
+ *
+ * The block kernels are the ones of motif_search.cpp, with the per-base loop
+ * expanded by a fold over the motif's positions: every broadcast is a constant
+ * and there is no loop counter or motif load left. Anchored checks and starts
+ * too few for a vector block compare packed 8-byte words instead of bytes.
+ * Results are identical to find_with_mismatches() at any max_mismatches; the
+ * runtime version stays for motifs that aren't known at build time.
+ */
+
+namespace fixed_motif_detail {
+
+constexpr std::uint64_t LOW7 = 0x7F7F7F7F7F7F7F7FULL;
+
+/**
+ * @brief number of non-zero bytes in x.
+ */
+inline int nonzero_bytes(std::uint64_t x) {
+    return std::popcount((((x & LOW7) + LOW7) | x) & ~LOW7);
+}
+
+/**
+ * @brief substitutions between MOTIF and the MOTIF.size() bytes at data.
+ */
+template <FixedMotif MOTIF>
+int mismatches_at(const char *data) {
+    int mismatches = 0;
+    [&]<std::size_t... W>(std::index_sequence<W...>) {
+        ((mismatches += [&]() {
+             constexpr std::size_t BYTES = MOTIF.size() - 8 * W < 8 ? MOTIF.size() - 8 * W : 8;
+             std::uint64_t word = 0;
+             std::memcpy(&word, data + 8 * W, BYTES);
+             return nonzero_bytes(word ^ MOTIF.words[W]);
+         }()),
+         ...);
+    }(std::make_index_sequence<MOTIF.WORDS>{});
+    return mismatches;
+}
+
+/**
+ * @brief first start in [0, last_start] within max_mismatches, one word compare per start.
+ */
+template <FixedMotif MOTIF>
+std::size_t search_words(const char *data, std::size_t last_start, int max_mismatches) {
+    for (std::size_t start = 0; start <= last_start; start++) {
+        if (mismatches_at<MOTIF>(data + start) <= max_mismatches) return start;
+    }
+    return std::string::npos;
+}
+
+/**
+ * @brief scan aligned blocks of LANES starts, then one overlapping block ending at last_start.
+ *
+ * @param block_hits bitmask of hits among the starts of a block, BITS bits per start.
+ */
+template <std::size_t LANES, std::size_t BITS, typename BlockHits>
+std::size_t search_blocks(std::size_t last_start, BlockHits block_hits) {
+    std::size_t block = 0;
+    for (; block + LANES - 1 <= last_start; block += LANES) {
+        const auto hits = block_hits(block);
+        if (hits) return block + std::countr_zero(hits) / BITS;
+    }
+    if (block > last_start) return std::string::npos;
+
+    const std::size_t tail = last_start + 1 - LANES;
+    const auto hits = block_hits(tail) >> ((block - tail) * BITS); // drop starts already checked.
+    return hits ? block + std::countr_zero(hits) / BITS : std::string::npos;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+template <FixedMotif MOTIF>
+std::size_t search_sse2(const char *data, std::size_t last_start, int max_mismatches) {
+    const __m128i threshold = _mm_set1_epi8(static_cast<char>(MOTIF.size() - max_mismatches - 1));
+    return search_blocks<16, 1>(last_start, [&](std::size_t block) {
+        __m128i matches = _mm_setzero_si128();
+        [&]<std::size_t... J>(std::index_sequence<J...>) {
+            ((matches = _mm_sub_epi8(matches, _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + block + J)),
+                                                             _mm_set1_epi8(MOTIF.bases[J])))),
+             ...);
+        }(std::make_index_sequence<MOTIF.size()>{});
+        return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpgt_epi8(matches, threshold)));
+    });
+}
+
+template <FixedMotif MOTIF>
+__attribute__((target("avx2")))
+std::size_t search_avx2(const char *data, std::size_t last_start, int max_mismatches) {
+    const __m256i threshold = _mm256_set1_epi8(static_cast<char>(MOTIF.size() - max_mismatches - 1));
+    return search_blocks<32, 1>(last_start, [&](std::size_t block) __attribute__((target("avx2"))) {
+        __m256i matches = _mm256_setzero_si256();
+        [&]<std::size_t... J>(std::index_sequence<J...>) __attribute__((target("avx2"))) {
+            ((matches = _mm256_sub_epi8(matches, _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + block + J)),
+                                                                   _mm256_set1_epi8(MOTIF.bases[J])))),
+             ...);
+        }(std::make_index_sequence<MOTIF.size()>{});
+        return static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpgt_epi8(matches, threshold)));
+    });
+}
+
+#endif // x86
+
+#if defined(__aarch64__)
+
+template <FixedMotif MOTIF>
+std::size_t search_neon(const char *data, std::size_t last_start, int max_mismatches) {
+    const uint8x16_t needed = vdupq_n_u8(static_cast<std::uint8_t>(MOTIF.size() - max_mismatches));
+    const auto *bytes = reinterpret_cast<const std::uint8_t *>(data);
+    // 4 mask bits per start: the shift-right-narrow turns each 0x00/0xFF lane into a nibble.
+    return search_blocks<16, 4>(last_start, [&](std::size_t block) {
+        uint8x16_t matches = vdupq_n_u8(0);
+        [&]<std::size_t... J>(std::index_sequence<J...>) {
+            ((matches = vsubq_u8(matches, vceqq_u8(vld1q_u8(bytes + block + J),
+                                                   vdupq_n_u8(static_cast<std::uint8_t>(MOTIF.bases[J]))))),
+             ...);
+        }(std::make_index_sequence<MOTIF.size()>{});
+        const uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(vcgeq_u8(matches, needed)), 4);
+        return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+    });
+}
+
+#endif // aarch64
+
+} // namespace fixed_motif_detail
+
+/**
+ * @brief true if MOTIF sits exactly at seq[pos] with at most max_mismatches substitutions.
+ */
+template <FixedMotif MOTIF>
+bool fixed_motif_at(std::string_view seq, std::size_t pos, int max_mismatches) {
+    if (pos > seq.size() || seq.size() - pos < MOTIF.size()) return false;
+    return fixed_motif_detail::mismatches_at<MOTIF>(seq.data() + pos) <= max_mismatches;
+}
+
+/**
+ * @brief first position where MOTIF occurs in seq with at most max_mismatches substitutions.
+ *
+ * Uses the vector width of best_motif_search_kernel().
+ *
+ * @return std::size_t match start, std::string::npos if none.
+ */
+template <FixedMotif MOTIF>
+std::size_t find_fixed_motif(std::string_view seq, int max_mismatches) {
+    static_assert(MOTIF.size() <= 127, "per-position match counters are signed bytes");
+    if (seq.size() < MOTIF.size() || max_mismatches < 0) return std::string::npos;
+    if (static_cast<std::size_t>(max_mismatches) >= MOTIF.size()) return 0; // anything matches.
+
+    const std::size_t last_start = seq.size() - MOTIF.size();
+#if defined(__x86_64__) || defined(__i386__)
+    static const bool avx2 = best_motif_search_kernel().search == find_with_mismatches_avx2;
+    if (avx2 && last_start + 1 >= 32) {
+        return fixed_motif_detail::search_avx2<MOTIF>(seq.data(), last_start, max_mismatches);
+    }
+    if (last_start + 1 >= 16) {
+        return fixed_motif_detail::search_sse2<MOTIF>(seq.data(), last_start, max_mismatches);
+    }
+#elif defined(__aarch64__)
+    if (last_start + 1 >= 16) {
+        return fixed_motif_detail::search_neon<MOTIF>(seq.data(), last_start, max_mismatches);
+    }
+#endif
+    return fixed_motif_detail::search_words<MOTIF>(seq.data(), last_start, max_mismatches);
+}
+
+#endif // FIXED_MOTIF_H
@@ -2,10 +2,254 @@
 #include "fastq_reader.h"
 #include "barcode_index.h"
 #include "dabseq_utilities.h"
+#include "read_pipeline.h"
+#include "tsv_writer.h"
+#include "mtx_writer.h"
+#include "sample_sheet.h"
+#include "progress_reporter.h"
 #include <fstream>
+#include <sstream>
 #include <iomanip>    // for std::setprecision, std::setw, std::left
 #include <algorithm>  // for std::sort, std::min
 #include <vector>     // for std::vector
+#include <tuple>
+#include <memory>
+#include <optional>
+#include <thread>     // for std::thread::hardware_concurrency
+#include <cstdint>
+#include <chrono>
+#include <cmath>     // for --profile stage timers
+#include <filesystem> // for --index-cache paths
+#include <stdexcept>
+#include <charconv>   // for std::from_chars
+#include <sys/resource.h> // for getrusage
+
+/**
+ * @brief a whole command line number, no sign or trailing text.
+ * 
+ * std::stoul takes "-1" and wraps it round to ULONG_MAX; this throws instead,
+ * so a bad value ends in the usage message like any other.
+ */
+template <typename T>
+static T parse_count(const std::string &text)
+{
+    T value{};
+    const char *end = text.data() + text.size();
+    const auto [ptr, error] = std::from_chars(text.data(), end, value);
+    if (text.empty() || text[0] == '-' || error != std::errc() || ptr != end) {
+        throw std::invalid_argument("not a non-negative integer: " + text);
+    }
+    return value;
+}
+
+/**
+ * @brief a command line decimal within [min, max], no trailing text.
+ *
+ * std::stod stops at the first bad character ("5s" -> 5) and takes "nan"; this
+ * throws instead, like parse_count.
+ */
+static double parse_decimal(const std::string &text, double min, double max)
+{
+    double value = 0.0;
+    const char *end = text.data() + text.size();
+    const auto [ptr, error] = std::from_chars(text.data(), end, value);
+    if (text.empty() || error != std::errc() || ptr != end || !std::isfinite(value)) {
+        throw std::invalid_argument("not a number: " + text);
+    }
+    if (value < min || value > max) {
+        std::ostringstream range;
+        range << "out of range [" << min << ", " << max << "]: " << text;
+        throw std::invalid_argument(range.str());
+    }
+    return value;
+}
+
+// Highest Phred score a Sanger (offset 33) quality character can encode.
+static constexpr double MAX_PHRED = 93.0;
+
+/**
+ * @brief peak resident set size of this process so far.
+ */
+static std::uint64_t peak_rss_bytes()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return static_cast<std::uint64_t>(usage.ru_maxrss) * 1024; // KiB on Linux.
+}
+
+/**
+ * @brief one --profile table row: stage time and pairs/s through it.
+ */
+static void print_stage(const char *stage, double seconds, std::size_t pairs)
+{
+    std::cout << "  " << std::left << std::setw(18) << stage << std::right << std::fixed
+              << std::setw(10) << std::setprecision(3) << seconds;
+    if (seconds > 0) {
+        std::cout << std::setw(14) << std::setprecision(2) << pairs / seconds / 1e6;
+    }
+    std::cout << "\n";
+}
+
+/**
+ * @brief machine-readable run statistics for monitoring, written next to the TSV with --profile.
+ */
+static void write_stats_json(const std::string &path, const PipelineResult &result, const std::vector<FastqPairReader *> &lanes,
+                             std::size_t fastq_pairs, std::size_t threads, double pipeline_seconds, double write_seconds,
+                             std::size_t cells_written, std::size_t total_rows)
+{
+    std::ofstream json(path);
+    if (!json) {
+        throw std::runtime_error("could not open " + path + " for writing");
+    }
+
+    const StageTimes &stages = result.stage_times;
+    // r1/r2 are summed over every R1/R2 pair given (and every slice of it).
+    std::pair<const char *, FastqPairReader::FileStats> file_stats[] = {{"r1", {}}, {"r2", {}}};
+    for (const FastqPairReader *lane : lanes) {
+        const FastqPairReader::FileStats lane_stats[] = {lane->r1_stats(), lane->r2_stats()};
+        for (std::size_t i = 0; i < 2; i++) {
+            FastqPairReader::FileStats &total = file_stats[i].second;
+            total.compressed_bytes = total.compressed_bytes < 0 || lane_stats[i].compressed_bytes < 0
+                                         ? -1 : total.compressed_bytes + lane_stats[i].compressed_bytes;
+            total.decompressed_bytes += lane_stats[i].decompressed_bytes;
+            total.read_seconds += lane_stats[i].read_seconds;
+            total.io_wait_seconds += lane_stats[i].io_wait_seconds;
+            total.prefetch_seconds += lane_stats[i].prefetch_seconds;
+            total.prefetched_bytes += lane_stats[i].prefetched_bytes;
+        }
+    }
+
+    json << std::fixed << std::setprecision(6);
+    json << "{\n";
+    json << "  \"threads\": " << threads << ",\n";
+    json << "  \"fastq_pairs\": " << fastq_pairs << ",\n";
+    json << "  \"readers\": " << lanes.size() << ",\n";
+    std::uint64_t pairs_read = 0;
+    for (const FastqPairReader *lane : lanes) {
+        pairs_read += lane->pairs_read();
+    }
+    json << "  \"pairs_read\": " << pairs_read << ",\n"; // total_pairs plus any sampled out.
+    json << "  \"total_pairs\": " << result.total_pairs << ",\n";
+    json << "  \"valid_cell_barcodes\": " << result.num_with_barcodes << ",\n";
+    json << "  \"valid_antibody_payloads\": " << result.num_with_ab_payload << ",\n";
+    json << "  \"r2_skipped\": " << result.r2_sampling.skipped << ",\n";
+    json << "  \"r2_sampled\": " << result.r2_sampling.sampled << ",\n";
+    json << "  \"estimated_antibody_payloads\": " << result.r2_sampling.estimated_payloads(result.num_with_ab_payload) << ",\n";
+    json << "  \"countable_pairs\": " << result.num_with_both << ",\n";
+    json << "  \"filtered_pairs\": {\"bc1_n\": " << result.filter_counters.bc1_n
+         << ", \"bc1_quality\": " << result.filter_counters.bc1_quality
+         << ", \"r2_n\": " << result.filter_counters.r2_n
+         << ", \"r2_quality\": " << result.filter_counters.r2_quality << "},\n";
+    json << "  \"unique_cells\": " << result.counts.num_cells() << ",\n";
+    json << "  \"unique_umis\": " << result.umis.size() << ",\n";
+    json << "  \"cells_written\": " << cells_written << ",\n";
+    json << "  \"rows_written\": " << total_rows << ",\n";
+    json << "  \"count_table_bytes\": " << result.counts.memory_bytes() << ",\n";
+    json << "  \"umi_set_bytes\": " << result.umis.memory_bytes() << ",\n";
+    json << "  \"peak_rss_bytes\": " << peak_rss_bytes() << ",\n";
+    json << "  \"seconds\": {\n";
+    json << "    \"pipeline_wall\": " << pipeline_seconds << ",\n";
+    json << "    \"read\": " << stages.read << ",\n";
+    json << "    \"r1_parse\": " << stages.r1_parse << ",\n";
+    json << "    \"r2_parse\": " << stages.r2_parse << ",\n";
+    json << "    \"count\": " << stages.count << ",\n";
+    json << "    \"write_tsv\": " << write_seconds << "\n";
+    json << "  },\n";
+    json << "  \"files\": {\n";
+    for (std::size_t i = 0; i < 2; i++) {
+        const auto &[label, stats] = file_stats[i];
+        json << "    \"" << label << "\": {\"compressed_bytes\": " << stats.compressed_bytes
+             << ", \"decompressed_bytes\": " << stats.decompressed_bytes
+             << ", \"read_seconds\": " << stats.read_seconds
+             << ", \"io_wait_seconds\": " << stats.io_wait_seconds // part of read_seconds.
+             << ", \"prefetched_bytes\": " << stats.prefetched_bytes
+             << ", \"prefetch_seconds\": " << stats.prefetch_seconds << "}" << (i == 0 ? ",\n" : "\n");
+    }
+    json << "  }\n";
+    json << "}\n";
+}
+
+/**
+ * @brief load (or build and cache) a whitelist and print what it holds.
+ * 
+ * @param cache_dir directory for the binary index cache, "" = next to the CSV, "-" = no cache.
+ */
+static BarcodeIndex load_whitelist(const std::string &what, const std::string &csv_path,
+                                   const BarcodeCorrection &correction, const std::string &cache_dir)
+{
+    std::string cache_path;
+    if (cache_dir != "-") {
+        cache_path = BarcodeIndex::default_cache_path(csv_path, correction);
+        if (!cache_dir.empty()) {
+            cache_path = (std::filesystem::path(cache_dir) / std::filesystem::path(cache_path).filename()).string();
+        }
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    std::cout << "  Loading " << what << " barcodes..." << std::flush;
+    BarcodeIndex index = BarcodeIndex::load_or_build(csv_path, correction, cache_path);
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << " done (" << std::fixed << std::setprecision(1) << ms << " ms";
+    switch (index.cache_status())
+    {
+    case BarcodeIndex::CacheStatus::LOADED: std::cout << ", from index cache"; break;
+    case BarcodeIndex::CacheStatus::WRITTEN: std::cout << ", index cache written"; break;
+    case BarcodeIndex::CacheStatus::WRITE_FAILED: std::cout << ", could not write index cache " << cache_path; break;
+    case BarcodeIndex::CacheStatus::NOT_USED: break;
+    }
+    std::cout << ").\n";
+    std::cout << "    -> " << index.size() << " canonical barcodes\n";
+    std::cout << "    -> " << index.hamming_dict_size() << " entries in hamming dictionary\n";
+    if (index.ambiguous_entries() > 0) {
+        std::cout << "    -> " << index.ambiguous_entries() << " ambiguous entries (not corrected)\n";
+    }
+    std::cout << "    -> " << std::fixed << std::setprecision(2) << index.memory_bytes() / 1e6 << " MB"
+              << (index.cache_status() == BarcodeIndex::CacheStatus::LOADED ? " (tables mapped from the cache)" : "") << "\n";
+    return index;
+}
+
+static void print_usage(const char *program)
+{
+    std::cerr << "Usage: " << program << " [options] R1.fastq[.gz] R2.fastq[.gz] [R1 R2 ...] cell_barcodes.csv antibody_barcodes.csv\n"
+              << "  Several R1/R2 pairs (e.g. lanes, " << "'*_L00?_R[12]_001.fastq.gz') are counted into one output.\n"
+              << "Options:\n"
+              << "  --threads N               parse/count worker threads (default 1, 0 = all cores)\n"
+              << "  --decompress-threads N    htslib inflate threads shared by R1/R2 (default 0)\n"
+              << "  --max-pairs N             stop after N read pairs per R1/R2 pair or slice (default 0 = whole file)\n"
+              << "  --sample-fraction F       keep a fraction F of the pairs, picked by read name hash over the whole input\n"
+              << "  --sample-reads N          keep about N pairs the same way, fraction estimated from the record size\n"
+              << "  --sample-seed N           draw a different sample (default 0)\n"
+              << "  --lane-jobs N             R1/R2 pairs (or slices) processed at once, sharing --threads (default min(readers, threads))\n"
+              << "  --slices N                split each uncompressed or BGZF R1/R2 pair into N byte ranges read in parallel (default 1)\n"
+              << "  --pair-check all|batch|N  verify R1/R2 pairing on every pair, the last pair of each batch, or every Nth pair (default all)\n"
+              << "  --read-ahead DEPTH[:MB]   prefetch each FASTQ DEPTH chunks of MB (default 4) ahead, for NFS (default off)\n"
+              << "  --min-count N             leave out (cell, antibody) counts below N in the outputs (default 10)\n"
+              << "  --umi LENGTH[:OFFSET]     count unique UMIs too: LENGTH bases OFFSET (default 0) past the 3' antibody handle, max 12,\n"
+              << "                            not with --memory-limit\n"
+              << "  --sample-sheet CSV        demultiplex by the i7[+i5] index in the R1 headers (rows sample,i7[,i5]),\n"
+              << "                            one antibody_counts.<sample>.tsv each, pairs of no sample in Undetermined\n"
+              << "  --index-distance N        substitutions corrected per sample index, 0-2 (default 1)\n"
+              << "  --mtx DIR                 also write a 10x-style Matrix Market directory (matrix.mtx.gz, barcodes/features.tsv.gz)\n"
+              << "  --memory-limit MB         per-worker partial table memory before it spills to disk, with --threads > 1\n"
+              << "                            (default 0 = no limit); the merged table is held in memory regardless\n"
+              << "  --spill-dir DIR           directory for spilled partial tables (default system temp directory)\n"
+              << "  --progress SECONDS        progress line interval, at least 0.1 (default 5, 0 = off)\n"
+              << "  --profile                 time each stage and write <output>.stats.json next to the TSV\n"
+              << "  --count-only              parse R2 only for pairs with a cell barcode, estimate the payload rate of the rest\n"
+              << "  --r2-sample N             with --count-only, still parse R2 of 1 in N pairs without a cell barcode (default 64, 0 = none)\n"
+              << "  --max-bc1-n N             drop pairs with more than N Ns in bc1 (R1 bases 1-9) before parsing (default off)\n"
+              << "  --min-bc1-quality Q       drop pairs whose bc1 mean Phred is below Q (default off)\n"
+              << "  --max-r2-n N              drop pairs with more than N Ns in R2 (default off)\n"
+              << "  --min-r2-quality Q        drop pairs whose R2 mean Phred is below Q (default off)\n"
+              << "  --r1-window FIRST:LAST    expected R1 motif start positions, skips learning\n"
+              << "  --r1-learn-pairs N        pairs used to learn the R1 motif window (default 10000, 0 = always full scan)\n"
+              << "  --cell-distance N         substitutions corrected per cell barcode half, 0-2 (default 1)\n"
+              << "  --cell-indels             also correct one inserted/deleted base in cell barcodes\n"
+              << "  --antibody-distance N     substitutions corrected in antibody barcodes, 0-2 (default 1)\n"
+              << "  --antibody-indels         also correct one inserted/deleted base in antibody barcodes\n"
+              << "  --index-cache DIR         where binary whitelist caches are kept (default next to each CSV)\n"
+              << "  --no-index-cache          always build the whitelist tables from the CSVs\n";
+}
 
 int main(int argc, char **argv)
 {
@@ -13,21 +257,240 @@ int main(int argc, char **argv)
     std::cout << "  DAb-seq C++ Pipeline\n";
     std::cout << "========================================\n\n";
 
-    if (argc != 5)
+    PipelineOptions pipeline_options;
+    int decompress_threads = 0;
+    std::size_t slices = 1;
+    FastqPairReader::PairCheck pair_check = FastqPairReader::PairCheck::EVERY_PAIR;
+    std::size_t min_count = 10;
+    std::string mtx_directory; // empty -> TSV only.
+    std::size_t pair_check_every = 1;
+    std::size_t read_ahead_depth = 0; // chunks, 0 = off.
+    std::size_t read_ahead_mb = 4;
+    FastqPairReader::Sampling sampling;
+    BarcodeCorrection cell_correction;
+    BarcodeCorrection antibody_correction;
+    std::string index_cache_dir; // "" next to the CSVs, "-" disabled.
+    std::string sample_sheet_csv; // empty -> no demultiplexing.
+    BarcodeCorrection index_correction;
+
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; i++)
     {
-        std::cerr << "Usage: " << argv[0] << " R1.fastq[.gz] R2.fastq[.gz] cell_barcodes.csv antibody_barcodes.csv\n";
+        const std::string arg = argv[i];
+        try
+        {
+            if (arg == "--threads" && i + 1 < argc)
+            {
+                pipeline_options.threads = parse_count<std::size_t>(argv[++i]);
+                if (pipeline_options.threads == 0) {
+                    pipeline_options.threads = std::max(1u, std::thread::hardware_concurrency());
+                }
+            }
+            else if (arg == "--decompress-threads" && i + 1 < argc)
+            {
+                decompress_threads = parse_count<int>(argv[++i]);
+            }
+            else if (arg == "--max-pairs" && i + 1 < argc)
+            {
+                pipeline_options.max_pairs = parse_count<std::uint64_t>(argv[++i]);
+            }
+            else if (arg == "--sample-fraction" && i + 1 < argc)
+            {
+                sampling.fraction = parse_decimal(argv[++i], 0.0, 1.0);
+                if (!(sampling.fraction > 0.0 && sampling.fraction <= 1.0)) {
+                    throw std::invalid_argument("--sample-fraction must be in (0, 1]");
+                }
+            }
+            else if (arg == "--sample-reads" && i + 1 < argc)
+            {
+                sampling.target_pairs = parse_count<std::uint64_t>(argv[++i]);
+                if (sampling.target_pairs == 0) throw std::invalid_argument("--sample-reads must be at least 1");
+            }
+            else if (arg == "--sample-seed" && i + 1 < argc)
+            {
+                sampling.seed = parse_count<std::uint64_t>(argv[++i]);
+            }
+            else if (arg == "--lane-jobs" && i + 1 < argc)
+            {
+                pipeline_options.lane_jobs = parse_count<std::size_t>(argv[++i]);
+            }
+            else if (arg == "--slices" && i + 1 < argc)
+            {
+                slices = parse_count<std::size_t>(argv[++i]);
+                if (slices == 0) throw std::invalid_argument("--slices must be at least 1");
+            }
+            else if (arg == "--pair-check" && i + 1 < argc)
+            {
+                const std::string mode = argv[++i];
+                if (mode == "all") {
+                    pair_check = FastqPairReader::PairCheck::EVERY_PAIR;
+                } else if (mode == "batch") {
+                    pair_check = FastqPairReader::PairCheck::BATCH_ENDS;
+                } else {
+                    pair_check = FastqPairReader::PairCheck::EVERY_NTH;
+                    pair_check_every = parse_count<std::size_t>(mode);
+                    if (pair_check_every == 0) throw std::invalid_argument("--pair-check N must be at least 1");
+                }
+            }
+            else if (arg == "--read-ahead" && i + 1 < argc)
+            {
+                const std::string read_ahead = argv[++i];
+                const std::size_t colon = read_ahead.find(':');
+                read_ahead_depth = parse_count<std::size_t>(read_ahead.substr(0, colon));
+                if (colon != std::string::npos) {
+                    read_ahead_mb = parse_count<std::size_t>(read_ahead.substr(colon + 1));
+                    if (read_ahead_mb == 0 || read_ahead_mb > 1024) throw std::invalid_argument("--read-ahead MB must be 1-1024");
+                }
+            }
+            else if (arg == "--min-count" && i + 1 < argc)
+            {
+                min_count = parse_count<std::size_t>(argv[++i]);
+            }
+            else if (arg == "--umi" && i + 1 < argc)
+            {
+                const std::string umi = argv[++i];
+                const std::size_t colon = umi.find(':');
+                pipeline_options.umi.length = parse_count<std::size_t>(umi.substr(0, colon));
+                pipeline_options.umi.offset = colon == std::string::npos ? 0 : parse_count<std::size_t>(umi.substr(colon + 1));
+                if (pipeline_options.umi.length == 0 || pipeline_options.umi.length > UmiSet::MAX_UMI_LENGTH) {
+                    throw std::invalid_argument("--umi LENGTH must be 1-12");
+                }
+            }
+            else if (arg == "--sample-sheet" && i + 1 < argc)
+            {
+                sample_sheet_csv = argv[++i];
+            }
+            else if (arg == "--index-distance" && i + 1 < argc)
+            {
+                index_correction.max_substitutions = parse_count<int>(argv[++i]);
+            }
+            else if (arg == "--mtx" && i + 1 < argc)
+            {
+                mtx_directory = argv[++i];
+            }
+            else if (arg == "--memory-limit" && i + 1 < argc)
+            {
+                const std::size_t memory_mb = parse_count<std::size_t>(argv[++i]);
+                if (memory_mb > SIZE_MAX >> 20) throw std::invalid_argument("--memory-limit MB is too large");
+                pipeline_options.memory_limit = memory_mb << 20;
+            }
+            else if (arg == "--spill-dir" && i + 1 < argc)
+            {
+                pipeline_options.spill_directory = argv[++i];
+            }
+            else if (arg == "--progress" && i + 1 < argc)
+            {
+                pipeline_options.progress_seconds = parse_decimal(argv[++i], 0.0, ProgressReporter::MAX_INTERVAL_SECONDS);
+            }
+            else if (arg == "--profile")
+            {
+                pipeline_options.profile = true;
+            }
+            else if (arg == "--count-only")
+            {
+                pipeline_options.count_only = true;
+            }
+            else if (arg == "--r2-sample" && i + 1 < argc)
+            {
+                pipeline_options.r2_sample_every = parse_count<std::size_t>(argv[++i]);
+            }
+            else if (arg == "--max-bc1-n" && i + 1 < argc)
+            {
+                pipeline_options.read_filter.max_bc1_n = parse_count<std::size_t>(argv[++i]);
+            }
+            else if (arg == "--min-bc1-quality" && i + 1 < argc)
+            {
+                pipeline_options.read_filter.min_bc1_quality = parse_decimal(argv[++i], 0.0, MAX_PHRED);
+            }
+            else if (arg == "--max-r2-n" && i + 1 < argc)
+            {
+                pipeline_options.read_filter.max_r2_n = parse_count<std::size_t>(argv[++i]);
+            }
+            else if (arg == "--min-r2-quality" && i + 1 < argc)
+            {
+                pipeline_options.read_filter.min_r2_quality = parse_decimal(argv[++i], 0.0, MAX_PHRED);
+            }
+            else if (arg == "--r1-window" && i + 1 < argc)
+            {
+                const std::string window = argv[++i];
+                const std::size_t colon = window.find(':');
+                if (colon == std::string::npos) throw std::invalid_argument("--r1-window expects FIRST:LAST");
+                pipeline_options.r1_motif_window.first = parse_count<std::size_t>(window.substr(0, colon));
+                pipeline_options.r1_motif_window.last = parse_count<std::size_t>(window.substr(colon + 1));
+                if (!pipeline_options.r1_motif_window.enabled()) throw std::invalid_argument("--r1-window FIRST > LAST");
+            }
+            else if (arg == "--r1-learn-pairs" && i + 1 < argc)
+            {
+                pipeline_options.r1_learn_pairs = parse_count<std::size_t>(argv[++i]);
+            }
+            else if (arg == "--cell-distance" && i + 1 < argc)
+            {
+                cell_correction.max_substitutions = parse_count<int>(argv[++i]);
+            }
+            else if (arg == "--cell-indels")
+            {
+                cell_correction.indels = true;
+            }
+            else if (arg == "--antibody-distance" && i + 1 < argc)
+            {
+                antibody_correction.max_substitutions = parse_count<int>(argv[++i]);
+            }
+            else if (arg == "--antibody-indels")
+            {
+                antibody_correction.indels = true;
+            }
+            else if (arg == "--index-cache" && i + 1 < argc)
+            {
+                index_cache_dir = argv[++i];
+            }
+            else if (arg == "--no-index-cache")
+            {
+                index_cache_dir = "-";
+            }
+            else if (arg.rfind("--", 0) == 0)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            else
+            {
+                positional.push_back(arg);
+            }
+        }
+        catch (const std::exception &)
+        {
+            std::cerr << "Invalid value for " << arg << "\n";
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // One or more R1/R2 pairs, then the two whitelists.
+    if (positional.size() < 4 || positional.size() % 2 != 0)
+    {
+        print_usage(argv[0]);
         return 1;
     }
 
-    const std::string r1_path = argv[1];
-    const std::string r2_path = argv[2];
-    const std::string cell_barcodes_csv = argv[3];
-    const std::string antibody_barcodes_csv = argv[4];
+    const std::size_t num_lanes = (positional.size() - 2) / 2;
+    std::vector<std::pair<std::string, std::string>> fastq_pairs;
+    for (std::size_t lane = 0; lane < num_lanes; lane++) {
+        fastq_pairs.emplace_back(positional[2 * lane], positional[2 * lane + 1]);
+    }
+    const std::string cell_barcodes_csv = positional[positional.size() - 2];
+    const std::string antibody_barcodes_csv = positional[positional.size() - 1];
+    // "L1 R1" etc. once there is more than one pair.
+    auto file_label = [num_lanes](std::size_t lane, const char *read) {
+        return (num_lanes > 1 ? "L" + std::to_string(lane + 1) + " " : std::string()) + read;
+    };
 
 
     std::cout << "[Input Files]\n";
-    std::cout << "  R1 FASTQ:           " << r1_path << "\n";
-    std::cout << "  R2 FASTQ:           " << r2_path << "\n";
+    for (std::size_t lane = 0; lane < num_lanes; lane++) {
+        std::cout << "  " << std::left << std::setw(20) << (file_label(lane, "R1") + " FASTQ:") << fastq_pairs[lane].first << "\n";
+        std::cout << "  " << std::left << std::setw(20) << (file_label(lane, "R2") + " FASTQ:") << fastq_pairs[lane].second << "\n";
+    }
+    std::cout << std::right;
     std::cout << "  Cell barcodes:      " << cell_barcodes_csv << "\n";
     std::cout << "  Antibody barcodes:  " << antibody_barcodes_csv << "\n\n";
 
@@ -35,207 +498,415 @@ int main(int argc, char **argv)
     {
         // Load cell barcode whitelist.
         std::cout << "[Loading Barcodes]\n";
-        std::cout << "  Loading cell barcodes..." << std::flush;
-        BarcodeIndex cell_barcode_set(cell_barcodes_csv);
-        std::cout << " done.\n";
-        std::cout << "    -> " << cell_barcode_set.size() << " canonical barcodes\n";
-        std::cout << "    -> " << cell_barcode_set.hamming_dict_size() << " entries in hamming dictionary\n";
-
-
-        // Load antibody barcode whitelist.
-        std::cout << "  Loading antibody barcodes..." << std::flush;
-        BarcodeIndex antibody_barcode_set(antibody_barcodes_csv);
-        std::cout << " done.\n";
-        std::cout << "    -> " << antibody_barcode_set.size() << " canonical barcodes\n";
-        std::cout << "    -> " << antibody_barcode_set.hamming_dict_size() << " entries in hamming dictionary\n";
-
-        std::cout << "  Loading antibody name map..." << std::flush;
-        std::unordered_map<std::string, std::string> antibody_barcode_to_name = load_antibody_name_map(antibody_barcodes_csv);
-        std::cout << " done.\n";
-        std::cout << "    -> " << antibody_barcode_to_name.size() << " antibody name mappings\n\n";
+        const BarcodeIndex cell_barcode_set = load_whitelist("cell", cell_barcodes_csv, cell_correction, index_cache_dir);
+
+        // Load antibody barcode whitelist, names come from its second column.
+        const BarcodeIndex antibody_barcode_set = load_whitelist("antibody", antibody_barcodes_csv, antibody_correction, index_cache_dir);
+
+        std::optional<SampleSheet> sample_sheet;
+        if (!sample_sheet_csv.empty()) {
+            sample_sheet.emplace(sample_sheet_csv, index_correction);
+            pipeline_options.samples = &*sample_sheet;
+            std::cout << "  Loaded " << sample_sheet->size() << " samples (" << (sample_sheet->dual_index() ? "i7+i5" : "i7")
+                      << ", " << index_correction.max_substitutions << " substitution"
+                      << (index_correction.max_substitutions == 1 ? "" : "s") << " per index) from " << sample_sheet_csv << "\n";
+        }
+        std::cout << "\n";
 
         std::cout << "[Opening FASTQ Files]\n";
-        FastqPairReader reader(r1_path, r2_path);
-        std::cout << "  FASTQ files opened successfully.\n\n";
-
-        FastqPairReader::FastqPair pair;
-
-        std::size_t total_pairs = 0;
-        const int max_pairs = 1000000;
-        std::size_t num_with_barcodes = 0; // measure effectiveness of hamming dictionary
-        std::size_t num_with_ab_payload = 0;
-        std::size_t num_with_both = 0;
-
-        //                  cell_id     antibody, cnt
-        std::unordered_map<std::string, std::unordered_map<std::string, std::size_t>> counts;
-
+        // With --slices every pair gets one reader per slice; lanes are the readers.
+        std::vector<std::unique_ptr<FastqPairReader>> readers;
+        std::vector<FastqPairReader *> lanes;
+        std::vector<std::size_t> lane_pair; // input pair each reader belongs to.
+        for (std::size_t pair = 0; pair < num_lanes; pair++) {
+            const auto &[r1_path, r2_path] = fastq_pairs[pair];
+            std::size_t count = slices;
+            if (count > 1 && !(FastqPairReader::splittable(r1_path) && FastqPairReader::splittable(r2_path))) {
+                std::cout << "  " << file_label(pair, "R1/R2") << " is not uncompressed or BGZF, read as one slice.\n";
+                count = 1;
+            }
+            for (std::size_t slice = 0; slice < count; slice++) {
+                readers.push_back(std::make_unique<FastqPairReader>(r1_path, r2_path, decompress_threads,
+                                                                    FastqPairReader::Slice{slice, count}));
+                readers.back()->set_pair_check(pair_check, pair_check_every);
+                readers.back()->set_read_ahead(read_ahead_depth, read_ahead_mb << 20);
+                lanes.push_back(readers.back().get());
+                lane_pair.push_back(pair);
+            }
+        }
+        if (sampling.enabled()) {
+            // --sample-reads is shared out by input size, evenly if a size is unknown.
+            std::int64_t input_bytes = 0;
+            for (const FastqPairReader *lane : lanes) {
+                input_bytes = input_bytes < 0 || lane->input_bytes() < 0 ? -1 : input_bytes + lane->input_bytes();
+            }
+            for (FastqPairReader *lane : lanes) {
+                FastqPairReader::Sampling lane_sampling = sampling;
+                if (sampling.target_pairs > 0) {
+                    const double share = input_bytes > 0 ? static_cast<double>(lane->input_bytes()) / input_bytes
+                                                         : 1.0 / lanes.size();
+                    lane_sampling.target_pairs = std::max<std::uint64_t>(1, std::llround(sampling.target_pairs * share));
+                }
+                lane->set_sampling(lane_sampling);
+            }
+        }
+        std::cout << "  FASTQ files opened successfully.\n";
+        if (lanes.size() > num_lanes) {
+            std::cout << "  Slices: " << lanes.size() << " readers over " << num_lanes << " R1/R2 pair"
+                      << (num_lanes > 1 ? "s" : "") << "\n";
+        }
+        if (decompress_threads > 0) {
+            std::cout << "  Decompression threads: " << decompress_threads << " (shared by R1/R2"
+                      << (lanes.size() > num_lanes ? ", per slice" : num_lanes > 1 ? ", per pair" : "") << ")\n";
+        }
+        if (read_ahead_depth > 0) {
+            std::cout << "  Read-ahead: " << read_ahead_depth << " x " << read_ahead_mb << " MB per file\n";
+        }
+        std::cout << "\n";
 
         std::cout << "[Processing Reads]\n";
         std::cout << "  Processing";
-        if (max_pairs > 0) {
-            std::cout << " (max " << max_pairs << " pairs)";
+        if (pipeline_options.max_pairs > 0) {
+            std::cout << " (max " << pipeline_options.max_pairs << " pairs)";
+        }
+        if (sampling.target_pairs > 0) {
+            std::cout << " a sample of about " << sampling.target_pairs << " pairs";
+        } else if (sampling.enabled()) {
+            std::cout << " a " << std::fixed << std::setprecision(2) << 100.0 * sampling.fraction << "% sample";
+        }
+        if (num_lanes > 1) {
+            std::cout << " " << num_lanes << " R1/R2 pairs";
+        }
+        if (pipeline_options.threads > 1) {
+            std::cout << " with " << pipeline_options.threads << " worker threads";
         }
         std::cout << "...\n";
 
-        // Progress tracking
-        const std::size_t progress_interval = 1000000;
+        const auto pipeline_start = std::chrono::steady_clock::now();
+        PipelineResult result = run_read_pipeline(lanes, cell_barcode_set, antibody_barcode_set, pipeline_options, lane_pair);
+        const double pipeline_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - pipeline_start).count();
+        if (result.reached_end_of_file) {
+            std::cout << "  Reached end of file.\n";
+        }
 
-        while (max_pairs == 0 || total_pairs < max_pairs) // check logic
-        {
-            FastqPairReader::ReadStatus status = reader.next_record(pair);
+        const std::size_t total_pairs = result.total_pairs;
+        const std::size_t num_with_barcodes = result.num_with_barcodes;
+        const std::size_t num_with_ab_payload = result.num_with_ab_payload;
+        const std::size_t num_with_both = result.num_with_both;
+        const CountMatrix &counts = result.counts;
+
+        // Final count, the progress line was cleared by the reporter
+        std::cout << "  Processed " << total_pairs << " pairs total.        \n\n";
 
-            if (status == FastqPairReader::ReadStatus::END_OF_FILE) {
-                std::cout << "  Reached end of file.\n";
-                break;
+        // Summary statistics
+        std::cout << "[Summary Statistics]\n";
+        std::cout << "  Total read pairs processed:    " << total_pairs << "\n";
+        if (num_lanes > 1) {
+            std::vector<std::size_t> pair_counts(num_lanes, 0);
+            for (std::size_t lane = 0; lane < lanes.size(); lane++) {
+                pair_counts[lane_pair[lane]] += result.lane_pairs[lane];
             }
-            
-            if (status == FastqPairReader::ReadStatus::READ_ERROR) {
-                std::cerr << "\n  Error: malformed or truncated FASTQ at pair " << total_pairs + 1 << "\n"; // because haven't incremented total pairs yet
-                return 1;
+            for (std::size_t lane = 0; lane < num_lanes; lane++) {
+                std::cout << "    " << std::left << std::setw(27) << ("L" + std::to_string(lane + 1) + ":") << std::right
+                          << pair_counts[lane] << "\n";
             }
-
-            total_pairs++;
-
-            // Progress indicator
-            if (total_pairs % progress_interval == 0) {
-                std::cout << "  Processed " << total_pairs << " pairs...\r" << std::flush;
+        }
+        std::uint64_t pairs_checked = 0;
+        std::uint64_t pairs_read = 0;
+        for (const FastqPairReader *lane : lanes) {
+            pairs_checked += lane->pairs_checked();
+            pairs_read += lane->pairs_read();
+        }
+        if (sampling.enabled()) {
+            // Rates below are of the sample; it is drawn evenly, so they hold for the whole input.
+            std::cout << "  Sampled from:                  " << pairs_read << " pairs read ("
+                      << std::fixed << std::setprecision(2) << (pairs_read > 0 ? 100.0 * total_pairs / pairs_read : 0.0)
+                      << "% kept, seed " << sampling.seed << ")\n";
+        }
+        std::cout << "  R1/R2 pairing verified:        ";
+        switch (pair_check)
+        {
+        case FastqPairReader::PairCheck::EVERY_PAIR: std::cout << "every pair"; break;
+        case FastqPairReader::PairCheck::EVERY_NTH: std::cout << "1 pair in " << pair_check_every; break;
+        case FastqPairReader::PairCheck::BATCH_ENDS: std::cout << "last pair of each batch"; break;
+        }
+        std::cout << " (" << pairs_checked << " checked)\n";
+        std::cout << "  Valid cell barcodes:           " << num_with_barcodes 
+                  << " (" << std::fixed << std::setprecision(1) 
+                  << (100.0 * num_with_barcodes / total_pairs) << "%)\n";
+        if (pipeline_options.count_only) {
+            // R2 of most pairs without a cell barcode was skipped, extrapolate from the sampled ones.
+            const R2Sampling &sampling = result.r2_sampling;
+            const double estimated = sampling.estimated_payloads(num_with_ab_payload);
+            std::cout << "  Valid antibody payloads:       ~" << std::fixed << std::setprecision(0) << estimated
+                      << " (" << std::setprecision(1) << (100.0 * estimated / total_pairs) << "%), ";
+            if (sampling.sampled > 0) {
+                std::cout << "estimated from " << sampling.sampled << " sampled R2 reads\n";
+            } else {
+                std::cout << "R2 of " << sampling.skipped << " pairs not parsed\n";
             }
+        } else {
+            std::cout << "  Valid antibody payloads:       " << num_with_ab_payload
+                      << " (" << std::fixed << std::setprecision(1)
+                      << (100.0 * num_with_ab_payload / total_pairs) << "%)\n";
+        }
+        std::cout << "  Both valid (countable reads):  " << num_with_both
+                  << " (" << std::fixed << std::setprecision(1)
+                  << (100.0 * num_with_both / total_pairs) << "%)\n";
+        std::cout << "  Unique cell barcodes observed: " << counts.num_cells() << "\n";
+        if (result.spill_runs > 0) {
+            std::cout << "  Spilled partial tables:        " << result.spill_runs << " ("
+                      << std::fixed << std::setprecision(1) << result.spill_bytes / 1e6 << " MB)\n";
+        }
+        std::cout << "  Count table memory:            " << std::fixed << std::setprecision(1) << counts.memory_bytes() / 1e6
+                  << " MB (cell map " << counts.map_bytes() / 1e6 << " MB)\n";
+        std::cout << "  Peak RSS:                      " << std::fixed << std::setprecision(1)
+                  << peak_rss_bytes() / 1e6 << " MB\n\n";
+
+        // Pairs the pre-filter dropped before any motif search, by the first check that failed.
+        if (pipeline_options.read_filter.enabled()) {
+            const ReadFilter &filter = pipeline_options.read_filter;
+            const ReadFilterCounters &rejected = result.filter_counters;
+            auto print_reason = [total_pairs](const char *label, std::size_t pairs) {
+                std::cout << "  " << std::left << std::setw(31) << label << std::right << pairs << " ("
+                          << std::fixed << std::setprecision(1) << (100.0 * pairs / total_pairs) << "%)\n";
+            };
+            std::cout << "[Read Filter]\n";
+            if (filter.max_bc1_n != SIZE_MAX) print_reason(("bc1 Ns > " + std::to_string(filter.max_bc1_n) + ":").c_str(), rejected.bc1_n);
+            if (filter.min_bc1_quality > 0.0) print_reason("bc1 mean quality too low:", rejected.bc1_quality);
+            if (filter.max_r2_n != SIZE_MAX) print_reason(("R2 Ns > " + std::to_string(filter.max_r2_n) + ":").c_str(), rejected.r2_n);
+            if (filter.min_r2_quality > 0.0) print_reason("R2 mean quality too low:", rejected.r2_quality);
+            print_reason("Rejected before parsing:", rejected.rejected());
+            std::cout << "\n";
+        }
 
-            // Parse cell barcode from R1
-            ParsedBarcode cell_barcode = parse_barcodes_from_r1(pair.r1, cell_barcode_set);
-            
-            // Parse antibody barcode from R2
-            ParsedAntibody antibody_barcode = parse_antibody_from_r2(pair.r2, antibody_barcode_set);
-
-            if (cell_barcode.valid) {
-                num_with_barcodes++;
+        // Molecules behind the read counts: unique (cell, antibody, UMI) triples.
+        if (pipeline_options.umi.enabled()) {
+            const std::size_t reads_with_umi = num_with_both - result.reads_without_umi;
+            std::cout << "[UMIs]\n";
+            std::cout << "  UMI position:                  " << pipeline_options.umi.length << " bp, "
+                      << pipeline_options.umi.offset << " bp past the 3' handle\n";
+            std::cout << "  Counted reads with a UMI:      " << reads_with_umi << " (" << std::fixed << std::setprecision(1)
+                      << (num_with_both > 0 ? 100.0 * reads_with_umi / num_with_both : 0.0) << "% of countable)\n";
+            std::cout << "  Unique (cell, antibody, UMI):  " << result.umis.size() << "\n";
+            if (result.umis.size() > 0) {
+                std::cout << "  Reads per UMI:                 " << std::fixed << std::setprecision(2)
+                          << static_cast<double>(reads_with_umi) / result.umis.size() << "\n";
             }
+            std::cout << "  UMI set memory:                " << std::fixed << std::setprecision(1)
+                      << result.umis.memory_bytes() / 1e6 << " MB\n\n";
+        }
 
-            if (antibody_barcode.valid) {
-                num_with_ab_payload++;
+        // Demultiplexing: pairs per sample and what each counted, from its own table.
+        std::vector<CountMatrix> sample_counts;
+        if (sample_sheet) {
+            sample_counts = counts.split_samples(sample_sheet->num_ids());
+            std::cout << "[Samples]\n";
+            std::cout << "  " << std::left << std::setw(24) << "sample" << std::right << std::setw(12) << "pairs"
+                      << std::setw(9) << "%" << std::setw(14) << "countable" << std::setw(9) << "cells" << "\n";
+            for (std::size_t id = 0; id < sample_sheet->num_ids(); id++) {
+                const CountMatrix &table = sample_counts[id];
+                std::uint64_t countable = 0;
+                for (std::size_t row = 0; row < table.num_cells(); row++) {
+                    countable += table.row_total(row);
+                }
+                const std::size_t pairs = id < result.sample_pairs.size() ? result.sample_pairs[id] : 0;
+                std::cout << "  " << std::left << std::setw(24) << sample_sheet->name(static_cast<SampleSheet::SampleId>(id))
+                          << std::right << std::setw(12) << pairs << std::setw(8) << std::fixed << std::setprecision(1)
+                          << (total_pairs > 0 ? 100.0 * pairs / total_pairs : 0.0) << "%" << std::setw(14) << countable
+                          << std::setw(9) << table.num_cells() << "\n";
             }
+            std::cout << "\n";
+        }
 
-            if (cell_barcode.valid && antibody_barcode.valid) {
-
-                std::string cell_id = cell_barcode.bc1 + "_" + cell_barcode.bc2;
-                num_with_both++;
-                counts[cell_id][antibody_barcode.barcode] += 1;
+        // How the R1 motif was found: expected window first, full read on a miss.
+        const R1ParseCounters &r1_counters = result.r1_counters;
+        std::cout << "[R1 Motif Search]\n";
+        if (result.r1_motif_window.enabled()) {
+            std::cout << "  Expected window:               " << result.r1_motif_window.first << "-"
+                      << result.r1_motif_window.last;
+            if (result.r1_learned_from > 0) {
+                std::cout << " (learned from " << result.r1_learned_from << " pairs)";
             }
+            std::cout << "\n";
+        } else {
+            std::cout << "  Expected window:               none (full scan only)\n";
         }
-
-        // Clear progress line and print final count
-        std::cout << "  Processed " << total_pairs << " pairs total.        \n\n";
-
-        // Summary statistics
-        std::cout << "[Summary Statistics]\n";
-        std::cout << "  Total read pairs processed:    " << total_pairs << "\n";
-        std::cout << "  Valid cell barcodes:           " << num_with_barcodes 
-                  << " (" << std::fixed << std::setprecision(1) 
-                  << (100.0 * num_with_barcodes / total_pairs) << "%)\n";
-        std::cout << "  Valid antibody payloads:       " << num_with_ab_payload
+        std::cout << "  Found in window:               " << r1_counters.window_hits
                   << " (" << std::fixed << std::setprecision(1)
-                  << (100.0 * num_with_ab_payload / total_pairs) << "%)\n";
-        std::cout << "  Both valid (countable reads):  " << num_with_both
+                  << (100.0 * r1_counters.window_hits / total_pairs) << "%)\n";
+        std::cout << "  Found by full scan:            " << r1_counters.full_scan_hits
                   << " (" << std::fixed << std::setprecision(1)
-                  << (100.0 * num_with_both / total_pairs) << "%)\n";
-        std::cout << "  Unique cell barcodes observed: " << counts.size() << "\n\n";
+                  << (100.0 * r1_counters.full_scan_hits / total_pairs) << "%)"
+                  << (result.r1_learned_from > 0 ? ", includes the learning pairs\n" : "\n");
+        std::cout << "  No motif:                      " << r1_counters.no_motif
+                  << " (" << std::fixed << std::setprecision(1)
+                  << (100.0 * r1_counters.no_motif / total_pairs) << "%)\n\n";
+
+        // Decompression throughput, per file.
+        std::cout << "[Decompression]\n";
+        std::vector<std::tuple<std::string, FastqPairReader::FileStats, bool>> file_stats;
+        for (std::size_t lane = 0; lane < num_lanes; lane++) {
+            file_stats.emplace_back(file_label(lane, "R1"), FastqPairReader::FileStats{}, false);
+            file_stats.emplace_back(file_label(lane, "R2"), FastqPairReader::FileStats{}, false);
+        }
+        for (std::size_t lane = 0; lane < lanes.size(); lane++) {
+            // Slices of one pair add up to the pair.
+            const std::pair<FastqPairReader::FileStats, bool> lane_stats[] = {
+                {lanes[lane]->r1_stats(), lanes[lane]->r1_memory_mapped()},
+                {lanes[lane]->r2_stats(), lanes[lane]->r2_memory_mapped()}};
+            for (std::size_t read = 0; read < 2; read++) {
+                auto &[label, total, mapped] = file_stats[2 * lane_pair[lane] + read];
+                const auto &[stats, lane_mapped] = lane_stats[read];
+                total.compressed_bytes = total.compressed_bytes < 0 || stats.compressed_bytes < 0
+                                             ? -1 : total.compressed_bytes + stats.compressed_bytes;
+                total.decompressed_bytes += stats.decompressed_bytes;
+                total.read_seconds += stats.read_seconds;
+                total.io_wait_seconds += stats.io_wait_seconds;
+                total.prefetch_seconds += stats.prefetch_seconds;
+                total.prefetched_bytes += stats.prefetched_bytes;
+                mapped = mapped || lane_mapped;
+            }
+        }
+        for (const auto &[label, stats, mapped] : file_stats) {
+            const double decompressed_mb = stats.decompressed_bytes / 1e6;
+            std::cout << "  " << label << ": ";
+            if (stats.compressed_bytes >= 0) {
+                std::cout << std::fixed << std::setprecision(1) << stats.compressed_bytes / 1e6 << " MB read -> ";
+            }
+            std::cout << std::fixed << std::setprecision(1) << decompressed_mb << " MB in "
+                      << std::setprecision(2) << stats.read_seconds << " s";
+            if (stats.read_seconds > 0) {
+                std::cout << " (" << std::setprecision(1) << decompressed_mb / stats.read_seconds << " MB/s)";
+            }
+            if (mapped) {
+                std::cout << ", memory-mapped";
+            }
+            if (read_ahead_depth > 0) {
+                // Waiting is counted in the read time above; the rest is inflate and parsing.
+                std::cout << ", " << std::setprecision(2) << stats.io_wait_seconds << " s of it waiting on read-ahead"
+                          << " (" << std::setprecision(1) << stats.prefetched_bytes / 1e6 << " MB prefetched in "
+                          << std::setprecision(2) << stats.prefetch_seconds << " s)";
+            }
+            std::cout << "\n";
+        }
+        std::cout << "\n";
 
 
 // Output file
         std::string output_file = "antibody_counts.tsv";
 
         std::cout << "[Writing Output File]\n";
-        std::cout << "  Output file: " << output_file << "\n";
 
-        std::ofstream out(output_file);
-        if (!out) {
-            std::cerr << "  Error: could not open " << output_file << " for writing\n";
-            return 1;
+        // One TSV (and matrix directory) for the run, or one per sample when demultiplexing.
+        struct Output {
+            std::string tsv;
+            std::string mtx;
+            const CountMatrix *counts;
+        };
+        std::vector<Output> outputs;
+        if (sample_sheet) {
+            const std::string stem = output_file.substr(0, output_file.rfind('.'));
+            for (std::size_t id = 0; id < sample_counts.size(); id++) {
+                const std::string &name = sample_sheet->name(static_cast<SampleSheet::SampleId>(id));
+                outputs.push_back({stem + "." + name + ".tsv",
+                                   mtx_directory.empty() ? std::string() : (std::filesystem::path(mtx_directory) / name).string(),
+                                   &sample_counts[id]});
+            }
+        } else {
+            outputs.push_back({output_file, mtx_directory, &counts});
         }
 
-        // Write header
-        out << "cell_id\tcell_bc1\tcell_bc2\tantibody_barcode\tantibody_name\tcount\n";
-
-        std::size_t total_rows = 0;
+        TsvOptions tsv_options;
+        tsv_options.min_count = min_count;
+        tsv_options.threads = pipeline_options.threads;
+        if (pipeline_options.umi.enabled()) tsv_options.umi_counts = &result.umi_counts;
         std::size_t cells_written = 0;
-
-        // Sort cells by ID for consistent output
-        std::vector<std::string> sorted_cell_ids;
-        for (const auto &[cell_id, _] : counts) {
-            sorted_cell_ids.push_back(cell_id);
-        }
-        std::sort(sorted_cell_ids.begin(), sorted_cell_ids.end());
-
-        for (const auto &cell_id : sorted_cell_ids) {
-            const auto &antibody_counts = counts.at(cell_id);
-            
-            // Parse bc1 and bc2 from cell_id (format: "BC1_BC2")
-            std::size_t underscore_pos = cell_id.find('_');
-            std::string bc1 = (underscore_pos != std::string::npos) ? cell_id.substr(0, underscore_pos) : cell_id;
-            std::string bc2 = (underscore_pos != std::string::npos) ? cell_id.substr(underscore_pos + 1) : "";
-
-            bool cell_has_output = false;
-
-            // Sort antibodies by count descending for this cell
-            std::vector<std::pair<std::string, std::size_t>> sorted_abs(antibody_counts.begin(), antibody_counts.end());
-            std::sort(sorted_abs.begin(), sorted_abs.end(),
-                      [](const auto& a, const auto& b) { return a.second > b.second; });
-
-            for (const auto &[antibody_barcode, count] : sorted_abs) {
-                if (count < 10) continue;
-                // Look up antibody name
-                std::string antibody_name;
-                auto it = antibody_barcode_to_name.find(antibody_barcode);
-                if (it != antibody_barcode_to_name.end()) {
-                    antibody_name = it->second;
-                } else {
-                    antibody_name = "UNKNOWN";
-                }
-
-                out << cell_id << "\t" 
-                    << bc1 << "\t" 
-                    << bc2 << "\t"
-                    << antibody_barcode << "\t" 
-                    << antibody_name << "\t" 
-                    << count << "\n";
-                
-                total_rows++;
-                cell_has_output = true;
-            }
-
-            if (cell_has_output) {
-                cells_written++;
+        std::size_t total_rows = 0;
+        double write_seconds = 0.0; // TSVs only, as timed by --profile.
+        for (const Output &output : outputs) {
+            std::cout << "  Output file: " << output.tsv << "\n";
+            const auto write_start = std::chrono::steady_clock::now();
+            const TsvSummary written = write_counts_tsv(output.tsv, *output.counts, cell_barcode_set, antibody_barcode_set, tsv_options);
+            write_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - write_start).count();
+            cells_written += written.cells_written;
+            total_rows += written.rows_written;
+
+            std::cout << "  Cells written:     " << written.cells_written << "\n";
+            std::cout << "  Total rows:        " << written.rows_written << " (counts >= " << min_count << ")\n";
+
+            if (!output.mtx.empty()) {
+                MtxOptions mtx_options;
+                mtx_options.min_count = min_count;
+                const MtxSummary matrix = write_counts_mtx(output.mtx, *output.counts, cell_barcode_set, antibody_barcode_set, mtx_options);
+                std::cout << "  Matrix Market:     " << output.mtx << " (" << output.counts->num_antibodies() << " antibodies x "
+                          << matrix.cells_written << " cells, " << matrix.entries_written << " entries)\n";
             }
         }
+        std::cout << "\n";
+
+        if (pipeline_options.profile) {
+            const StageTimes &stages = result.stage_times;
+            std::cout << "[Profile]\n";
+            std::cout << "  " << std::left << std::setw(18) << "stage" << std::right << std::setw(10) << "seconds"
+                      << std::setw(14) << "M pairs/s" << "\n";
+            print_stage("read", stages.read, total_pairs);
+            print_stage("R1 parse", stages.r1_parse, total_pairs);
+            print_stage("R2 parse", stages.r2_parse, total_pairs);
+            print_stage("count", stages.count, total_pairs);
+            print_stage("write TSV", write_seconds, total_pairs);
+            print_stage("pipeline (wall)", pipeline_seconds, total_pairs);
+            if (pipeline_options.threads > 1) {
+                std::cout << "  Parse/count times are summed over " << pipeline_options.threads << " workers.\n";
+            }
 
-        out.close();
-
-        std::cout << "  Cells written:     " << cells_written << "\n";
-        std::cout << "  Total rows:        " << total_rows << "\n\n";
+            const std::string stats_file = output_file.substr(0, output_file.rfind('.')) + ".stats.json";
+            write_stats_json(stats_file, result, lanes, num_lanes, pipeline_options.threads, pipeline_seconds, write_seconds,
+                             cells_written, total_rows);
+            std::cout << "  Stats file: " << stats_file << "\n\n";
+        }
 
         // Print top cells by total counts (optional detailed output)
         std::cout << "[Top Cells by Total Counts]\n";
         
-        // Create vector for sorting
-        std::vector<std::pair<std::string, std::size_t>> cell_totals;
-        for (const auto &[cell_id, antibody_counts] : counts) {
-            std::size_t total = 0;
-            for (const auto &[ab, cnt] : antibody_counts) {
-                total += cnt;
-            }
-            cell_totals.emplace_back(cell_id, total);
+        // Create vector for sorting; demultiplexed rows are (sample, cell), Undetermined left out.
+        const std::vector<std::uint32_t> cell_rank = barcode_sort_rank(cell_barcode_set);
+        std::vector<std::pair<std::size_t, std::uint64_t>> cell_totals; // row, total
+        for (std::size_t row = 0; row < counts.num_cells(); row++) {
+            if (sample_sheet && counts.sample(row) == sample_sheet->undetermined()) continue;
+            cell_totals.emplace_back(row, counts.row_total(row));
         }
         
         // Sort by count descending
+        auto cell_before = [&](std::size_t a, std::size_t b) {
+            if (counts.bc1(a) != counts.bc1(b)) return cell_rank[counts.bc1(a)] < cell_rank[counts.bc1(b)];
+            if (counts.bc2(a) != counts.bc2(b)) return cell_rank[counts.bc2(a)] < cell_rank[counts.bc2(b)];
+            return counts.sample(a) < counts.sample(b); // one cell in several samples.
+        };
         std::sort(cell_totals.begin(), cell_totals.end(),
-                  [](const auto& a, const auto& b) { return a.second > b.second; });
+                  [&](const auto& a, const auto& b) {
+                      return a.second > b.second || (a.second == b.second && cell_before(a.first, b.first));
+                  });
         
         // Print top 10
-        std::cout << "  " << std::left << std::setw(25) << "Cell ID" << "Total Counts\n";
-        std::cout << "  " << std::string(40, '-') << "\n";
+        std::size_t sample_width = 0;
+        if (sample_sheet) {
+            sample_width = std::string("Sample").size();
+            for (std::size_t id = 0; id < sample_sheet->size(); id++) {
+                sample_width = std::max(sample_width, sample_sheet->name(static_cast<SampleSheet::SampleId>(id)).size());
+            }
+            sample_width += 2;
+        }
+        std::cout << "  " << std::left;
+        if (sample_sheet) std::cout << std::setw(sample_width) << "Sample";
+        std::cout << std::setw(25) << "Cell ID" << "Total Counts\n";
+        std::cout << "  " << std::string(40 + sample_width, '-') << "\n";
         for (std::size_t i = 0; i < std::min<std::size_t>(10, cell_totals.size()); i++) {
-            std::cout << "  " << std::left << std::setw(25) << cell_totals[i].first 
-                      << cell_totals[i].second << "\n";
+            const std::size_t row = cell_totals[i].first;
+            const std::string cell_id = cell_barcode_set.barcode(counts.bc1(row)) + "_" + cell_barcode_set.barcode(counts.bc2(row));
+            std::cout << "  " << std::left;
+            if (sample_sheet) std::cout << std::setw(sample_width) << sample_sheet->name(counts.sample(row));
+            std::cout << std::setw(25) << cell_id << cell_totals[i].second << "\n";
         }
 
         std::cout << "\n========================================\n";
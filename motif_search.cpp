@@ -0,0 +1,225 @@
+#include "motif_search.h"
+#include <cstdint>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+// Per-position match counters are signed bytes in the vector kernels.
+constexpr std::size_t MAX_VECTOR_MOTIF_LENGTH = 127;
+
+/**
+ * @brief shared argument checks, true if the vector kernels should defer to scalar.
+ */
+bool use_scalar(std::string_view seq, std::string_view motif, int max_mismatches) {
+    return motif.empty() || seq.size() < motif.size() || max_mismatches < 0 ||
+           motif.size() > MAX_VECTOR_MOTIF_LENGTH || static_cast<std::size_t>(max_mismatches) >= motif.size();
+}
+
+} // namespace
+
+/**
+ * @brief naive O(read_len x motif_len) search, the reference for the vector kernels.
+ * 
+ * @param seq read sequence.
+ * @param motif motif to look for.
+ * @param max_mismatches allowed substitutions.
+ * @return std::size_t first matching start, std::string::npos if none.
+ */
+std::size_t find_with_mismatches_scalar(std::string_view seq, std::string_view motif, int max_mismatches) {
+
+    // If motif is empty or longer than the sequence, there is no match.
+    if (motif.empty() || seq.size() < motif.size()) {
+        return std::string::npos;
+    }
+
+    const std::size_t MOTIF_LENGTH = motif.size();
+    const std::size_t SEQ_LENGTH = seq.size();
+
+    for (std::size_t start = 0; start + MOTIF_LENGTH <= SEQ_LENGTH; start++) {
+        int mismatches = 0;
+
+        for (std::size_t i = 0; i < MOTIF_LENGTH; i++) {
+            if (seq[start+i] != motif[i]) {
+                mismatches++;
+            }
+            if (mismatches > max_mismatches) {
+                break;
+            }
+        }
+
+        if (mismatches <= max_mismatches) {
+            return start;
+        }
+    }
+
+    return std::string::npos;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/**
+ * @brief 16 start positions per step. SSE2 is baseline on x86-64.
+ */
+std::size_t find_with_mismatches_sse2(std::string_view seq, std::string_view motif, int max_mismatches) {
+    if (use_scalar(seq, motif, max_mismatches)) {
+        return find_with_mismatches_scalar(seq, motif, max_mismatches);
+    }
+
+    constexpr std::size_t LANES = 16;
+    const std::size_t MOTIF_LENGTH = motif.size();
+    const std::size_t SEQ_LENGTH = seq.size();
+    const std::size_t LAST_START = SEQ_LENGTH - MOTIF_LENGTH; // last valid start position.
+    if (LAST_START + 1 < LANES) {
+        // Fewer starts than lanes, eg an anchored window: not worth a vector setup.
+        return find_with_mismatches_scalar(seq, motif, max_mismatches);
+    }
+    const __m128i threshold = _mm_set1_epi8(static_cast<char>(MOTIF_LENGTH - max_mismatches - 1));
+
+    // Bitmask of starts in [block, block + 16) with enough matches.
+    auto block_hits = [&](std::size_t block) {
+        __m128i matches = _mm_setzero_si128();
+        for (std::size_t j = 0; j < MOTIF_LENGTH; j++) {
+            __m128i window = _mm_loadu_si128(reinterpret_cast<const __m128i *>(seq.data() + block + j));
+            matches = _mm_sub_epi8(matches, _mm_cmpeq_epi8(window, _mm_set1_epi8(motif[j]))); // -(-1) per match
+        }
+        return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpgt_epi8(matches, threshold)));
+    };
+
+    std::size_t block = 0;
+    for (; block + LANES - 1 <= LAST_START; block += LANES) {
+        unsigned hits = block_hits(block);
+        if (hits) return block + __builtin_ctz(hits);
+    }
+    if (block > LAST_START) return std::string::npos;
+
+    // Tail: one overlapping block ending at LAST_START.
+    const std::size_t tail = LAST_START + 1 - LANES;
+    unsigned hits = block_hits(tail) >> (block - tail); // drop starts already checked.
+    return hits ? block + __builtin_ctz(hits) : std::string::npos;
+}
+
+/**
+ * @brief 32 start positions per step, only call on CPUs with AVX2.
+ */
+__attribute__((target("avx2")))
+std::size_t find_with_mismatches_avx2(std::string_view seq, std::string_view motif, int max_mismatches) {
+    if (use_scalar(seq, motif, max_mismatches)) {
+        return find_with_mismatches_scalar(seq, motif, max_mismatches);
+    }
+
+    constexpr std::size_t LANES = 32;
+    const std::size_t MOTIF_LENGTH = motif.size();
+    const std::size_t SEQ_LENGTH = seq.size();
+    const std::size_t LAST_START = SEQ_LENGTH - MOTIF_LENGTH;
+    if (LAST_START + 1 < LANES) {
+        // Checked before any ymm register is dirtied, so the SSE2 code runs without a transition penalty.
+        return find_with_mismatches_sse2(seq, motif, max_mismatches);
+    }
+    const __m256i threshold = _mm256_set1_epi8(static_cast<char>(MOTIF_LENGTH - max_mismatches - 1));
+
+    auto block_hits = [&](std::size_t block) __attribute__((target("avx2"))) {
+        __m256i matches = _mm256_setzero_si256();
+        for (std::size_t j = 0; j < MOTIF_LENGTH; j++) {
+            __m256i window = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(seq.data() + block + j));
+            matches = _mm256_sub_epi8(matches, _mm256_cmpeq_epi8(window, _mm256_set1_epi8(motif[j])));
+        }
+        return static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpgt_epi8(matches, threshold)));
+    };
+
+    std::size_t block = 0;
+    for (; block + LANES - 1 <= LAST_START; block += LANES) {
+        unsigned hits = block_hits(block);
+        if (hits) return block + __builtin_ctz(hits);
+    }
+    if (block > LAST_START) return std::string::npos;
+
+    const std::size_t tail = LAST_START + 1 - LANES;
+    unsigned hits = block_hits(tail) >> (block - tail);
+    return hits ? block + __builtin_ctz(hits) : std::string::npos;
+}
+
+#endif // x86
+
+#if defined(__aarch64__)
+
+/**
+ * @brief 16 start positions per step. NEON is baseline on AArch64.
+ */
+std::size_t find_with_mismatches_neon(std::string_view seq, std::string_view motif, int max_mismatches) {
+    if (use_scalar(seq, motif, max_mismatches)) {
+        return find_with_mismatches_scalar(seq, motif, max_mismatches);
+    }
+
+    constexpr std::size_t LANES = 16;
+    const std::size_t MOTIF_LENGTH = motif.size();
+    const std::size_t SEQ_LENGTH = seq.size();
+    const std::size_t LAST_START = SEQ_LENGTH - MOTIF_LENGTH;
+    if (LAST_START + 1 < LANES) {
+        return find_with_mismatches_scalar(seq, motif, max_mismatches);
+    }
+    const uint8x16_t needed = vdupq_n_u8(static_cast<std::uint8_t>(MOTIF_LENGTH - max_mismatches));
+    const auto *data = reinterpret_cast<const std::uint8_t *>(seq.data());
+
+    // First start in [block + skip, block + 16) with enough matches, LANES if none.
+    auto first_hit = [&](std::size_t block, std::size_t skip) -> std::size_t {
+        uint8x16_t matches = vdupq_n_u8(0);
+        for (std::size_t j = 0; j < MOTIF_LENGTH; j++) {
+            uint8x16_t window = vld1q_u8(data + block + j);
+            matches = vsubq_u8(matches, vceqq_u8(window, vdupq_n_u8(static_cast<std::uint8_t>(motif[j]))));
+        }
+        uint8x16_t hit = vcgeq_u8(matches, needed);
+        if (vmaxvq_u8(hit) == 0) return LANES;
+        std::uint8_t lanes[LANES];
+        vst1q_u8(lanes, hit);
+        for (std::size_t i = skip; i < LANES; i++) {
+            if (lanes[i]) return i;
+        }
+        return LANES;
+    };
+
+    std::size_t block = 0;
+    for (; block + LANES - 1 <= LAST_START; block += LANES) {
+        std::size_t lane = first_hit(block, 0);
+        if (lane < LANES) return block + lane;
+    }
+    if (block > LAST_START) return std::string::npos;
+
+    const std::size_t tail = LAST_START + 1 - LANES;
+    std::size_t lane = first_hit(tail, block - tail);
+    return lane < LANES ? tail + lane : std::string::npos;
+}
+
+#endif // aarch64
+
+/**
+ * @brief kernels runnable on this CPU, in order of preference (best last).
+ */
+std::vector<MotifSearchKernel> available_motif_search_kernels() {
+    std::vector<MotifSearchKernel> kernels = {{"scalar", find_with_mismatches_scalar}};
+#if defined(__x86_64__) || defined(__i386__)
+    kernels.push_back({"sse2", find_with_mismatches_sse2});
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.push_back({"avx2", find_with_mismatches_avx2});
+    }
+#endif
+#if defined(__aarch64__)
+    kernels.push_back({"neon", find_with_mismatches_neon});
+#endif
+    return kernels;
+}
+
+/**
+ * @brief runtime-dispatched kernel, chosen on first use.
+ */
+const MotifSearchKernel &best_motif_search_kernel() {
+    static const MotifSearchKernel best = available_motif_search_kernels().back();
+    return best;
+}
@@ -0,0 +1,76 @@
+#ifndef MOTIF_SEARCH_H
+#define MOTIF_SEARCH_H
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+/* Kernels behind find_with_mismatches(). Every kernel returns the first start
+ * position where motif matches seq with at most max_mismatches substitutions,
+ * or std::string::npos, so they are interchangeable.
+ *
+ * The vector kernels test 16 (SSE2/NEON) or 32 (AVX2) start positions at once:
+ * for each motif base j, compare seq[start + j .. start + j + 31] against a
+ * broadcast of motif[j] and add the equality mask into per-position byte
+ * counters. After motif.size() steps each byte holds the match count of one
+ * start position, and a compare + movemask gives every hit in the block.
+ */
+
+using MotifSearchFn = std::size_t (*)(std::string_view seq, std::string_view motif, int max_mismatches);
+
+struct MotifSearchKernel {
+    const char *name;
+    MotifSearchFn search;
+};
+
+std::size_t find_with_mismatches_scalar(std::string_view seq, std::string_view motif, int max_mismatches);
+
+#if defined(__x86_64__) || defined(__i386__)
+std::size_t find_with_mismatches_sse2(std::string_view seq, std::string_view motif, int max_mismatches);
+std::size_t find_with_mismatches_avx2(std::string_view seq, std::string_view motif, int max_mismatches); // AVX2 CPUs only.
+#endif
+
+#if defined(__aarch64__)
+std::size_t find_with_mismatches_neon(std::string_view seq, std::string_view motif, int max_mismatches);
+#endif
+
+// Kernels this CPU can run, scalar first and the preferred one last.
+std::vector<MotifSearchKernel> available_motif_search_kernels();
+
+// Picked once at startup, used by find_with_mismatches().
+const MotifSearchKernel &best_motif_search_kernel();
+
+/* A motif known at compile time, usable as a template argument:
+ *
+ *   constexpr FixedMotif H5{"TGACTACGCTACTCATGG"};
+ *   find_fixed_motif<H5>(seq, 1); // see fixed_motif.h
+ *
+ * The bases are also kept as packed 8-byte words (the byte order of a native
+ * unaligned load, zero padded), so an anchored comparison is a few XORs.
+ */
+template <std::size_t N>
+struct FixedMotif {
+    static_assert(N > 0, "empty motif");
+    static constexpr std::size_t WORDS = (N + 7) / 8;
+
+    char bases[N] = {};
+    std::uint64_t words[WORDS] = {};
+
+    constexpr FixedMotif(const char (&text)[N + 1]) {
+        for (std::size_t i = 0; i < N; i++) {
+            bases[i] = text[i];
+            const unsigned shift = std::endian::native == std::endian::little ? 8 * (i % 8) : 56 - 8 * (i % 8);
+            words[i / 8] |= static_cast<std::uint64_t>(static_cast<unsigned char>(text[i])) << shift;
+        }
+    }
+
+    static constexpr std::size_t size() { return N; }
+    constexpr std::string_view view() const { return std::string_view(bases, N); }
+};
+
+template <std::size_t M>
+FixedMotif(const char (&)[M]) -> FixedMotif<M - 1>;
+
+#endif // MOTIF_SEARCH_H
@@ -0,0 +1,135 @@
+#include "mtx_writer.h"
+#include "tsv_writer.h"
+#include <htslib/bgzf.h>
+#include <algorithm>
+#include <charconv>
+#include <filesystem>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+constexpr std::size_t FLUSH_BYTES = 1 << 20;
+
+/**
+ * @brief output file written through large buffered chunks, BGZF or plain.
+ */
+class MtxFile {
+public:
+    MtxFile(const std::filesystem::path &path, bool compress) : _path_(path.string()) {
+        // "wu" is uncompressed BGZF: same code path, plain bytes on disk.
+        _file_ = bgzf_open(_path_.c_str(), compress ? "w" : "wu");
+        if (!_file_) {
+            throw std::runtime_error("could not open " + _path_ + " for writing");
+        }
+        _buffer_.reserve(FLUSH_BYTES + 4096);
+    }
+
+    ~MtxFile() {
+        if (_file_) bgzf_close(_file_);
+    }
+
+    MtxFile(const MtxFile &) = delete;
+    MtxFile &operator=(const MtxFile &) = delete;
+
+    MtxFile &operator<<(std::string_view text) {
+        _buffer_.append(text);
+        if (_buffer_.size() >= FLUSH_BYTES) flush();
+        return *this;
+    }
+
+    MtxFile &operator<<(std::uint64_t value) {
+        char number[24];
+        const char *end = std::to_chars(number, number + sizeof(number), value).ptr;
+        return *this << std::string_view(number, static_cast<std::size_t>(end - number));
+    }
+
+    void close() {
+        flush();
+        BGZF *file = _file_;
+        _file_ = nullptr;
+        if (bgzf_close(file) != 0) {
+            throw std::runtime_error("Failed to write " + _path_);
+        }
+    }
+
+private:
+    std::string _path_;
+    BGZF *_file_ = nullptr;
+    std::string _buffer_;
+
+    void flush() {
+        if (!_buffer_.empty() && bgzf_write(_file_, _buffer_.data(), _buffer_.size()) != static_cast<ssize_t>(_buffer_.size())) {
+            throw std::runtime_error("Failed to write " + _path_);
+        }
+        _buffer_.clear();
+    }
+};
+
+} // namespace
+
+/**
+ * @brief write the count table as a 10x-style Matrix Market directory.
+ *
+ * One pass over the sorted rows finds the cells and entries over the threshold
+ * (the header needs the entry count up front), a second writes them.
+ *
+ * @param directory created if missing, the three files in it are replaced.
+ * @param counts cell x antibody table, by barcode ID.
+ * @param cell_barcodes whitelist the cell IDs refer to.
+ * @param antibody_barcodes whitelist the antibody IDs refer to, names from its labels.
+ * @param options entry threshold and compression.
+ * @return MtxSummary what was written.
+ */
+MtxSummary write_counts_mtx(const std::string &directory, const CountMatrix &counts, const BarcodeIndex &cell_barcodes,
+                            const BarcodeIndex &antibody_barcodes, const MtxOptions &options) {
+    const std::filesystem::path dir(directory);
+    std::filesystem::create_directories(dir);
+    const char *suffix = options.compress ? ".gz" : "";
+    const CountMatrix::Count min_count =
+        static_cast<CountMatrix::Count>(std::clamp<std::size_t>(options.min_count, 1, UINT32_MAX));
+
+    MtxSummary summary;
+    std::vector<std::uint32_t> rows;
+    for (std::uint32_t row : sorted_cell_rows(counts, cell_barcodes)) {
+        const CountMatrix::Count *row_counts = counts.counts(row);
+        const std::size_t kept = std::count_if(row_counts, row_counts + counts.num_antibodies(),
+                                               [&](CountMatrix::Count n) { return n >= min_count; });
+        if (kept > 0) {
+            rows.push_back(row);
+            summary.entries_written += kept;
+        }
+    }
+    summary.cells_written = rows.size();
+
+    MtxFile features(dir / (std::string("features.tsv") + suffix), options.compress);
+    for (BarcodeIndex::BarcodeId ab = 0; ab < counts.num_antibodies(); ab++) {
+        const std::string &name = antibody_barcodes.label(ab);
+        features << antibody_barcodes.barcode(ab) << "\t" << (name.empty() ? "UNKNOWN" : name) << "\tAntibody Capture\n";
+    }
+    features.close();
+
+    MtxFile barcodes(dir / (std::string("barcodes.tsv") + suffix), options.compress);
+    for (std::uint32_t row : rows) {
+        barcodes << cell_barcodes.barcode(counts.bc1(row)) << "_" << cell_barcodes.barcode(counts.bc2(row)) << "\n";
+    }
+    barcodes.close();
+
+    // Column-major: one column per cell, antibody rows ascending within it.
+    MtxFile matrix(dir / (std::string("matrix.mtx") + suffix), options.compress);
+    matrix << "%%MatrixMarket matrix coordinate integer general\n";
+    matrix << static_cast<std::uint64_t>(counts.num_antibodies()) << " " << static_cast<std::uint64_t>(rows.size()) << " "
+           << static_cast<std::uint64_t>(summary.entries_written) << "\n";
+    for (std::size_t column = 0; column < rows.size(); column++) {
+        const CountMatrix::Count *row_counts = counts.counts(rows[column]);
+        for (std::size_t ab = 0; ab < counts.num_antibodies(); ab++) {
+            if (row_counts[ab] >= min_count) {
+                matrix << static_cast<std::uint64_t>(ab + 1) << " " << static_cast<std::uint64_t>(column + 1) << " "
+                       << static_cast<std::uint64_t>(row_counts[ab]) << "\n";
+            }
+        }
+    }
+    matrix.close();
+    return summary;
+}
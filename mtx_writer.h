@@ -0,0 +1,33 @@
+#ifndef MTX_WRITER_H
+#define MTX_WRITER_H
+
+#include <cstdint>
+#include <string>
+#include "barcode_index.h"
+#include "count_matrix.h"
+
+/* Cell x antibody counts as a sparse matrix in the 10x Genomics layout:
+ *
+ *   <directory>/matrix.mtx.gz     Matrix Market coordinate, antibodies x cells, 1-based.
+ *   <directory>/barcodes.tsv.gz   one "bc1_bc2" cell ID per matrix column.
+ *   <directory>/features.tsv.gz   barcode, name, "Antibody Capture" per matrix row.
+ *
+ * scanpy.read_10x_mtx, Seurat's Read10X and scipy.io.mmread load it directly,
+ * which is much faster than parsing the long-format TSV. Entries and cells
+ * follow the TSV: the same min_count threshold, cells in barcode order. Files
+ * are BGZF, which any gzip reader accepts.
+ */
+struct MtxOptions {
+    std::size_t min_count = 10; // entries below this are left out, cells left empty are dropped.
+    bool compress = true;       // false writes plain .mtx/.tsv files.
+};
+
+struct MtxSummary {
+    std::size_t cells_written = 0;
+    std::size_t entries_written = 0;
+};
+
+MtxSummary write_counts_mtx(const std::string &directory, const CountMatrix &counts, const BarcodeIndex &cell_barcodes,
+                            const BarcodeIndex &antibody_barcodes, const MtxOptions &options);
+
+#endif // MTX_WRITER_H
@@ -0,0 +1,144 @@
+#include "progress_reporter.h"
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+namespace {
+
+/**
+ * @brief seconds as H:MM:SS.
+ */
+std::string format_duration(double seconds) {
+    const long long total = static_cast<long long>(seconds + 0.5);
+    std::ostringstream out;
+    out << total / 3600 << ":" << std::setw(2) << std::setfill('0') << (total / 60) % 60
+        << ":" << std::setw(2) << std::setfill('0') << total % 60;
+    return out.str();
+}
+
+} // namespace
+
+/**
+ * @brief start the reporter thread.
+ * 
+ * @param reader polled for consumed_bytes() and input_bytes(), must outlive the reporter.
+ * @param interval_seconds time between progress lines.
+ */
+ProgressReporter::ProgressReporter(const FastqPairReader &reader, double interval_seconds)
+    : ProgressReporter(std::vector<const FastqPairReader *>{&reader}, interval_seconds) {}
+
+/**
+ * @brief start the reporter thread for several lanes read at once.
+ * 
+ * @param readers polled like the single reader, all must outlive the reporter.
+ * @param interval_seconds time between progress lines.
+ */
+ProgressReporter::ProgressReporter(std::vector<const FastqPairReader *> readers, double interval_seconds)
+    : _readers_(std::move(readers)),
+      _interval_(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(
+          std::clamp(interval_seconds, MIN_INTERVAL_SECONDS, MAX_INTERVAL_SECONDS)))),
+      _start_(Clock::now()) {
+    _thread_ = std::thread([this]() { run(); });
+}
+
+ProgressReporter::~ProgressReporter() {
+    stop();
+}
+
+/**
+ * @brief stop the thread and clear the progress line. Safe to call twice.
+ */
+void ProgressReporter::stop() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex_);
+        _stopping_ = true;
+    }
+    _wake_.notify_all();
+    if (_thread_.joinable()) {
+        _thread_.join();
+    }
+    if (_line_width_ > 0) {
+        std::cout << "\r" << std::string(_line_width_, ' ') << "\r" << std::flush;
+        _line_width_ = 0;
+    }
+}
+
+/**
+ * @brief input consumed over all readers, -1 if any can't tell.
+ */
+std::int64_t ProgressReporter::consumed_bytes() const {
+    std::int64_t total = 0;
+    for (const FastqPairReader *reader : _readers_) {
+        const std::int64_t bytes = reader->consumed_bytes();
+        if (bytes < 0) return -1;
+        total += bytes;
+    }
+    return total;
+}
+
+/**
+ * @brief input size over all readers, -1 if any is unknown.
+ */
+std::int64_t ProgressReporter::input_bytes() const {
+    std::int64_t total = 0;
+    for (const FastqPairReader *reader : _readers_) {
+        const std::int64_t bytes = reader->input_bytes();
+        if (bytes < 0) return -1;
+        total += bytes;
+    }
+    return total;
+}
+
+void ProgressReporter::run() {
+    std::size_t last_pairs = 0;
+    std::int64_t last_bytes = 0;
+    Clock::time_point last_time = _start_;
+
+    std::unique_lock<std::mutex> lock(_mutex_);
+    while (!_wake_.wait_for(lock, _interval_, [this] { return _stopping_; })) {
+        const Clock::time_point now = Clock::now();
+        const std::size_t pairs = _pairs_.load(std::memory_order_relaxed);
+        const std::int64_t bytes = consumed_bytes();
+        const double elapsed = std::chrono::duration<double>(now - last_time).count();
+
+        const double pairs_per_second = elapsed > 0 ? (pairs - last_pairs) / elapsed : 0.0;
+        const double bytes_per_second = elapsed > 0 && bytes >= 0 ? (bytes - last_bytes) / elapsed : -1.0;
+        print_line(pairs, pairs_per_second, bytes, bytes_per_second);
+
+        last_pairs = pairs;
+        last_bytes = bytes;
+        last_time = now;
+    }
+}
+
+/**
+ * @brief rewrite the progress line in place.
+ * 
+ * @param bytes compressed input consumed so far, -1 if unknown (no MB/s or ETA then).
+ * @param bytes_per_second over the last interval, negative if unknown.
+ */
+void ProgressReporter::print_line(std::size_t pairs, double pairs_per_second, std::int64_t bytes, double bytes_per_second) {
+    std::ostringstream line;
+    line << std::fixed << "  Processed " << std::setprecision(2) << pairs / 1e6 << "M pairs, "
+         << pairs_per_second / 1e6 << "M pairs/s";
+
+    if (bytes_per_second >= 0) {
+        line << ", " << std::setprecision(1) << bytes_per_second / 1e6 << " MB/s input";
+    }
+
+    const std::int64_t total_bytes = input_bytes();
+    if (bytes > 0 && total_bytes > 0) {
+        const double fraction = std::min(1.0, static_cast<double>(bytes) / total_bytes);
+        const double elapsed = std::chrono::duration<double>(Clock::now() - _start_).count();
+        line << ", " << std::setprecision(1) << 100.0 * fraction << "%"
+             << ", ETA " << format_duration(elapsed * (1.0 - fraction) / fraction);
+    }
+
+    std::string text = line.str();
+    const std::size_t width = text.size();
+    if (width < _line_width_) text.append(_line_width_ - width, ' '); // cover a longer previous line.
+    _line_width_ = std::max(_line_width_, width);
+    std::cout << "\r" << text << std::flush;
+}
@@ -0,0 +1,58 @@
+#ifndef PROGRESS_REPORTER_H
+#define PROGRESS_REPORTER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "fastq_reader.h"
+
+/* Periodic progress line printed from its own thread.
+ *
+ * The hot loop only calls add() once per batch (one relaxed atomic add).
+ * Every interval the reporter thread prints pairs processed, pairs/s and input
+ * MB/s over the last interval, and an ETA from the average rate at which the
+ * compressed input (FastqPairReader::consumed_bytes) is being consumed relative
+ * to its size on disk, summed over every lane's reader. The line is rewritten
+ * in place with '\r' and cleared on stop(). The interval is clamped to
+ * [MIN_INTERVAL_SECONDS, MAX_INTERVAL_SECONDS].
+ */
+class ProgressReporter {
+public:
+    static constexpr double MIN_INTERVAL_SECONDS = 0.1;
+    static constexpr double MAX_INTERVAL_SECONDS = 24 * 3600.0;
+
+    ProgressReporter(const FastqPairReader &reader, double interval_seconds);
+    ProgressReporter(std::vector<const FastqPairReader *> readers, double interval_seconds);
+    ~ProgressReporter();
+
+    ProgressReporter(const ProgressReporter &) = delete;
+    ProgressReporter &operator=(const ProgressReporter &) = delete;
+
+    void add(std::size_t pairs) { _pairs_.fetch_add(pairs, std::memory_order_relaxed); }
+    void stop();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    const std::vector<const FastqPairReader *> _readers_;
+    const Clock::duration _interval_;
+    const Clock::time_point _start_;
+    std::atomic<std::size_t> _pairs_{0};
+
+    std::mutex _mutex_;
+    std::condition_variable _wake_;
+    bool _stopping_ = false;
+    std::size_t _line_width_ = 0; // width of the last line printed, 0 if none.
+    std::thread _thread_;
+
+    void run();
+    std::int64_t consumed_bytes() const;
+    std::int64_t input_bytes() const;
+    void print_line(std::size_t pairs, double pairs_per_second, std::int64_t bytes, double bytes_per_second);
+};
+
+#endif // PROGRESS_REPORTER_H
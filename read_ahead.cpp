@@ -0,0 +1,130 @@
+#include "read_ahead.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr std::size_t ALIGNMENT = 4096; // chunks start and end on page boundaries.
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+/**
+ * @brief open the file and start prefetching at begin.
+ *
+ * @param path file to prefetch, opened separately from the reader's handle.
+ * @param begin first byte the reader will need (a slice start, or 0).
+ * @param end prefetching stops here or at the end of the file.
+ * @param chunk_bytes size of each pread, rounded up to whole pages.
+ * @param depth chunks kept ready past the reader's position, at least 1.
+ */
+ReadAhead::ReadAhead(const std::string &path, std::uint64_t begin, std::uint64_t end, std::size_t chunk_bytes,
+                     std::size_t depth)
+    : _end_(end), _chunk_bytes_((std::max<std::size_t>(chunk_bytes, 1) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT),
+      _depth_(std::max<std::size_t>(depth, 1)), _position_(begin), _frontier_(begin / ALIGNMENT * ALIGNMENT) {
+    _fd_ = ::open(path.c_str(), O_RDONLY);
+    if (_fd_ < 0) {
+        throw std::runtime_error("Failed to open " + path + " for read-ahead");
+    }
+    ::posix_fadvise(_fd_, 0, 0, POSIX_FADV_SEQUENTIAL); // a hint only, failure doesn't matter.
+    _thread_ = std::thread(&ReadAhead::run, this);
+}
+
+ReadAhead::~ReadAhead() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex_);
+        _stop_ = true;
+    }
+    _wake_prefetcher_.notify_all();
+    _thread_.join();
+    ::close(_fd_);
+}
+
+/**
+ * @brief block until the next `bytes` from `position` have been prefetched.
+ *
+ * At most depth chunks are waited for, a larger read finds the rest uncached.
+ * Also lets the prefetcher move on: it stays up to depth chunks past the
+ * latest position reported here.
+ *
+ * @param position absolute file offset the reader has reached.
+ * @param bytes how far the reader's next read may go.
+ * @return double seconds spent blocked, 0 if the data was already in.
+ */
+double ReadAhead::wait(std::uint64_t position, std::uint64_t bytes) {
+    std::unique_lock<std::mutex> lock(_mutex_);
+    if (position > _position_) {
+        _position_ = position;
+        _wake_prefetcher_.notify_one();
+    }
+    // The prefetcher never gets further ahead than its window, so neither can a wait.
+    const std::uint64_t window = static_cast<std::uint64_t>(_depth_) * _chunk_bytes_;
+    const std::uint64_t needed = std::min(position + std::min(bytes, window), _end_);
+    if (_done_ || _frontier_ >= needed) {
+        return 0.0;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    _wake_reader_.wait(lock, [&]() { return _done_ || _frontier_ >= needed; });
+    const double seconds = seconds_since(start);
+    _stats_.stall_seconds += seconds;
+    _stats_.stalls++;
+    return seconds;
+}
+
+ReadAhead::Stats ReadAhead::stats() const {
+    std::lock_guard<std::mutex> lock(_mutex_);
+    return _stats_;
+}
+
+/**
+ * @brief prefetch thread: pread chunk after chunk while within depth of the reader.
+ *
+ * A short or failed read ends prefetching; the reader then simply reads
+ * uncached, and reports any real error itself.
+ */
+void ReadAhead::run() {
+    std::unique_ptr<char, decltype(&std::free)> buffer(static_cast<char *>(std::aligned_alloc(ALIGNMENT, _chunk_bytes_)),
+                                                       &std::free);
+    const std::uint64_t window = static_cast<std::uint64_t>(_depth_) * _chunk_bytes_;
+    for (;;) {
+        std::uint64_t offset;
+        {
+            std::unique_lock<std::mutex> lock(_mutex_);
+            _wake_prefetcher_.wait(lock, [&]() { return _stop_ || _frontier_ < _position_ + window; });
+            if (_stop_) return;
+            if (!buffer || _frontier_ >= _end_) {
+                _done_ = true;
+                break;
+            }
+            offset = _frontier_;
+        }
+
+        const std::size_t length = static_cast<std::size_t>(std::min<std::uint64_t>(_chunk_bytes_, _end_ - offset));
+        const auto start = std::chrono::steady_clock::now();
+        const ssize_t got = ::pread(_fd_, buffer.get(), length, static_cast<off_t>(offset));
+        const double seconds = seconds_since(start);
+
+        std::lock_guard<std::mutex> lock(_mutex_);
+        _stats_.io_seconds += seconds;
+        if (got <= 0) {
+            _done_ = true;
+            break;
+        }
+        _frontier_ += static_cast<std::uint64_t>(got);
+        _stats_.bytes += static_cast<std::uint64_t>(got);
+        if (static_cast<std::size_t>(got) < length) {
+            _done_ = true; // end of file.
+            break;
+        }
+        _wake_reader_.notify_all();
+    }
+    _wake_reader_.notify_all();
+}
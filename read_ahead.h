@@ -0,0 +1,62 @@
+#ifndef READ_AHEAD_H
+#define READ_AHEAD_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/* Background read-ahead of one input file, for storage where every read waits
+ * on a round trip (NFS and other network filesystems).
+ *
+ * htslib reads its input in small synchronous chunks, each of which stalls on
+ * the network when the data isn't cached. A ReadAhead thread preads the file in
+ * large page-aligned chunks, up to `depth` chunks past the position the reader
+ * last reported, into a scratch buffer: the data lands in the page cache, and
+ * htslib's own reads (or page faults on a mapping) are then served from memory.
+ * The reader keeps reading the file exactly as before, so errors are still
+ * reported by it and nothing about the parsed bytes depends on the prefetcher.
+ *
+ * wait() is the reader side: it reports the reader's position and blocks until
+ * the bytes it is about to read are in. Time spent there is I/O the reader had to
+ * wait for, as opposed to inflate and parse time.
+ */
+class ReadAhead {
+public:
+    struct Stats {
+        std::uint64_t bytes = 0;     // prefetched.
+        double io_seconds = 0.0;     // prefetch thread time inside pread.
+        double stall_seconds = 0.0;  // reader time blocked in wait().
+        std::uint64_t stalls = 0;    // wait() calls that blocked.
+    };
+
+    // Prefetch [begin, end) of path (end may be past the end of the file).
+    ReadAhead(const std::string &path, std::uint64_t begin, std::uint64_t end, std::size_t chunk_bytes, std::size_t depth);
+    ~ReadAhead();
+    ReadAhead(const ReadAhead &) = delete;
+    ReadAhead &operator=(const ReadAhead &) = delete;
+
+    // The reader is at `position` and will read `bytes` next; returns seconds blocked.
+    double wait(std::uint64_t position, std::uint64_t bytes);
+    Stats stats() const;
+
+private:
+    int _fd_ = -1;
+    std::uint64_t _end_;
+    std::size_t _chunk_bytes_;
+    std::size_t _depth_;
+    mutable std::mutex _mutex_; // guards the fields below.
+    std::condition_variable _wake_prefetcher_;
+    std::condition_variable _wake_reader_;
+    std::uint64_t _position_;   // reader's last reported offset.
+    std::uint64_t _frontier_;   // everything before this has been read.
+    bool _done_ = false;        // end of range, end of file or a failed read.
+    bool _stop_ = false;
+    Stats _stats_;
+    std::thread _thread_;       // last, started once everything above is set.
+
+    void run();
+};
+
+#endif // READ_AHEAD_H
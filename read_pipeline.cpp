@@ -0,0 +1,623 @@
+#include "read_pipeline.h"
+#include "bounded_queue.h"
+#include "count_spill.h"
+#include "progress_reporter.h"
+#include "dabseq_utilities.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/* Producer/consumer layout used when more than one worker is requested:
+ *
+ *   reader thread --(filled batches)--> N worker threads
+ *        ^                                     |
+ *        +---------(empty batches)-------------+
+ *
+ * The reader is the only thread touching the FastqPairReader (htslib file handles
+ * are not thread-safe), and it recycles a fixed pool of RecordBatches so their
+ * block buffers keep their capacity between uses. Each worker owns a private
+ * PipelineResult, padded to whole cache lines, and the private count tables
+ * are summed after all threads are joined by a parallel tree merge
+ * (CountMatrix::merge_all), so no locking happens on the per-read path.
+ *
+ * Unless a window is given, the first r1_learn_pairs pairs are processed on
+ * the calling thread with a full R1 scan, and the positions where the motif
+ * was found pick the window every later read tries first.
+ *
+ * With a memory_limit, each worker's partial table may use limit / workers
+ * bytes. A table past its share is written to a CountSpill run after the
+ * current batch and restarted empty, and all runs are summed back into the
+ * result at the end. The limit caps the partial tables only: the merged table
+ * holds every cell regardless, so the single-threaded loop, which counts
+ * straight into it, never spills.
+ *
+ * With options.profile each batch is processed in stages (all R1 reads, then
+ * all R2 reads, then counting) so one steady_clock reading per stage per batch
+ * is enough to attribute time; the per-read loop is untouched otherwise.
+ *
+ * With options.umi every counted pair also puts its (cell, antibody, UMI) key
+ * into its table's UmiSet; sets are merged like the tables, but never spilled,
+ * so a memory_limit is refused with options.umi.
+ *
+ * With options.samples every pair is assigned a sample from the index reads in
+ * its R1 header before anything else, and counts go to (sample, cell) rows of
+ * the same tables, so demultiplexing costs no pass of its own.
+ *
+ * Progress is printed by a ProgressReporter thread; whoever counts a batch
+ * bumps its atomic pair counter afterwards.
+ *
+ * Several input pairs (one per lane) each get the whole pipeline above, with
+ * options.lane_jobs of them running at once on their own threads and the worker
+ * and memory budgets split between them. The whitelists are read-only and
+ * shared, one ProgressReporter covers every reader, and the per-lane results are
+ * merged in memory like the per-worker ones.
+ */
+
+namespace {
+
+using ReadStatus = FastqPairReader::ReadStatus;
+using PairView = FastqPairReader::PairView;
+using RecordBatch = FastqPairReader::RecordBatch;
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief tally one read pair from its parse results.
+ */
+void tally(const CellBarcodeHit &cell_barcode, const AntibodyHit &antibody_barcode, CountMatrix::SampleId sample,
+           PipelineResult &result) {
+    if (cell_barcode.valid) {
+        result.num_with_barcodes++;
+    }
+
+    if (antibody_barcode.valid) {
+        result.num_with_ab_payload++;
+    }
+
+    if (cell_barcode.valid && antibody_barcode.valid) {
+        result.num_with_both++;
+        result.counts.add(cell_barcode.bc1_id, cell_barcode.bc2_id, antibody_barcode.id, 1, sample);
+    }
+}
+
+/**
+ * @brief add a counted pair's (cell, antibody, UMI) triple to the UMI set.
+ */
+void collect_umi(std::string_view r2_sequence, const CellBarcodeHit &cell_barcode, const AntibodyHit &antibody_barcode,
+                 const UmiLayout &umi, PipelineResult &result) {
+    if (!umi.enabled() || !cell_barcode.valid || !antibody_barcode.valid) return;
+    const std::uint32_t umi_pos = locate_ab_umi_in_r2(r2_sequence, antibody_barcode, umi);
+    std::uint32_t umi_bits;
+    if (umi_pos == NO_OFFSET || !UmiSet::pack_umi(r2_sequence.substr(umi_pos, umi.length), umi_bits)) {
+        result.reads_without_umi++;
+        return;
+    }
+    result.umis.insert(UmiSet::key(cell_barcode.bc1_id, cell_barcode.bc2_id, antibody_barcode.id, umi_bits));
+}
+
+/**
+ * @brief sample of a pair, 0 without a sample sheet; every pair is counted in sample_pairs.
+ */
+CountMatrix::SampleId assign_sample(const PairView &pair, const SampleSheet *samples, PipelineResult &result) {
+    if (!samples) return 0;
+    const CountMatrix::SampleId sample = samples->assign(pair.r1.header);
+    result.sample_pairs[sample]++;
+    return sample;
+}
+
+void record_motif_position(const CellBarcodeHit &cell_barcode, std::vector<std::size_t> *histogram) {
+    if (!histogram || cell_barcode.motif_pos == NO_OFFSET) return;
+    if (cell_barcode.motif_pos >= histogram->size()) histogram->resize(cell_barcode.motif_pos + 1, 0);
+    (*histogram)[cell_barcode.motif_pos]++;
+}
+
+/**
+ * @brief parse R2 unless count_only says its result can't be used.
+ *
+ * With count_only, pairs without a cell barcode are never counted, so their R2
+ * is parsed only for every r2_sample_every-th pair of the batch, to estimate
+ * the payload rate of the ones skipped.
+ *
+ * @param index position of the pair in its batch, picks the sampled pairs.
+ */
+AntibodyHit match_r2_if_counted(std::string_view r2_sequence, const CellBarcodeHit &cell_barcode, std::size_t index,
+                                const BarcodeIndex &antibody_barcodes, const PipelineOptions &options, R2Sampling &sampling) {
+    if (!options.count_only || cell_barcode.valid) {
+        return match_antibody_in_r2(r2_sequence, antibody_barcodes);
+    }
+    if (options.r2_sample_every == 0 || index % options.r2_sample_every != 0) {
+        sampling.skipped++;
+        return AntibodyHit();
+    }
+    AntibodyHit hit = match_antibody_in_r2(r2_sequence, antibody_barcodes);
+    sampling.sampled++;
+    sampling.sampled_hits += hit.valid;
+    return hit;
+}
+
+constexpr std::size_t CACHE_LINE_BYTES = 64;
+
+// A worker's private result on cache lines of its own: its counters are bumped
+// for every read, and must not share a line with the next worker's table.
+struct alignas(CACHE_LINE_BYTES) WorkerResult {
+    PipelineResult result;
+};
+
+// Per-thread parse results of one batch, reused between batches (profile mode only).
+struct BatchScratch {
+    std::vector<CountMatrix::SampleId> samples;
+    std::vector<CellBarcodeHit> cell_barcodes;
+    std::vector<AntibodyHit> antibody_barcodes;
+    std::vector<char> passed; // pre-filter verdicts, R2 is skipped where 0.
+};
+
+double seconds_since(Clock::time_point start, Clock::time_point end) {
+    return std::chrono::duration<double>(end - start).count();
+}
+
+/**
+ * @brief parse cell/antibody barcodes of every pair in a batch and tally them.
+ *
+ * @param batch r1/r2 pairs.
+ * @param cell_barcodes cell barcode whitelist.
+ * @param antibody_barcodes antibody barcode whitelist.
+ * @param window expected R1 motif starts.
+ * @param options profile selects the staged, timed loop; pairs failing read_filter are not parsed,
+ *        count_only skips R2 of most pairs without a cell barcode, samples demultiplexes every pair.
+ * @param scratch staged parse results, only used when profiling.
+ * @param result counters, count table and stage times updated in place.
+ * @param motif_histogram R1 motif starts are tallied here if not null.
+ */
+void count_batch(const RecordBatch &batch, const BarcodeIndex &cell_barcodes, const BarcodeIndex &antibody_barcodes,
+                 const MotifWindow &window, const PipelineOptions &options, BatchScratch &scratch,
+                 PipelineResult &result, std::vector<std::size_t> *motif_histogram) {
+    const bool filter = options.read_filter.enabled();
+    if (options.samples && result.sample_pairs.empty()) result.sample_pairs.assign(options.samples->num_ids(), 0);
+    if (!options.profile) {
+        for (std::size_t i = 0; i < batch.size(); i++) {
+            const PairView &pair = batch[i];
+            const CountMatrix::SampleId sample = assign_sample(pair, options.samples, result);
+            if (filter && !passes_read_filter(pair, options.read_filter, result.filter_counters)) continue;
+
+            // Parse cell barcode from R1
+            CellBarcodeHit cell_barcode = match_barcodes_in_r1(pair.r1.sequence, cell_barcodes, window, result.r1_counters);
+
+            // Parse antibody barcode from R2
+            AntibodyHit antibody_barcode =
+                match_r2_if_counted(pair.r2.sequence, cell_barcode, i, antibody_barcodes, options, result.r2_sampling);
+
+            record_motif_position(cell_barcode, motif_histogram);
+            tally(cell_barcode, antibody_barcode, sample, result);
+            collect_umi(pair.r2.sequence, cell_barcode, antibody_barcode, options.umi, result);
+        }
+        return;
+    }
+
+    const std::size_t n = batch.size();
+    scratch.samples.resize(n);
+    scratch.cell_barcodes.resize(n);
+    scratch.antibody_barcodes.resize(n);
+    scratch.passed.resize(n);
+
+    // The pre-filter and sample index are timed as part of R1 parsing; rejected pairs keep empty hits and tally nothing.
+    const Clock::time_point start = Clock::now();
+    for (std::size_t i = 0; i < n; i++) {
+        scratch.samples[i] = assign_sample(batch[i], options.samples, result);
+        scratch.passed[i] = !filter || passes_read_filter(batch[i], options.read_filter, result.filter_counters);
+        scratch.cell_barcodes[i] = scratch.passed[i] ? match_barcodes_in_r1(batch[i].r1.sequence, cell_barcodes, window, result.r1_counters)
+                                                     : CellBarcodeHit();
+    }
+    const Clock::time_point r1_done = Clock::now();
+    for (std::size_t i = 0; i < n; i++) {
+        scratch.antibody_barcodes[i] = scratch.passed[i] ? match_r2_if_counted(batch[i].r2.sequence, scratch.cell_barcodes[i], i,
+                                                                               antibody_barcodes, options, result.r2_sampling)
+                                                         : AntibodyHit();
+    }
+    const Clock::time_point r2_done = Clock::now();
+    for (std::size_t i = 0; i < n; i++) {
+        record_motif_position(scratch.cell_barcodes[i], motif_histogram);
+        tally(scratch.cell_barcodes[i], scratch.antibody_barcodes[i], scratch.samples[i], result);
+        collect_umi(batch[i].r2.sequence, scratch.cell_barcodes[i], scratch.antibody_barcodes[i], options.umi, result);
+    }
+    const Clock::time_point count_done = Clock::now();
+
+    result.stage_times.r1_parse += seconds_since(start, r1_done);
+    result.stage_times.r2_parse += seconds_since(r1_done, r2_done);
+    result.stage_times.count += seconds_since(r2_done, count_done);
+}
+
+/**
+ * @brief add a worker's counters and UMI set into the running total, see merge_results().
+ */
+void merge_counters(PipelineResult &total, PipelineResult &part) {
+    total.num_with_barcodes += part.num_with_barcodes;
+    total.num_with_ab_payload += part.num_with_ab_payload;
+    total.num_with_both += part.num_with_both;
+    total.r1_counters.window_hits += part.r1_counters.window_hits;
+    total.r1_counters.full_scan_hits += part.r1_counters.full_scan_hits;
+    total.r1_counters.no_motif += part.r1_counters.no_motif;
+    total.filter_counters.bc1_n += part.filter_counters.bc1_n;
+    total.filter_counters.bc1_quality += part.filter_counters.bc1_quality;
+    total.filter_counters.r2_n += part.filter_counters.r2_n;
+    total.filter_counters.r2_quality += part.filter_counters.r2_quality;
+    total.r2_sampling.skipped += part.r2_sampling.skipped;
+    total.r2_sampling.sampled += part.r2_sampling.sampled;
+    total.r2_sampling.sampled_hits += part.r2_sampling.sampled_hits;
+    total.reads_without_umi += part.reads_without_umi;
+    if (total.sample_pairs.size() < part.sample_pairs.size()) total.sample_pairs.resize(part.sample_pairs.size(), 0);
+    for (std::size_t sample = 0; sample < part.sample_pairs.size(); sample++) {
+        total.sample_pairs[sample] += part.sample_pairs[sample];
+    }
+    if (total.umis.size() == 0) {
+        std::swap(total.umis, part.umis);
+    } else {
+        total.umis.merge(part.umis);
+    }
+    part.umis = UmiSet();
+    total.stage_times.r1_parse += part.stage_times.r1_parse;
+    total.stage_times.r2_parse += part.stage_times.r2_parse;
+    total.stage_times.count += part.stage_times.count;
+}
+
+/**
+ * @brief add finished results into total, count tables through a parallel tree merge.
+ *
+ * @param parts worker or lane results in order, their tables are released.
+ * @param threads merges run at once.
+ */
+void merge_results(PipelineResult &total, const std::vector<PipelineResult *> &parts, std::size_t threads) {
+    std::vector<CountMatrix> tables;
+    tables.reserve(parts.size() + 1);
+    tables.push_back(std::move(total.counts)); // learning pairs, or nothing, go first.
+    for (PipelineResult *part : parts) {
+        merge_counters(total, *part);
+        tables.push_back(std::move(part->counts));
+    }
+    total.counts = CountMatrix::merge_all(tables, threads);
+}
+
+/**
+ * @brief write the table to a spill run and start a fresh one once it outgrows limit.
+ */
+void spill_if_full(CountMatrix &counts, std::size_t limit, CountSpill &spill) {
+    if (limit == 0 || counts.memory_bytes() <= limit) return;
+    spill.write(counts);
+    counts = CountMatrix(counts.num_antibodies());
+}
+
+/**
+ * @brief the malformed input error; a slice only knows its pairs from the slice start.
+ */
+std::runtime_error read_error(const FastqPairReader &reader, std::size_t pair_number) {
+    return std::runtime_error("malformed or truncated FASTQ at pair " + std::to_string(pair_number) +
+                              (reader.slice().count > 1 ? " of the slice (counted from the slice start)" : ""));
+}
+
+/**
+ * @brief how many pairs the next batch may hold, 0 once max_pairs is reached.
+ */
+std::size_t next_batch_size(std::size_t total_pairs, const PipelineOptions &options) {
+    const std::size_t batch_size = options.batch_size > 0 ? options.batch_size : 1;
+    if (options.max_pairs == 0) return batch_size;
+    if (total_pairs >= options.max_pairs) return 0;
+    return std::min(batch_size, options.max_pairs - total_pairs);
+}
+
+/**
+ * @brief pull one batch, throwing with the 1-based pair number on malformed input.
+ *
+ * @param read_seconds time spent in the reader is added here when profiling.
+ * @return false at end of file or once max_pairs is reached.
+ */
+bool read_batch(FastqPairReader &reader, RecordBatch &batch, std::size_t &total_pairs,
+                bool &reached_end_of_file, const PipelineOptions &options, double &read_seconds) {
+    const std::size_t wanted = next_batch_size(total_pairs, options);
+    if (wanted == 0) return false;
+
+    const Clock::time_point start = options.profile ? Clock::now() : Clock::time_point();
+    ReadStatus status = reader.next_batch(batch, wanted);
+    if (options.profile) read_seconds += seconds_since(start, Clock::now());
+    if (status == ReadStatus::END_OF_FILE) {
+        reached_end_of_file = true;
+        return false;
+    }
+    if (status == ReadStatus::READ_ERROR) {
+        throw read_error(reader, reader.pairs_read() + 1); // counts pairs sampled out too.
+    }
+
+    total_pairs += batch.size();
+    return true;
+}
+
+/**
+ * @brief process pairs on the calling thread with a full R1 scan and learn the motif window.
+ *
+ * @param batch reused afterwards by the runners, so the reader sees it come back.
+ * @param result seeded with the counts of the learning pairs, window set unless nothing matched.
+ */
+void learn_r1_window(FastqPairReader &reader, const BarcodeIndex &cell_barcodes,
+                     const BarcodeIndex &antibody_barcodes, const PipelineOptions &options,
+                     RecordBatch &batch, ProgressReporter *progress, PipelineResult &result) {
+    PipelineOptions learn_options = options;
+    learn_options.max_pairs = options.max_pairs > 0 ? std::min(options.max_pairs, options.r1_learn_pairs)
+                                                    : options.r1_learn_pairs;
+    const MotifWindow full_scan;
+    std::vector<std::size_t> histogram;
+    BatchScratch scratch;
+
+    while (read_batch(reader, batch, result.total_pairs, result.reached_end_of_file, learn_options,
+                      result.stage_times.read)) {
+        count_batch(batch, cell_barcodes, antibody_barcodes, full_scan, options, scratch, result, &histogram);
+        if (progress) progress->add(batch.size());
+    }
+
+    result.r1_motif_window = learn_motif_window(histogram, options.r1_window_coverage);
+    result.r1_learned_from = result.total_pairs;
+}
+
+void run_single_threaded(FastqPairReader &reader, const BarcodeIndex &cell_barcodes,
+                         const BarcodeIndex &antibody_barcodes, const PipelineOptions &options,
+                         RecordBatch &batch, ProgressReporter *progress, PipelineResult &result) {
+    BatchScratch scratch;
+    reader.set_batches_in_flight(1);
+
+    while (read_batch(reader, batch, result.total_pairs, result.reached_end_of_file, options, result.stage_times.read)) {
+        count_batch(batch, cell_barcodes, antibody_barcodes, result.r1_motif_window, options, scratch, result, nullptr);
+        if (progress) progress->add(batch.size());
+    }
+}
+
+void run_multi_threaded(FastqPairReader &reader, const BarcodeIndex &cell_barcodes,
+                        const BarcodeIndex &antibody_barcodes, const PipelineOptions &options,
+                        RecordBatch &first_batch, CountSpill &spill, ProgressReporter *progress, PipelineResult &result) {
+    const std::size_t num_workers = options.threads;
+    const std::size_t worker_memory_limit = options.memory_limit > 0 ? std::max<std::size_t>(1, options.memory_limit / num_workers) : 0;
+    const std::size_t queue_depth = options.queue_depth > 0 ? options.queue_depth : 2 * num_workers;
+    const std::size_t pool_size = queue_depth + num_workers; // every worker can hold one while the queue is full.
+    const MotifWindow window = result.r1_motif_window;
+    reader.set_batches_in_flight(pool_size); // all of them can be out at once.
+
+    BoundedQueue<RecordBatch> filled_batches(queue_depth);
+    BoundedQueue<RecordBatch> empty_batches(pool_size);
+    empty_batches.push(std::move(first_batch)); // the learning batch, see learn_r1_window().
+    for (std::size_t i = 1; i < pool_size; i++) {
+        empty_batches.push(RecordBatch());
+    }
+
+    std::size_t total_pairs = result.total_pairs;
+    bool reached_end_of_file = false;
+    double read_seconds = 0.0;
+    std::exception_ptr reader_exception;
+
+    std::thread reader_thread([&]() {
+        try {
+            while (std::optional<RecordBatch> batch = empty_batches.pop()) { // nullopt if a worker failed.
+                if (!read_batch(reader, *batch, total_pairs, reached_end_of_file, options, read_seconds)) break;
+                if (!filled_batches.push(std::move(*batch))) break;
+            }
+        } catch (...) {
+            reader_exception = std::current_exception();
+        }
+        filled_batches.close(); // workers drain what is left, then exit.
+    });
+
+    std::vector<WorkerResult> worker_results(num_workers);
+    for (WorkerResult &part : worker_results) {
+        part.result.counts = CountMatrix(antibody_barcodes.size());
+    }
+    std::vector<std::exception_ptr> worker_exceptions(num_workers);
+    std::vector<std::thread> workers;
+    workers.reserve(num_workers);
+
+    for (std::size_t w = 0; w < num_workers; w++) {
+        workers.emplace_back([&, w]() {
+            try {
+                BatchScratch scratch;
+                while (std::optional<RecordBatch> batch = filled_batches.pop()) {
+                    count_batch(*batch, cell_barcodes, antibody_barcodes, window, options, scratch, worker_results[w].result, nullptr);
+                    if (progress) progress->add(batch->size());
+                    empty_batches.push(std::move(*batch));
+                    spill_if_full(worker_results[w].result.counts, worker_memory_limit, spill);
+                }
+            } catch (...) {
+                worker_exceptions[w] = std::current_exception();
+                // Unblock the reader and the other workers so everything can be joined.
+                empty_batches.close();
+                filled_batches.close();
+            }
+        });
+    }
+
+    reader_thread.join();
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+
+    if (reader_exception) std::rethrow_exception(reader_exception);
+    for (const std::exception_ptr &e : worker_exceptions) {
+        if (e) std::rethrow_exception(e);
+    }
+
+    result.total_pairs = total_pairs;
+    result.reached_end_of_file = reached_end_of_file;
+    result.stage_times.read += read_seconds;
+    std::vector<PipelineResult *> parts;
+    for (WorkerResult &part : worker_results) {
+        parts.push_back(&part.result);
+    }
+    merge_results(result, parts, num_workers);
+}
+
+/**
+ * @brief everything run_read_pipeline() does for one input pair, progress owned by the caller.
+ */
+PipelineResult run_lane(FastqPairReader &reader, const BarcodeIndex &cell_barcodes,
+                        const BarcodeIndex &antibody_barcodes, const PipelineOptions &options,
+                        ProgressReporter *progress) {
+    if (options.samples && options.umi.enabled()) {
+        // UMI keys have no bits left for a sample.
+        throw std::runtime_error("UMI counting can't be combined with sample demultiplexing");
+    }
+    if (options.memory_limit > 0 && options.umi.enabled()) {
+        // The UMI sets grow past any table limit and are never spilled, so the limit would not hold.
+        throw std::runtime_error("UMI counting can't be combined with a memory limit");
+    }
+    PipelineResult result;
+    result.counts = CountMatrix(antibody_barcodes.size());
+    result.r1_motif_window = options.r1_motif_window;
+    CountSpill spill(options.spill_directory);
+
+    // Batches handed back to the reader let it drop mapped input it no longer needs,
+    // so the one used for learning carries on into the runners.
+    RecordBatch batch;
+    if (!result.r1_motif_window.enabled() && options.r1_learn_pairs > 0) {
+        learn_r1_window(reader, cell_barcodes, antibody_barcodes, options, batch, progress, result);
+    }
+
+    if (result.reached_end_of_file) {
+        // the input was shorter than the learning pairs.
+    } else if (options.threads <= 1) {
+        run_single_threaded(reader, cell_barcodes, antibody_barcodes, options, batch, progress, result);
+    } else {
+        run_multi_threaded(reader, cell_barcodes, antibody_barcodes, options, batch, spill, progress, result);
+    }
+
+    result.spill_runs = spill.runs();
+    result.spill_bytes = spill.bytes_written();
+    spill.merge_into(result.counts);
+    result.lane_pairs = {result.total_pairs};
+    return result;
+}
+
+/**
+ * @brief add one lane's totals into the run total, lanes in input order; counters and
+ * counts follow in merge_results().
+ */
+void merge_lane(PipelineResult &total, PipelineResult &lane) {
+    const bool first = total.lane_pairs.empty();
+    total.total_pairs += lane.total_pairs;
+    total.reached_end_of_file = first ? lane.reached_end_of_file : total.reached_end_of_file && lane.reached_end_of_file;
+    if (first) total.r1_motif_window = lane.r1_motif_window; // each lane learns its own, report the first.
+    total.r1_learned_from += lane.r1_learned_from;
+    total.spill_runs += lane.spill_runs;
+    total.spill_bytes += lane.spill_bytes;
+    total.stage_times.read += lane.stage_times.read;
+    total.lane_pairs.push_back(lane.total_pairs);
+}
+
+} // namespace
+
+/**
+ * @brief read every pair from the reader, parse barcodes and tally counts.
+ *
+ * With options.threads <= 1 this is the original single loop. Otherwise one
+ * reader thread fills batches into a bounded queue and options.threads workers
+ * parse them into private count tables which are merged at the end, so the
+ * counts are identical to the single-threaded run.
+ *
+ * R1 motif searches try options.r1_motif_window first; if it is disabled the
+ * window is learned from the first options.r1_learn_pairs pairs.
+ *
+ * @param reader open r1/r2 reader, only ever touched by one thread.
+ * @param cell_barcodes cell barcode whitelist.
+ * @param antibody_barcodes antibody barcode whitelist.
+ * @param options thread count, batching, read limit, R1 window and memory ceiling.
+ * @return PipelineResult totals and merged count table.
+ */
+PipelineResult run_read_pipeline(FastqPairReader &reader, const BarcodeIndex &cell_barcodes,
+                                 const BarcodeIndex &antibody_barcodes, const PipelineOptions &options) {
+    std::unique_ptr<ProgressReporter> progress;
+    if (options.progress_seconds > 0) {
+        progress = std::make_unique<ProgressReporter>(reader, options.progress_seconds);
+    }
+    PipelineResult result = run_lane(reader, cell_barcodes, antibody_barcodes, options, progress.get());
+    if (progress) progress->stop();
+    if (options.umi.enabled()) result.umi_counts = result.umis.counts_like(result.counts);
+    return result;
+}
+
+/**
+ * @brief run_read_pipeline() over several R1/R2 pairs, e.g. the lanes of one run.
+ *
+ * options.max_pairs applies to each lane. A failing lane fails the run, its error
+ * is reported with the 1-based input pair and, for a slice, which slice it is.
+ *
+ * @param lanes open readers, each only ever touched by the thread running its lane.
+ * @param lane_pair 0-based input pair of each reader, empty if every reader is a pair of its own.
+ * @param cell_barcodes cell barcode whitelist, shared read-only by every lane.
+ * @param antibody_barcodes antibody barcode whitelist, shared read-only by every lane.
+ * @param options as for one pair; threads and memory_limit are totals split across lane_jobs.
+ * @return PipelineResult totals and merged count table, lane_pairs per input pair.
+ */
+PipelineResult run_read_pipeline(const std::vector<FastqPairReader *> &lanes, const BarcodeIndex &cell_barcodes,
+                                 const BarcodeIndex &antibody_barcodes, const PipelineOptions &options,
+                                 const std::vector<std::size_t> &lane_pair) {
+    if (lanes.size() == 1) {
+        return run_read_pipeline(*lanes.front(), cell_barcodes, antibody_barcodes, options);
+    }
+
+    const std::size_t threads = std::max<std::size_t>(1, options.threads);
+    const std::size_t jobs = std::clamp<std::size_t>(options.lane_jobs > 0 ? options.lane_jobs : std::min(lanes.size(), threads),
+                                                     1, std::max<std::size_t>(1, lanes.size()));
+    PipelineOptions lane_options = options;
+    lane_options.threads = std::max<std::size_t>(1, threads / jobs);
+    lane_options.memory_limit = options.memory_limit > 0 ? std::max<std::size_t>(1, options.memory_limit / jobs) : 0;
+
+    std::unique_ptr<ProgressReporter> progress;
+    if (options.progress_seconds > 0) {
+        progress = std::make_unique<ProgressReporter>(std::vector<const FastqPairReader *>(lanes.begin(), lanes.end()),
+                                                      options.progress_seconds);
+    }
+
+    std::vector<PipelineResult> lane_results(lanes.size());
+    std::vector<std::exception_ptr> lane_exceptions(lanes.size());
+    std::atomic<std::size_t> next_lane{0};
+    auto run_lanes = [&]() {
+        for (std::size_t lane; (lane = next_lane.fetch_add(1)) < lanes.size();) {
+            try {
+                lane_results[lane] = run_lane(*lanes[lane], cell_barcodes, antibody_barcodes, lane_options, progress.get());
+            } catch (...) {
+                lane_exceptions[lane] = std::current_exception();
+            }
+        }
+    };
+    std::vector<std::thread> lane_threads;
+    for (std::size_t j = 1; j < jobs; j++) {
+        lane_threads.emplace_back(run_lanes);
+    }
+    run_lanes(); // the calling thread takes lanes too.
+    for (std::thread &thread : lane_threads) {
+        thread.join();
+    }
+    if (progress) progress->stop();
+
+    for (std::size_t lane = 0; lane < lanes.size(); lane++) {
+        if (!lane_exceptions[lane]) continue;
+        try {
+            std::rethrow_exception(lane_exceptions[lane]);
+        } catch (const std::exception &e) {
+            const FastqPairReader::Slice slice = lanes[lane]->slice();
+            std::string label = "R1/R2 pair " + std::to_string((lane_pair.empty() ? lane : lane_pair[lane]) + 1);
+            if (slice.count > 1) {
+                label += " (slice " + std::to_string(slice.index + 1) + "/" + std::to_string(slice.count) + ")";
+            }
+            throw std::runtime_error(label + ": " + e.what());
+        }
+    }
+
+    PipelineResult result;
+    result.counts = CountMatrix(antibody_barcodes.size());
+    std::vector<PipelineResult *> parts;
+    for (PipelineResult &lane : lane_results) {
+        merge_lane(result, lane);
+        parts.push_back(&lane);
+    }
+    merge_results(result, parts, threads);
+    if (options.umi.enabled()) result.umi_counts = result.umis.counts_like(result.counts);
+    return result;
+}
@@ -0,0 +1,90 @@
+#ifndef READ_PIPELINE_H
+#define READ_PIPELINE_H
+
+#include "fastq_reader.h"
+#include "barcode_index.h"
+#include "count_matrix.h"
+#include "dabseq_utilities.h"
+#include "sample_sheet.h"
+#include "umi_set.h"
+#include <string>
+#include <vector>
+
+struct PipelineOptions {
+    std::size_t threads = 1;            // parse/count workers. 1 keeps everything on the calling thread.
+    std::size_t batch_size = 4096;      // read pairs handed to a worker at a time.
+    std::size_t queue_depth = 0;        // filled batches buffered ahead of the workers, 0 -> 2 per worker.
+    std::size_t max_pairs = 0;          // stop after this many pairs, 0 -> no limit.
+    double progress_seconds = 5.0;      // interval of the live progress line, 0 -> none.
+    MotifWindow r1_motif_window;        // expected R1_START_MOTIF starts, disabled -> learn it.
+    std::size_t r1_learn_pairs = 10000; // pairs scanned in full to learn the window, 0 -> always full scan.
+    double r1_window_coverage = 0.99;   // fraction of the learned motif positions the window must cover.
+    std::size_t memory_limit = 0;       // worker partial table bytes before they spill to disk, 0 -> never.
+    std::string spill_directory;        // where spill runs go, empty -> system temp directory.
+    bool profile = false;               // time the read/parse/count stages per batch.
+    std::size_t lane_jobs = 0;          // input pairs processed at once, 0 -> min(lanes, threads).
+    ReadFilter read_filter;             // quality/N pre-filter, off by default.
+    bool count_only = false;            // skip R2 of pairs without a cell barcode, see R2Sampling.
+    std::size_t r2_sample_every = 64;   // with count_only, R2 of 1 in N of those pairs is still parsed, 0 -> none.
+    UmiLayout umi;                      // antibody UMI position, disabled -> read counts only.
+    const SampleSheet *samples = nullptr; // demultiplex by the header's index reads, counts keyed by sample.
+};
+
+// Seconds per stage with PipelineOptions::profile. With several workers the
+// parse and count stages are summed over workers (thread-seconds); read is
+// the reader thread alone.
+struct StageTimes {
+    double read = 0.0;
+    double r1_parse = 0.0;
+    double r2_parse = 0.0;
+    double count = 0.0;
+};
+
+// R2 reads of pairs without a cell barcode under PipelineOptions::count_only.
+// num_with_ab_payload then only covers parsed reads; the sample's payload rate
+// extrapolates it to the skipped ones.
+struct R2Sampling {
+    std::size_t skipped = 0;      // not parsed.
+    std::size_t sampled = 0;      // parsed to estimate the payload rate.
+    std::size_t sampled_hits = 0; // of those, with a valid payload.
+
+    // num_with_ab_payload as if every R2 had been parsed.
+    double estimated_payloads(std::size_t num_with_ab_payload) const {
+        if (sampled == 0) return static_cast<double>(num_with_ab_payload);
+        return num_with_ab_payload + static_cast<double>(skipped) * sampled_hits / sampled;
+    }
+};
+
+struct PipelineResult {
+    std::size_t total_pairs = 0;
+    std::size_t num_with_barcodes = 0; // measure effectiveness of hamming dictionary
+    std::size_t num_with_ab_payload = 0;
+    std::size_t num_with_both = 0;
+    bool reached_end_of_file = false;
+    MotifWindow r1_motif_window;       // window actually used, learned or from the options.
+    std::size_t r1_learned_from = 0;   // pairs the window was learned from, 0 if given.
+    R1ParseCounters r1_counters;
+    ReadFilterCounters filter_counters; // pairs dropped by the pre-filter, never parsed.
+    R2Sampling r2_sampling;            // all zero unless count_only.
+    std::size_t spill_runs = 0;        // partial tables written to disk, summed back into counts.
+    std::uint64_t spill_bytes = 0;
+    StageTimes stage_times;
+    std::vector<std::size_t> lane_pairs; // pairs read from each input pair, in input order.
+    std::vector<std::size_t> sample_pairs; // with options.samples, pairs per SampleId (undetermined last).
+    CountMatrix counts; // (bc1, bc2) x antibody, by barcode ID.
+    // With options.umi: unique (cell, antibody, UMI) triples, and their count per
+    // (cell, antibody) with rows aligned to counts once the run is complete.
+    UmiSet umis;
+    CountMatrix umi_counts;
+    std::size_t reads_without_umi = 0; // counted reads whose UMI ran off the read or had an N.
+};
+
+PipelineResult run_read_pipeline(FastqPairReader &reader, const BarcodeIndex &cell_barcodes,
+                                 const BarcodeIndex &antibody_barcodes, const PipelineOptions &options);
+// Several R1/R2 pairs (lanes) sharing the whitelists, merged into one result. With
+// slices, lane_pair has the input pair of each reader, for error messages.
+PipelineResult run_read_pipeline(const std::vector<FastqPairReader *> &lanes, const BarcodeIndex &cell_barcodes,
+                                 const BarcodeIndex &antibody_barcodes, const PipelineOptions &options,
+                                 const std::vector<std::size_t> &lane_pair = {});
+
+#endif // READ_PIPELINE_H
@@ -0,0 +1,148 @@
+#include "sample_sheet.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+const std::string UNDETERMINED_NAME = "Undetermined";
+
+/**
+ * @brief trim surrounding whitespace (and a CRLF file's '\r').
+ */
+std::string trim_field(const std::string &field) {
+    const std::size_t first = field.find_first_not_of(" \t\r");
+    if (first == std::string::npos) return std::string();
+    return field.substr(first, field.find_last_not_of(" \t\r") - first + 1);
+}
+
+bool is_index_sequence(const std::string &field) {
+    return !field.empty() && field.find_first_not_of("ACGTN") == std::string::npos;
+}
+
+/**
+ * @brief whether a name is safe in the per-sample TSV name and --mtx subdirectory:
+ * only [A-Za-z0-9._-], and not "." or "..".
+ */
+bool is_sample_name(const std::string &name) {
+    if (name.empty() || name.find_first_not_of('.') == std::string::npos) return false;
+    return std::all_of(name.begin(), name.end(), [](char c) {
+        return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '.' || c == '_' || c == '-';
+    });
+}
+
+} // namespace
+
+/**
+ * @brief load a sample sheet and build the index lookups.
+ *
+ * @param csv_path rows of "sample,i7" or "sample,i7,i5", all rows alike; a first
+ * row whose i7 isn't a base sequence is taken for a header.
+ * @param correction how far an index read may be from its sample's index, per index.
+ */
+SampleSheet::SampleSheet(const std::string &csv_path, const BarcodeCorrection &correction) {
+    std::ifstream csv(csv_path);
+    if (!csv) {
+        throw std::runtime_error("Failed to open sample sheet " + csv_path);
+    }
+
+    std::vector<std::string> i7s, i5s;
+    std::string line;
+    bool first_row = true;
+    while (std::getline(csv, line)) {
+        if (trim_field(line).empty()) continue;
+        std::vector<std::string> fields;
+        std::istringstream split(line);
+        for (std::string field; std::getline(split, field, ',');) {
+            fields.push_back(trim_field(field));
+        }
+        const bool header = first_row && (fields.size() < 2 || !is_index_sequence(fields[1]));
+        first_row = false;
+        if (header) continue;
+
+        if (fields.size() < 2 || fields.size() > 3 || (!i7s.empty() && (fields.size() == 3) != !i5s.empty())) {
+            throw std::runtime_error("Sample sheet rows must all be sample,i7 or all sample,i7,i5: " + line);
+        }
+        const std::string &name = fields[0];
+        if (!is_sample_name(name) || name == UNDETERMINED_NAME) {
+            throw std::runtime_error("Invalid sample name in " + csv_path + ": " + line);
+        }
+        if (std::find(_names_.begin(), _names_.end(), name) != _names_.end()) {
+            throw std::runtime_error("Duplicate sample name in " + csv_path + ": " + name);
+        }
+        if (_names_.size() == MAX_SAMPLES) {
+            throw std::runtime_error("More than " + std::to_string(MAX_SAMPLES) + " samples in " + csv_path);
+        }
+        _names_.push_back(name);
+        i7s.push_back(fields[1]);
+        if (fields.size() == 3) i5s.push_back(fields[2]);
+    }
+    if (_names_.empty()) {
+        throw std::runtime_error("No samples in " + csv_path);
+    }
+
+    _i7_ = BarcodeIndex::from_barcodes(i7s, correction, csv_path + " (i7)");
+    if (!i5s.empty()) {
+        _i5_ = BarcodeIndex::from_barcodes(i5s, correction, csv_path + " (i5)");
+    }
+
+    const std::size_t num_i5 = _i5_ ? _i5_->size() : 1;
+    _sample_of_pair_.assign(_i7_->size() * num_i5, undetermined());
+    for (std::size_t sample = 0; sample < _names_.size(); sample++) {
+        // Every sheet index is canonical in its own index, so this is an exact lookup.
+        const std::size_t i7 = _i7_->find_id(i7s[sample]);
+        const std::size_t i5 = _i5_ ? _i5_->find_id(i5s[sample]) : 0;
+        SampleId &slot = _sample_of_pair_[i7 * num_i5 + i5];
+        if (slot != undetermined()) {
+            throw std::runtime_error("Samples " + _names_[slot] + " and " + _names_[sample] + " share their index in " + csv_path);
+        }
+        slot = static_cast<SampleId>(sample);
+    }
+}
+
+/**
+ * @brief sample name by ID, "Undetermined" for undetermined().
+ */
+const std::string &SampleSheet::name(SampleId id) const {
+    return id < _names_.size() ? _names_[id] : UNDETERMINED_NAME;
+}
+
+/**
+ * @brief index sequences from a header such as "@... 1:N:0:GNAAGATC+AGTCGAAN", in place.
+ *
+ * @param header FASTQ header line.
+ * @param i7 set to the text after the comment's last ':' (up to a '+').
+ * @param i5 set to the text after the '+', empty if there is none.
+ * @return false if the header has no comment.
+ */
+bool SampleSheet::header_index(std::string_view header, std::string_view &i7, std::string_view &i5) {
+    const std::size_t space = header.find(' ');
+    if (space == std::string_view::npos) return false;
+    std::string_view index = header.substr(space + 1);
+    index = index.substr(index.rfind(':') + 1); // npos + 1 -> the whole comment.
+    const std::size_t plus = index.find('+');
+    i7 = index.substr(0, plus);
+    i5 = plus == std::string_view::npos ? std::string_view() : index.substr(plus + 1);
+    return true;
+}
+
+/**
+ * @brief which sample a read pair belongs to, from the index reads in its R1 header.
+ *
+ * Each index is corrected against its own set of sheet indexes; the pair then
+ * has to be one the sheet lists. A single-index sheet ignores any i5.
+ *
+ * @param header R1 header line.
+ * @return SampleId the sample, undetermined() if the indexes don't match one.
+ */
+SampleSheet::SampleId SampleSheet::assign(std::string_view header) const {
+    std::string_view i7, i5;
+    if (!header_index(header, i7, i5)) return undetermined();
+    const BarcodeIndex::BarcodeId i7_id = _i7_->find_id(i7);
+    if (i7_id == BarcodeIndex::NO_BARCODE) return undetermined();
+    if (!_i5_) return _sample_of_pair_[i7_id];
+    const BarcodeIndex::BarcodeId i5_id = _i5_->find_id(i5);
+    if (i5_id == BarcodeIndex::NO_BARCODE) return undetermined();
+    return _sample_of_pair_[static_cast<std::size_t>(i7_id) * _i5_->size() + i5_id];
+}
@@ -0,0 +1,50 @@
+#ifndef SAMPLE_SHEET_H
+#define SAMPLE_SHEET_H
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "barcode_index.h"
+#include "count_matrix.h"
+
+/* Samples of a multiplexed run, told apart by the index reads in the FASTQ header.
+ *
+ * bcl2fastq/BCL Convert record the i7 (and for dual indexing the i5) index at
+ * the end of the header comment, e.g. "1:N:0:GNAAGATC+AGTCGAAN". A sample sheet
+ * CSV has one "sample,i7[,i5]" row per sample (a header row is skipped). The
+ * distinct i7 and i5 sequences each get a BarcodeIndex, so an index read is
+ * corrected like any other barcode, and a small table maps the (i7, i5) pair to
+ * its sample. Pairs no sample claims go to undetermined(). Sample names end up
+ * in output paths, so they are limited to [A-Za-z0-9._-] and may not be "." or "..".
+ *
+ * Sample IDs are CountMatrix::SampleId, counted in the same pass as the cells.
+ */
+class SampleSheet {
+public:
+    using SampleId = CountMatrix::SampleId;
+    static constexpr std::size_t MAX_SAMPLES = CountMatrix::MAX_SAMPLES - 1; // one ID left for undetermined().
+
+    explicit SampleSheet(const std::string &csv_path, const BarcodeCorrection &correction = BarcodeCorrection());
+
+    std::size_t size() const { return _names_.size(); }
+    // IDs in use: the samples, then undetermined().
+    std::size_t num_ids() const { return _names_.size() + 1; }
+    SampleId undetermined() const { return static_cast<SampleId>(_names_.size()); }
+    const std::string &name(SampleId id) const;
+    bool dual_index() const { return _i5_.has_value(); }
+
+    // Sample of a read pair from its R1 header.
+    SampleId assign(std::string_view header) const;
+
+    // i7 and i5 (empty if single-indexed) at the end of a header comment, false if there is no index.
+    static bool header_index(std::string_view header, std::string_view &i7, std::string_view &i5);
+
+private:
+    std::vector<std::string> _names_;
+    std::optional<BarcodeIndex> _i7_;
+    std::optional<BarcodeIndex> _i5_;        // unset for single indexing.
+    std::vector<SampleId> _sample_of_pair_; // i7 ID * i5 set size + i5 ID -> sample.
+};
+
+#endif // SAMPLE_SHEET_H
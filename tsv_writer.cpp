@@ -0,0 +1,224 @@
+#include "tsv_writer.h"
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+namespace {
+
+constexpr std::string_view TSV_HEADER = "cell_id\tcell_bc1\tcell_bc2\tantibody_barcode\tantibody_name\tcount\n";
+constexpr std::string_view TSV_UMI_HEADER = "cell_id\tcell_bc1\tcell_bc2\tantibody_barcode\tantibody_name\tcount\tumi_count\n";
+constexpr std::size_t CELLS_PER_SHARD = 4096;
+
+struct FileCloser {
+    void operator()(std::FILE *f) const { std::fclose(f); }
+};
+using File = std::unique_ptr<std::FILE, FileCloser>;
+
+void write_or_throw(std::FILE *f, std::string_view data, const std::string &path) {
+    if (!data.empty() && std::fwrite(data.data(), 1, data.size(), f) != data.size()) {
+        throw std::runtime_error("Failed to write " + path);
+    }
+}
+
+// What every shard reads: the whole lookup state is built once, up front.
+struct TsvContext {
+    const CountMatrix &counts;
+    const CountMatrix *umi_counts;             // null without UMIs.
+    const BarcodeIndex &cell_barcodes;
+    std::vector<std::string> antibody_fields;  // "\t<barcode>\t<name>\t" by antibody ID.
+    std::vector<std::uint32_t> antibody_rank;
+    std::vector<std::uint32_t> sorted_rows;    // count matrix rows in output order.
+    CountMatrix::Count min_count;
+};
+
+// One shard's output, formatted by whichever thread picked it up.
+struct TsvShard {
+    std::string text;
+    std::size_t cells_written = 0;
+    std::size_t rows_written = 0;
+};
+
+/**
+ * @brief format rows [first, last) of the sorted rows into shard.text.
+ */
+void format_shard(const TsvContext &context, std::size_t first, std::size_t last, TsvShard &shard) {
+    const CountMatrix &counts = context.counts;
+    std::vector<std::pair<BarcodeIndex::BarcodeId, CountMatrix::Count>> sorted_abs;
+    std::string cell_fields;
+    char number[16];
+
+    shard.text.clear();
+    shard.cells_written = 0;
+    shard.rows_written = 0;
+    for (std::size_t i = first; i < last; i++) {
+        const std::size_t row = context.sorted_rows[i];
+        const CountMatrix::Count *antibody_counts = counts.counts(row);
+        const CountMatrix::Count *umi_counts = context.umi_counts ? context.umi_counts->counts(row) : nullptr;
+
+        sorted_abs.clear();
+        for (BarcodeIndex::BarcodeId ab = 0; ab < counts.num_antibodies(); ab++) {
+            if (antibody_counts[ab] >= context.min_count && antibody_counts[ab] > 0) {
+                sorted_abs.emplace_back(ab, antibody_counts[ab]);
+            }
+        }
+        if (sorted_abs.empty()) {
+            continue;
+        }
+        // Ties broken by barcode so output doesn't depend on hash/merge order.
+        std::sort(sorted_abs.begin(), sorted_abs.end(), [&](const auto &a, const auto &b) {
+            return a.second > b.second || (a.second == b.second && context.antibody_rank[a.first] < context.antibody_rank[b.first]);
+        });
+
+        // "bc1_bc2\tbc1\tbc2", shared by all of the cell's rows.
+        const std::string &bc1 = context.cell_barcodes.barcode(counts.bc1(row));
+        const std::string &bc2 = context.cell_barcodes.barcode(counts.bc2(row));
+        cell_fields.assign(bc1).append(1, '_').append(bc2).append(1, '\t').append(bc1).append(1, '\t').append(bc2);
+
+        for (const auto &[ab, count] : sorted_abs) {
+            shard.text.append(cell_fields).append(context.antibody_fields[ab]);
+            const char *end = std::to_chars(number, number + sizeof(number), count).ptr;
+            shard.text.append(number, static_cast<std::size_t>(end - number));
+            if (umi_counts) {
+                end = std::to_chars(number, number + sizeof(number), umi_counts[ab]).ptr;
+                shard.text.append(1, '\t').append(number, static_cast<std::size_t>(end - number));
+            }
+            shard.text.append(1, '\n');
+        }
+        shard.rows_written += sorted_abs.size();
+        shard.cells_written++;
+    }
+}
+
+} // namespace
+
+/**
+ * @brief position of each barcode ID when the barcodes are sorted as strings.
+ *
+ * @param index barcode whitelist.
+ * @return std::vector<std::uint32_t> rank, indexed by barcode ID.
+ */
+std::vector<std::uint32_t> barcode_sort_rank(const BarcodeIndex &index) {
+    std::vector<BarcodeIndex::BarcodeId> ids(index.size());
+    for (std::size_t i = 0; i < ids.size(); i++) {
+        ids[i] = static_cast<BarcodeIndex::BarcodeId>(i);
+    }
+    std::sort(ids.begin(), ids.end(), [&](auto a, auto b) { return index.barcode(a) < index.barcode(b); });
+
+    std::vector<std::uint32_t> rank(index.size());
+    for (std::size_t i = 0; i < ids.size(); i++) {
+        rank[ids[i]] = static_cast<std::uint32_t>(i);
+    }
+    return rank;
+}
+
+/**
+ * @brief count matrix rows in (bc1, bc2) barcode order.
+ *
+ * Sorted on one packed integer per row: bc1 rank, bc2 rank, row. Halves are
+ * fixed length, so this is also "bc1_bc2" string order.
+ *
+ * @param counts cell x antibody table, by barcode ID.
+ * @param cell_barcodes whitelist the cell IDs refer to.
+ * @return std::vector<std::uint32_t> rows in output order.
+ */
+std::vector<std::uint32_t> sorted_cell_rows(const CountMatrix &counts, const BarcodeIndex &cell_barcodes) {
+    const std::vector<std::uint32_t> cell_rank = barcode_sort_rank(cell_barcodes);
+    std::vector<std::uint64_t> keys(counts.num_cells());
+    for (std::size_t row = 0; row < keys.size(); row++) {
+        keys[row] = static_cast<std::uint64_t>(cell_rank[counts.bc1(row)]) << 48 |
+                    static_cast<std::uint64_t>(cell_rank[counts.bc2(row)]) << 32 | row;
+    }
+    std::sort(keys.begin(), keys.end());
+    std::vector<std::uint32_t> rows(keys.size());
+    for (std::size_t i = 0; i < keys.size(); i++) {
+        rows[i] = static_cast<std::uint32_t>(keys[i]);
+    }
+    return rows;
+}
+
+/**
+ * @brief write the count table as antibody_counts.tsv-style text.
+ *
+ * Shards of CELLS_PER_SHARD cells are formatted options.threads at a time, then
+ * written in order while nothing else runs, so output is identical for any
+ * thread count and memory stays at about options.threads shards of text.
+ *
+ * @param path output file, replaced.
+ * @param counts cell x antibody table, by barcode ID.
+ * @param cell_barcodes whitelist the cell IDs refer to.
+ * @param antibody_barcodes whitelist the antibody IDs refer to, names from its labels.
+ * @param options row threshold, formatting threads and optional UMI counts.
+ * @return TsvSummary what was written.
+ */
+TsvSummary write_counts_tsv(const std::string &path, const CountMatrix &counts, const BarcodeIndex &cell_barcodes,
+                            const BarcodeIndex &antibody_barcodes, const TsvOptions &options) {
+    File out(std::fopen(path.c_str(), "wb"));
+    if (!out) {
+        throw std::runtime_error("could not open " + path + " for writing");
+    }
+
+    if (options.umi_counts && (options.umi_counts->num_cells() != counts.num_cells() ||
+                               options.umi_counts->num_antibodies() != counts.num_antibodies())) {
+        throw std::runtime_error("UMI counts don't match the read count table");
+    }
+    TsvContext context{counts, options.umi_counts, cell_barcodes, {}, barcode_sort_rank(antibody_barcodes), {},
+                       static_cast<CountMatrix::Count>(std::min<std::size_t>(options.min_count, UINT32_MAX))};
+
+    // Antibody fields by ID, resolved once instead of per row.
+    context.antibody_fields.resize(counts.num_antibodies());
+    for (BarcodeIndex::BarcodeId ab = 0; ab < counts.num_antibodies(); ab++) {
+        const std::string &name = antibody_barcodes.label(ab);
+        context.antibody_fields[ab] = "\t" + antibody_barcodes.barcode(ab) + "\t" + (name.empty() ? "UNKNOWN" : name) + "\t";
+    }
+
+    context.sorted_rows = sorted_cell_rows(counts, cell_barcodes);
+
+    TsvSummary summary;
+    const std::string_view header = options.umi_counts ? TSV_UMI_HEADER : TSV_HEADER;
+    write_or_throw(out.get(), header, path);
+    summary.bytes_written += header.size();
+
+    const std::size_t num_rows = context.sorted_rows.size();
+    const std::size_t num_shards = (num_rows + CELLS_PER_SHARD - 1) / CELLS_PER_SHARD;
+    const std::size_t threads = std::clamp<std::size_t>(options.threads, 1, std::max<std::size_t>(1, num_shards));
+    std::vector<TsvShard> shards(threads);
+    std::vector<std::exception_ptr> errors(threads);
+    auto format = [&](std::size_t shard, std::size_t slot) {
+        try {
+            const std::size_t first = shard * CELLS_PER_SHARD;
+            format_shard(context, first, std::min(num_rows, first + CELLS_PER_SHARD), shards[slot]);
+        } catch (...) {
+            errors[slot] = std::current_exception();
+        }
+    };
+
+    for (std::size_t round = 0; round < num_shards; round += threads) {
+        const std::size_t in_round = std::min(threads, num_shards - round);
+        std::vector<std::thread> helpers;
+        for (std::size_t slot = 1; slot < in_round; slot++) {
+            helpers.emplace_back(format, round + slot, slot);
+        }
+        format(round, 0);
+        for (std::thread &helper : helpers) {
+            helper.join();
+        }
+        for (std::size_t slot = 0; slot < in_round; slot++) {
+            if (errors[slot]) std::rethrow_exception(errors[slot]);
+            write_or_throw(out.get(), shards[slot].text, path);
+            summary.bytes_written += shards[slot].text.size();
+            summary.cells_written += shards[slot].cells_written;
+            summary.rows_written += shards[slot].rows_written;
+        }
+    }
+
+    if (std::fclose(out.release()) != 0) {
+        throw std::runtime_error("Failed to write " + path);
+    }
+    return summary;
+}
@@ -0,0 +1,39 @@
+#ifndef TSV_WRITER_H
+#define TSV_WRITER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "barcode_index.h"
+#include "count_matrix.h"
+
+/* antibody_counts.tsv: one row per (cell, antibody) with at least min_count reads.
+ *
+ * Cells come in barcode order (bc1, then bc2), antibodies by count descending
+ * with ties broken by barcode, so the file doesn't depend on counting order.
+ * Everything is sorted and looked up by integer ID. Shards of cells are
+ * formatted into per-thread buffers with std::to_chars and written in order
+ * with one large write per shard. Given UMI counts, a umi_count column follows
+ * count.
+ */
+struct TsvOptions {
+    std::size_t min_count = 10; // rows below this are left out.
+    std::size_t threads = 1;    // formatting threads, including the caller.
+    const CountMatrix *umi_counts = nullptr; // rows aligned with the read counts, adds umi_count.
+};
+
+struct TsvSummary {
+    std::size_t cells_written = 0; // cells with at least one row.
+    std::size_t rows_written = 0;
+    std::uint64_t bytes_written = 0;
+};
+
+TsvSummary write_counts_tsv(const std::string &path, const CountMatrix &counts, const BarcodeIndex &cell_barcodes,
+                            const BarcodeIndex &antibody_barcodes, const TsvOptions &options);
+
+// Position of each barcode ID when the barcodes are sorted as strings.
+std::vector<std::uint32_t> barcode_sort_rank(const BarcodeIndex &index);
+// Count matrix rows in output (bc1, bc2 barcode) order, shared with the other writers.
+std::vector<std::uint32_t> sorted_cell_rows(const CountMatrix &counts, const BarcodeIndex &cell_barcodes);
+
+#endif // TSV_WRITER_H
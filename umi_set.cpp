@@ -0,0 +1,103 @@
+#include "umi_set.h"
+#include <stdexcept>
+
+namespace {
+
+constexpr std::size_t INITIAL_SLOTS = 1 << 12;
+
+/**
+ * @brief slot of a key in a table of mask + 1 slots (Fibonacci hashing).
+ */
+std::size_t home_slot(std::uint64_t key, std::size_t mask) {
+    return static_cast<std::size_t>((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+}
+
+} // namespace
+
+/**
+ * @brief pack a UMI as 2 bits per base, first base highest.
+ *
+ * @param umi UMI bases.
+ * @param bits set to the packed UMI on success.
+ * @return bool false if the UMI is longer than MAX_UMI_LENGTH or has a base other than ACGT.
+ */
+bool UmiSet::pack_umi(std::string_view umi, std::uint32_t &bits) {
+    if (umi.size() > MAX_UMI_LENGTH) return false;
+    bits = 0;
+    for (char base : umi) {
+        std::uint32_t code;
+        switch (base)
+        {
+        case 'A': code = 0; break;
+        case 'C': code = 1; break;
+        case 'G': code = 2; break;
+        case 'T': code = 3; break;
+        default: return false;
+        }
+        bits = bits << 2 | code;
+    }
+    return true;
+}
+
+/**
+ * @brief add a key, a no-op if it is already there.
+ *
+ * The table doubles once it is half full, which keeps probe runs short.
+ */
+void UmiSet::insert(std::uint64_t key) {
+    if (2 * (_size_ + 1) > _slots_.size()) grow();
+    const std::size_t mask = _slots_.size() - 1;
+    for (std::size_t slot = home_slot(key, mask);; slot = (slot + 1) & mask) {
+        if (_slots_[slot] == key) return;
+        if (_slots_[slot] == EMPTY) {
+            _slots_[slot] = key;
+            _size_++;
+            return;
+        }
+    }
+}
+
+/**
+ * @brief add every key of another set, used to combine worker sets.
+ */
+void UmiSet::merge(const UmiSet &other) {
+    for (std::uint64_t key : other._slots_) {
+        if (key != EMPTY) insert(key);
+    }
+}
+
+/**
+ * @brief unique UMIs per (cell, antibody), in a table laid out like reads.
+ *
+ * Every key comes from a counted read, so its cell has a row in reads; those
+ * rows are created first, in reads' order, and row i of the result is the same
+ * cell as row i of reads.
+ *
+ * @param reads read counts the UMIs were collected next to.
+ * @return CountMatrix UMI counts, same rows and antibodies as reads.
+ */
+CountMatrix UmiSet::counts_like(const CountMatrix &reads) const {
+    CountMatrix umis(reads.num_antibodies());
+    if (reads.num_antibodies() == 0) return umis;
+    for (std::size_t row = 0; row < reads.num_cells(); row++) {
+        umis.add(reads.bc1(row), reads.bc2(row), 0, 0);
+    }
+    for (std::uint64_t key : _slots_) {
+        if (key == EMPTY) continue;
+        umis.add(static_cast<BarcodeId>(key >> 50 & ID_MASK), static_cast<BarcodeId>(key >> 37 & ID_MASK),
+                 static_cast<BarcodeId>(key >> 24 & ID_MASK));
+    }
+    if (umis.num_cells() != reads.num_cells()) {
+        throw std::runtime_error("UMI set holds cells without read counts");
+    }
+    return umis;
+}
+
+void UmiSet::grow() {
+    std::vector<std::uint64_t> old = std::move(_slots_);
+    _slots_.assign(old.empty() ? INITIAL_SLOTS : 2 * old.size(), EMPTY);
+    _size_ = 0;
+    for (std::uint64_t key : old) {
+        if (key != EMPTY) insert(key);
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef UMI_SET_H
+#define UMI_SET_H
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include "barcode_index.h"
+#include "count_matrix.h"
+
+/* Unique (cell, antibody, UMI) triples, for counting molecules instead of reads.
+ *
+ * Each triple is one packed 64-bit key: bc1, bc2 and antibody IDs (13 bits
+ * each, as in BarcodeIndex's tables) above a 2-bit-per-base UMI of up to
+ * MAX_UMI_LENGTH bases. Keys live in an open-addressing table with linear
+ * probing, so a read costs one multiply-shift hash and usually one cache line,
+ * and each unique molecule 8-16 bytes. Every worker fills a private set; sets
+ * are merged after the threads are joined.
+ */
+class UmiSet {
+public:
+    using BarcodeId = BarcodeIndex::BarcodeId;
+    static constexpr std::size_t MAX_UMI_LENGTH = 12;
+    static constexpr std::uint64_t ID_MASK = 0x1FFF;
+
+    // UMI bases as 2-bit codes, false if it is too long or holds anything but ACGT.
+    static bool pack_umi(std::string_view umi, std::uint32_t &bits);
+    static std::uint64_t key(BarcodeId bc1, BarcodeId bc2, BarcodeId antibody, std::uint32_t umi_bits) {
+        return static_cast<std::uint64_t>(bc1 & ID_MASK) << 50 |
+               static_cast<std::uint64_t>(bc2 & ID_MASK) << 37 |
+               static_cast<std::uint64_t>(antibody & ID_MASK) << 24 | umi_bits;
+    }
+
+    void insert(std::uint64_t key);
+    void merge(const UmiSet &other);
+
+    std::size_t size() const { return _size_; }
+    std::size_t memory_bytes() const { return _slots_.capacity() * sizeof(std::uint64_t); }
+
+    // Unique UMIs per (cell, antibody), rows in the same order as reads'.
+    CountMatrix counts_like(const CountMatrix &reads) const;
+
+private:
+    static constexpr std::uint64_t EMPTY = ~std::uint64_t(0); // never a key, the top bit is always clear.
+
+    std::vector<std::uint64_t> _slots_;
+    std::size_t _size_ = 0;
+
+    void grow();
+};
+
+#endif // UMI_SET_H